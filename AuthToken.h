@@ -1,81 +1,272 @@
 #ifndef _AuthToken_h
 #define _AuthToken_h
 
+/*
+ * A signed authentication token of the form
+ *
+ *   un=user|tokenid=...|expiry=1600000000|...|SigningSubject=url|sig=hexdigits
+ *
+ * The token text is held in a fixed buffer inside the object and the
+ * fields we need are kept as offsets into it, so parsing (and copying)
+ * a token never touches the heap. The Session only copies the raw
+ * header in with assign(); the parse happens when dispatch finds that
+ * the method needs authentication.
+ *
+ * The signed text is every field except sig, joined by '|'. Since sig
+ * is normally the last field, that is a prefix of the token; text_parts()
+ * returns it as at most two pieces of the token text.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <ctime>
 #include <cstring>
 #include <iostream>
-#include <iomanip>
-#include <sstream>
-#include <fstream>
-#include <vector>
-#include <map>
+#include <string>
 
-#include <boost/algorithm/string.hpp>
-#include <boost/beast/core/string_type.hpp>
+#include <boost/utility/string_view.hpp>
 
 class AuthToken
 {
+public:
+    static const size_t max_token_size = 2048;
+    static const size_t max_signature_size = 512;
+
+    /*
+     * The decoded signature bytes.
+     */
+    class Bytes
+    {
+	const unsigned char *data_;
+	size_t size_;
+    public:
+	Bytes(const unsigned char *data, size_t size) : data_(data), size_(size) {}
+	const unsigned char *data() const { return data_; }
+	size_t size() const { return size_; }
+	const unsigned char *begin() const { return data_; }
+	const unsigned char *end() const { return data_ + size_; }
+    };
+
 private:
-    std::map<std::string, std::string> parts_;
-    std::string text_;
-    std::vector<unsigned char> binary_signature_;
-    std::string token_;
-    
+    struct Field
+    {
+	uint16_t off;
+	uint16_t len;
+    };
+
+    char buf_[max_token_size];
+    size_t len_;
+
+    Field user_;
+    Field signing_subject_;
+    Field sig_;			// the sig value
+    Field sig_field_;		// "sig=..." including the key
+    unsigned long expiry_;
+
+    unsigned char binary_signature_[max_signature_size];
+    size_t signature_len_;
+
+    bool parsed_;
     bool valid_;
-    
-public:
-    AuthToken(const std::string &str) : valid_(false) {
-	std::stringstream ifstr(str);
-	ifstr >> *this;
+
+    boost::string_view view(Field f) const { return boost::string_view(buf_ + f.off, f.len); }
+
+    void reset_fields() {
+	user_ = signing_subject_ = sig_ = sig_field_ = Field{0, 0};
+	expiry_ = 0;
+	signature_len_ = 0;
+	valid_ = false;
     }
-    AuthToken() : valid_(false) { }
 
-    AuthToken(const AuthToken &t)
-	: parts_(t.parts_)
-	, text_(t.text_)
-	, binary_signature_(t.binary_signature_)
-	, token_(t.token_)
-	, valid_(t.valid_) {}
+    void copy_from(const AuthToken &t) {
+	memcpy(buf_, t.buf_, t.len_);
+	len_ = t.len_;
+	user_ = t.user_;
+	signing_subject_ = t.signing_subject_;
+	sig_ = t.sig_;
+	sig_field_ = t.sig_field_;
+	expiry_ = t.expiry_;
+	memcpy(binary_signature_, t.binary_signature_, t.signature_len_);
+	signature_len_ = t.signature_len_;
+	parsed_ = t.parsed_;
+	valid_ = t.valid_;
+    }
+
+    /*
+     * Value of a hex digit, or -1.
+     */
+    static int hex_value(unsigned char c) {
+	struct Table
+	{
+	    signed char v[256];
+	    constexpr Table() : v() {
+		for (int i = 0; i < 256; i++)
+		    v[i] = -1;
+		for (int i = 0; i < 10; i++)
+		    v['0' + i] = i;
+		for (int i = 0; i < 6; i++)
+		{
+		    v['a' + i] = 10 + i;
+		    v['A' + i] = 10 + i;
+		}
+	    }
+	};
+	static constexpr Table table;
+	return table.v[c];
+    }
+
+    bool decode_signature(boost::string_view hex) {
+	if (hex.size() % 2 != 0 || hex.size() / 2 > max_signature_size)
+	    return false;
+	for (size_t i = 0; i < hex.size(); i += 2)
+	{
+	    int hi = hex_value(hex[i]);
+	    int lo = hex_value(hex[i + 1]);
+	    if (hi < 0 || lo < 0)
+		return false;
+	    binary_signature_[i / 2] = static_cast<unsigned char>(hi << 4 | lo);
+	}
+	signature_len_ = hex.size() / 2;
+	return true;
+    }
+
+    static bool parse_number(boost::string_view s, unsigned long &val) {
+	if (s.empty() || s.size() > 19)
+	    return false;
+	val = 0;
+	for (char c: s)
+	{
+	    if (c < '0' || c > '9')
+		return false;
+	    val = val * 10 + (c - '0');
+	}
+	return true;
+    }
+
+public:
+    AuthToken() : len_(0), signature_len_(0), parsed_(true), valid_(false) { reset_fields(); }
+    explicit AuthToken(boost::string_view str) : AuthToken() { parse(str); }
+    AuthToken(const std::string &str) : AuthToken() { parse(str); }
+    AuthToken(const char *str) : AuthToken() { parse(boost::string_view(str)); }
+
+    AuthToken(const AuthToken &t) { copy_from(t); }
+    AuthToken &operator=(const AuthToken &t) {
+	if (this != &t)
+	    copy_from(t);
+	return *this;
+    }
 
     void clear() {
-	parts_.clear();
-	text_ = "";
-	token_.clear();
-	binary_signature_.clear();
-	valid_ = false;
+	len_ = 0;
+	parsed_ = true;
+	reset_fields();
+    }
+
+    /*
+     * Take a copy of the token text without parsing it. Until parse()
+     * is called the token is not valid.
+     */
+    void assign(boost::string_view sv) {
+	// Tokens read from files carry a trailing newline.
+	while (!sv.empty() && (sv.back() == '\n' || sv.back() == '\r' || sv.back() == ' '))
+	    sv.remove_suffix(1);
+	reset_fields();
+	if (sv.size() > max_token_size)
+	{
+	    // Too long to be one of ours; leave it empty and invalid.
+	    len_ = 0;
+	    parsed_ = true;
+	    return;
+	}
+	memcpy(buf_, sv.data(), sv.size());
+	len_ = sv.size();
+	parsed_ = false;
     }
 
-    void parse(boost::string_view &sv) {
-	std::stringstream ifstr(std::string(sv.data(), sv.size()));
-	ifstr >> *this;
+    /*
+     * Parse the text given to assign(). A token is parsed only once.
+     */
+    void parse() {
+	if (parsed_)
+	    return;
+	parsed_ = true;
+
+	boost::string_view s(buf_, len_);
+	bool have_expiry = false;
+	bool ok = true;
+	size_t pos = 0;
+	while (ok && pos < len_)
+	{
+	    size_t bar = s.find('|', pos);
+	    if (bar == boost::string_view::npos)
+		bar = len_;
+	    boost::string_view field = s.substr(pos, bar - pos);
+	    size_t eq = field.find('=');
+	    if (eq != boost::string_view::npos)
+	    {
+		boost::string_view key = field.substr(0, eq);
+		Field value{static_cast<uint16_t>(pos + eq + 1), static_cast<uint16_t>(bar - pos - eq - 1)};
+		if (key == "un")
+		    user_ = value;
+		else if (key == "SigningSubject")
+		    signing_subject_ = value;
+		else if (key == "expiry")
+		    ok = have_expiry = parse_number(view(value), expiry_);
+		else if (key == "sig")
+		{
+		    // A second signature would leave the signed text ambiguous.
+		    ok = sig_.len == 0 && decode_signature(view(value));
+		    sig_ = value;
+		    sig_field_ = Field{static_cast<uint16_t>(pos), static_cast<uint16_t>(bar - pos)};
+		}
+	    }
+	    pos = bar + 1;
+	}
+
+	valid_ = ok && have_expiry && user_.len > 0 && signing_subject_.len > 0 && signature_len_ > 0;
     }
 
-    void parse(const std::string &s) {
-	std::stringstream ifstr(s);
-	ifstr >> *this;
+    void parse(boost::string_view sv) {
+	assign(sv);
+	parse();
+    }
+
+    void parse(const std::string &s) { parse(boost::string_view(s)); }
+
+    boost::string_view user() const { return view(user_); }
+    boost::string_view signing_subject() const { return view(signing_subject_); }
+    boost::string_view signature() const { return view(sig_); }
+    unsigned long expiry() const { return expiry_; }
+    boost::string_view token() const { return boost::string_view(buf_, len_); }
+    Bytes binary_signature() const { return Bytes(binary_signature_, signature_len_); }
+
+    /*
+     * The signed text: the token less its sig field and the '|'
+     * that separates it from its neighbour. The second piece is
+     * empty unless sig is in the middle of the token.
+     */
+    std::array<boost::string_view, 2> text_parts() const {
+	boost::string_view s = token();
+	size_t begin = sig_field_.off;
+	size_t end = sig_field_.off + sig_field_.len;
+	if (begin == 0)
+	    return {{ s.substr(std::min(end + 1, len_)), boost::string_view() }};
+	return {{ s.substr(0, begin - 1), s.substr(end) }};
     }
 
-    const std::string &user() const { return parts_.at("un"); }
-    const std::string &signing_subject() const { return parts_.at("SigningSubject"); }
-    const std::string &signature() const { return parts_.at("sig"); }
-    unsigned long expiry() const { return  std::stoul(parts_.at("expiry")); }
-    const std::string &text() const { return text_; }
-    const std::string &token() const { return token_; }
-    const std::vector<unsigned char> & binary_signature() const { return binary_signature_; }
-    
     bool is_expired() const {
 	std::time_t now = std::time(nullptr);
-	return expiry() < now;
+	return expiry() < static_cast<unsigned long>(now);
     }
 
+    bool parsed() const { return parsed_; }
     bool valid() const { return valid_; }
 
     /*
      * A token may be invalidated if verification fails.
      */
     void invalidate() { valid_ = false; }
-
-    friend std::istream& operator>>(std::istream& is, AuthToken& tok);
 };
 
 inline std::ostream &operator<<(std::ostream &os, const AuthToken &tok)
@@ -91,88 +282,20 @@ inline std::ostream &operator<<(std::ostream &os, const AuthToken &tok)
     }
     else
 	os << "InvalidToken()";
-    
+
     return os;
 }
 
+/*
+ * Read a token from a stream (e.g. a saved token file). The token is
+ * the first line.
+ */
 inline std::istream& operator>>(std::istream& is, AuthToken& tok)
 {
-    try {
-	std::stringstream all;
-	std::stringstream tok_str;
-	bool first = true;
-	while (is)
-	{
-	    char c;
-	    std::stringstream sstr;
-	    if (!is.get(*sstr.rdbuf(), '='))
-		break;
-	    
-	    std::string k = std::move(sstr.str());
-	    tok_str << k;
-	    
-	    if (k != "sig")
-	    {
-		if (!first)
-		    all << "|";
-		first = false;
-		all << k;
-	    }
-	    if (is.get(c))
-	    {
-		tok_str << c;
-		if (k != "sig")
-		    all << c;
-	    }
-
-	    std::stringstream sstr2;
-	    if (!is.get(*sstr2.rdbuf(), '|'))
-		break;
-	    std::string v = std::move(sstr2.str());
-	    tok_str << v;
-	    
-	    if (v.back() == '\n')
-		v.pop_back();
-	    if (k != "sig")
-		all << v;
-	    if (is.get(c))
-		tok_str << c;
-
-	    if (k == "sig")
-	    {
-		std::istringstream hex_chars_stream(v);
-		tok.binary_signature_.reserve(v.size() / 2);
-		char g[3];
-		g[2] = 0;
-		while (hex_chars_stream.get(g, 3))
-		{
-		    unsigned int c = std::stoi(g, 0, 16);
-		    tok.binary_signature_.push_back(c);
-		}
-	    }
-	    tok.parts_.emplace(std::make_pair(k,v));
-	}
-	tok.text_ = std::move(all.str());
-	tok.token_ = std::move(tok_str.str());
-
-	// Ensure we have the fields we need.
-
-	if (!tok.parts_.at("un").empty() &&
-	    !tok.parts_.at("SigningSubject").empty() &&
-	    !tok.parts_.at("sig").empty() &&
-	    !tok.parts_.at("expiry").empty())
-	{
-	    tok.valid_ = true;
-	}
-       
-    }
-    catch (std::exception e)
-    {
-	tok.valid_ = false;
-    }
+    std::string line;
+    std::getline(is, line);
+    tok.parse(line);
     return is;
 }
 
-
-
 #endif
@@ -19,4 +19,25 @@ inline std::string base64EncodeText(std::string text) {
     return ss.str();
 }
 
+/*
+ * Inverse of base64EncodeText. Throws if text contains characters
+ * outside the base64 alphabet.
+ */
+inline std::string base64DecodeText(std::string text) {
+    using namespace boost::archive::iterators;
+    typedef transform_width<binary_from_base64<std::string::const_iterator>, 8, 6> base64_dec;
+
+    size_t padding = 0;
+    while (!text.empty() && text.back() == '=')
+    {
+	text.pop_back();
+	padding++;
+    }
+    // Decode the padding as zero bits and drop the bytes it produced.
+    text.append(padding, 'A');
+    std::string res(base64_dec(text.begin()), base64_dec(text.end()));
+    res.erase(res.size() - std::min(padding, res.size()));
+    return res;
+}
+
 #endif
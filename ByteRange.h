@@ -0,0 +1,156 @@
+#ifndef _ByteRange_h
+#define _ByteRange_h
+
+/*
+ * Parse the byte ranges from an HTTP Range request header (RFC 7233).
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+struct ByteRange
+{
+    uint64_t first;
+    uint64_t last;		// inclusive
+
+    uint64_t length() const { return last - first + 1; }
+
+    // The value for a Content-Range header for this range of an object of the given size.
+    std::string content_range(uint64_t size) const {
+	return "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size);
+    }
+};
+
+enum class RangeParseResult
+{
+    Ignore,			// Malformed or not a byte range; send the whole object
+    Satisfiable,
+    Unsatisfiable,		// Valid, but no range overlaps the object; send 416
+};
+
+/*
+ * Parse spec (e.g. "bytes=0-499, 1000-, -500") against an object of the
+ * given size, filling ranges with the clipped ranges to send.
+ *
+ * Overlapping and adjacent ranges are coalesced and the result sorted
+ * by offset. A request for more than max_ranges distinct ranges is
+ * ignored rather than served piecemeal.
+ */
+inline RangeParseResult parse_byte_ranges(boost::string_view spec, uint64_t size,
+					  std::vector<ByteRange> &ranges,
+					  size_t max_ranges = 32)
+{
+    ranges.clear();
+
+    auto is_space = [](char c) { return c == ' ' || c == '\t'; };
+    auto trim = [&is_space](boost::string_view s) {
+	while (!s.empty() && is_space(s.front()))
+	    s.remove_prefix(1);
+	while (!s.empty() && is_space(s.back()))
+	    s.remove_suffix(1);
+	return s;
+    };
+
+    // Parse a non-empty run of digits making up all of s.
+    auto parse_number = [](boost::string_view s, uint64_t &val) {
+	if (s.empty())
+	    return false;
+	val = 0;
+	for (char c : s)
+	{
+	    if (c < '0' || c > '9')
+		return false;
+	    uint64_t d = c - '0';
+	    if (val > (UINT64_MAX - d) / 10)
+		return false;
+	    val = val * 10 + d;
+	}
+	return true;
+    };
+
+    spec = trim(spec);
+    const boost::string_view unit("bytes=");
+    if (spec.size() < unit.size())
+	return RangeParseResult::Ignore;
+    for (size_t i = 0; i < unit.size(); i++)
+	if (std::tolower(spec[i]) != unit[i])
+	    return RangeParseResult::Ignore;
+    spec.remove_prefix(unit.size());
+
+    bool have_spec = false;
+    while (!spec.empty())
+    {
+	auto comma = spec.find(',');
+	auto item = trim(spec.substr(0, comma));
+	spec = comma == boost::string_view::npos ? boost::string_view() : spec.substr(comma + 1);
+
+	// Empty list elements are permitted.
+	if (item.empty())
+	    continue;
+	have_spec = true;
+
+	auto dash = item.find('-');
+	if (dash == boost::string_view::npos)
+	    return RangeParseResult::Ignore;
+
+	auto first_str = trim(item.substr(0, dash));
+	auto last_str = trim(item.substr(dash + 1));
+	uint64_t first, last;
+
+	if (first_str.empty())
+	{
+	    // Suffix range: the final N bytes.
+	    uint64_t n;
+	    if (!parse_number(last_str, n))
+		return RangeParseResult::Ignore;
+	    if (n == 0 || size == 0)
+		continue;
+	    first = n < size ? size - n : 0;
+	    last = size - 1;
+	}
+	else
+	{
+	    if (!parse_number(first_str, first))
+		return RangeParseResult::Ignore;
+	    if (last_str.empty())
+		last = UINT64_MAX;
+	    else if (!parse_number(last_str, last) || last < first)
+		return RangeParseResult::Ignore;
+	    if (first >= size)
+		continue;
+	    last = std::min(last, size - 1);
+	}
+	ranges.push_back(ByteRange{first, last});
+    }
+
+    if (!have_spec)
+	return RangeParseResult::Ignore;
+    if (ranges.empty())
+	return RangeParseResult::Unsatisfiable;
+
+    std::sort(ranges.begin(), ranges.end(),
+	      [](const ByteRange &a, const ByteRange &b) { return a.first < b.first; });
+    size_t out = 0;
+    for (size_t i = 1; i < ranges.size(); i++)
+    {
+	if (ranges[i].first <= ranges[out].last + 1)
+	    ranges[out].last = std::max(ranges[out].last, ranges[i].last);
+	else
+	    ranges[++out] = ranges[i];
+    }
+    ranges.resize(out + 1);
+
+    if (ranges.size() > max_ranges)
+    {
+	ranges.clear();
+	return RangeParseResult::Ignore;
+    }
+    return RangeParseResult::Satisfiable;
+}
+
+#endif
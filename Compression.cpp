@@ -0,0 +1,330 @@
+#include "Compression.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <new>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace compression;
+namespace errc = boost::system::errc;
+
+const char *compression::encoding_name(Encoding enc)
+{
+    switch (enc)
+    {
+    case Encoding::gzip:
+	return "gzip";
+    case Encoding::deflate:
+	return "deflate";
+    case Encoding::zstd:
+	return "zstd";
+    default:
+	return "identity";
+    }
+}
+
+static boost::string_view trim(boost::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+	s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+	s.remove_suffix(1);
+    return s;
+}
+
+static bool iequals(boost::string_view a, const char *b)
+{
+    size_t n = strlen(b);
+    if (a.size() != n)
+	return false;
+    for (size_t i = 0; i < n; i++)
+	if (std::tolower(a[i]) != b[i])
+	    return false;
+    return true;
+}
+
+static bool coding_from_token(boost::string_view tok, Encoding &enc)
+{
+    if (iequals(tok, "gzip") || iequals(tok, "x-gzip"))
+	enc = Encoding::gzip;
+    else if (iequals(tok, "deflate"))
+	enc = Encoding::deflate;
+#ifdef HAVE_ZSTD
+    else if (iequals(tok, "zstd"))
+	enc = Encoding::zstd;
+#endif
+    else if (iequals(tok, "identity"))
+	enc = Encoding::identity;
+    else
+	return false;
+    return true;
+}
+
+Encoding compression::negotiate(boost::string_view accept_encoding)
+{
+    /*
+     * q-values for the codings we support, in our order of preference.
+     * -1 means not mentioned.
+     */
+    const Encoding preference[] = { Encoding::zstd, Encoding::gzip, Encoding::deflate };
+    double q[4] = { -1, -1, -1, -1 };
+    double q_star = -1;
+
+    while (!accept_encoding.empty())
+    {
+	auto comma = accept_encoding.find(',');
+	auto item = trim(accept_encoding.substr(0, comma));
+	accept_encoding = comma == boost::string_view::npos ? boost::string_view() : accept_encoding.substr(comma + 1);
+	if (item.empty())
+	    continue;
+
+	double qval = 1.0;
+	auto semi = item.find(';');
+	auto token = trim(item.substr(0, semi));
+	if (semi != boost::string_view::npos)
+	{
+	    auto param = trim(item.substr(semi + 1));
+	    if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+		qval = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+	}
+
+	Encoding enc;
+	if (token == "*")
+	    q_star = qval;
+	else if (coding_from_token(token, enc))
+	    q[static_cast<int>(enc)] = qval;
+    }
+
+    Encoding best = Encoding::identity;
+    double best_q = 0;
+    for (auto enc: preference)
+    {
+	double v = q[static_cast<int>(enc)];
+	if (v < 0)
+	    v = q_star;
+#ifndef HAVE_ZSTD
+	if (enc == Encoding::zstd)
+	    continue;
+#endif
+	if (v > best_q)
+	{
+	    best = enc;
+	    best_q = v;
+	}
+    }
+    return best;
+}
+
+bool compression::parse_content_encoding(boost::string_view content_encoding, Encoding &enc)
+{
+    auto token = trim(content_encoding);
+    if (token.empty())
+    {
+	enc = Encoding::identity;
+	return true;
+    }
+    // We don't decode stacked codings.
+    if (token.find(',') != boost::string_view::npos)
+	return false;
+    return coding_from_token(token, enc);
+}
+
+/*
+ * zlib implementations. The window bits select the framing:
+ * 15 + 16 writes a gzip header, plain 15 the zlib format used by
+ * HTTP "deflate", and 15 + 32 on inflate accepts either.
+ */
+
+class ZlibCompressor
+    : public Compressor
+{
+    z_stream zs_;
+    bool done_;
+public:
+    ZlibCompressor(Encoding enc, int level)
+	: done_(false) {
+	memset(&zs_, 0, sizeof(zs_));
+	int window_bits = enc == Encoding::gzip ? 15 + 16 : 15;
+	if (deflateInit2(&zs_, level < 0 ? Z_DEFAULT_COMPRESSION : level,
+			 Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	    throw std::bad_alloc();
+    }
+    ~ZlibCompressor() {
+	deflateEnd(&zs_);
+    }
+
+    void input(const char *data, size_t size) override {
+	zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	zs_.avail_in = size;
+    }
+
+    size_t output(char *buf, size_t size, bool finish, boost::system::error_code &ec) override {
+	if (done_)
+	    return 0;
+	zs_.next_out = reinterpret_cast<Bytef *>(buf);
+	zs_.avail_out = size;
+	int rc = deflate(&zs_, finish ? Z_FINISH : Z_NO_FLUSH);
+	if (rc == Z_STREAM_END)
+	    done_ = true;
+	else if (rc != Z_OK && rc != Z_BUF_ERROR)
+	    ec = errc::make_error_code(errc::io_error);
+	return size - zs_.avail_out;
+    }
+
+    bool done() const override { return done_; }
+};
+
+class ZlibDecompressor
+    : public Decompressor
+{
+    z_stream zs_;
+    bool done_;
+public:
+    ZlibDecompressor()
+	: done_(false) {
+	memset(&zs_, 0, sizeof(zs_));
+	if (inflateInit2(&zs_, 15 + 32) != Z_OK)
+	    throw std::bad_alloc();
+    }
+    ~ZlibDecompressor() {
+	inflateEnd(&zs_);
+    }
+
+    void input(const char *data, size_t size) override {
+	zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	zs_.avail_in = size;
+    }
+
+    size_t output(char *buf, size_t size, boost::system::error_code &ec) override {
+	if (done_)
+	    return 0;
+	zs_.next_out = reinterpret_cast<Bytef *>(buf);
+	zs_.avail_out = size;
+	int rc = inflate(&zs_, Z_NO_FLUSH);
+	if (rc == Z_STREAM_END)
+	    done_ = true;
+	else if (rc == Z_DATA_ERROR || rc == Z_NEED_DICT)
+	    ec = errc::make_error_code(errc::illegal_byte_sequence);
+	else if (rc != Z_OK && rc != Z_BUF_ERROR)
+	    ec = errc::make_error_code(errc::io_error);
+	return size - zs_.avail_out;
+    }
+
+    bool done() const override { return done_; }
+};
+
+#ifdef HAVE_ZSTD
+
+class ZstdCompressor
+    : public Compressor
+{
+    ZSTD_CCtx *cctx_;
+    ZSTD_inBuffer in_;
+    bool done_;
+public:
+    ZstdCompressor(int level)
+	: cctx_(ZSTD_createCCtx())
+	, in_{nullptr, 0, 0}
+	, done_(false) {
+	if (!cctx_)
+	    throw std::bad_alloc();
+	ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level < 0 ? 3 : level);
+    }
+    ~ZstdCompressor() {
+	ZSTD_freeCCtx(cctx_);
+    }
+
+    void input(const char *data, size_t size) override {
+	in_ = { data, size, 0 };
+    }
+
+    size_t output(char *buf, size_t size, bool finish, boost::system::error_code &ec) override {
+	if (done_)
+	    return 0;
+	ZSTD_outBuffer out{ buf, size, 0 };
+	size_t rc = ZSTD_compressStream2(cctx_, &out, &in_, finish ? ZSTD_e_end : ZSTD_e_continue);
+	if (ZSTD_isError(rc))
+	    ec = errc::make_error_code(errc::io_error);
+	else if (finish && rc == 0)
+	    done_ = true;
+	return out.pos;
+    }
+
+    bool done() const override { return done_; }
+};
+
+class ZstdDecompressor
+    : public Decompressor
+{
+    ZSTD_DCtx *dctx_;
+    ZSTD_inBuffer in_;
+    bool done_;
+public:
+    ZstdDecompressor()
+	: dctx_(ZSTD_createDCtx())
+	, in_{nullptr, 0, 0}
+	, done_(false) {
+	if (!dctx_)
+	    throw std::bad_alloc();
+    }
+    ~ZstdDecompressor() {
+	ZSTD_freeDCtx(dctx_);
+    }
+
+    void input(const char *data, size_t size) override {
+	in_ = { data, size, 0 };
+    }
+
+    size_t output(char *buf, size_t size, boost::system::error_code &ec) override {
+	if (done_)
+	    return 0;
+	ZSTD_outBuffer out{ buf, size, 0 };
+	size_t rc = ZSTD_decompressStream(dctx_, &out, &in_);
+	if (ZSTD_isError(rc))
+	    ec = errc::make_error_code(errc::illegal_byte_sequence);
+	else if (rc == 0)
+	    done_ = true;
+	return out.pos;
+    }
+
+    bool done() const override { return done_; }
+};
+
+#endif
+
+std::unique_ptr<Compressor> Compressor::create(Encoding enc, int level)
+{
+    switch (enc)
+    {
+    case Encoding::gzip:
+    case Encoding::deflate:
+	return std::make_unique<ZlibCompressor>(enc, level);
+#ifdef HAVE_ZSTD
+    case Encoding::zstd:
+	return std::make_unique<ZstdCompressor>(level);
+#endif
+    default:
+	return nullptr;
+    }
+}
+
+std::unique_ptr<Decompressor> Decompressor::create(Encoding enc)
+{
+    switch (enc)
+    {
+    case Encoding::gzip:
+    case Encoding::deflate:
+	return std::make_unique<ZlibDecompressor>();
+#ifdef HAVE_ZSTD
+    case Encoding::zstd:
+	return std::make_unique<ZstdDecompressor>();
+#endif
+    default:
+	return nullptr;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef _Compression_h
+#define _Compression_h
+
+/*
+ * Streaming compression for HTTP content codings.
+ *
+ * gzip and deflate are provided by zlib. zstd is available when the
+ * server is built with HAVE_ZSTD.
+ */
+
+#include <memory>
+#include <string>
+
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace compression {
+
+    enum class Encoding
+    {
+	identity,
+	gzip,
+	deflate,
+	zstd,
+    };
+
+    /*
+     * The token for enc as used in Content-Encoding.
+     */
+    const char *encoding_name(Encoding enc);
+
+    /*
+     * Choose the best coding we support from an Accept-Encoding header.
+     * Returns identity if the header is empty or nothing we support is
+     * acceptable.
+     */
+    Encoding negotiate(boost::string_view accept_encoding);
+
+    /*
+     * Parse a Content-Encoding header. Returns false if it names
+     * a coding (or a chain of codings) we cannot decode.
+     */
+    bool parse_content_encoding(boost::string_view content_encoding, Encoding &enc);
+
+    /*
+     * Streaming compressor.
+     *
+     * Supply data with input(), then call output() repeatedly to drain
+     * the compressed stream into caller-supplied buffers. When output()
+     * returns less than the buffer size all input has been consumed.
+     * Once the last input has been supplied, keep calling output() with
+     * finish set until done() is true.
+     */
+    class Compressor
+    {
+    public:
+	static std::unique_ptr<Compressor> create(Encoding enc, int level = -1);
+
+	virtual ~Compressor() {}
+	virtual void input(const char *data, size_t size) = 0;
+	virtual size_t output(char *buf, size_t size, bool finish, boost::system::error_code &ec) = 0;
+	virtual bool done() const = 0;
+    };
+
+    /*
+     * Streaming decompressor with the same protocol as Compressor.
+     * done() becomes true when the end of the compressed stream
+     * has been seen.
+     */
+    class Decompressor
+    {
+    public:
+	static std::unique_ptr<Decompressor> create(Encoding enc);
+
+	virtual ~Decompressor() {}
+	virtual void input(const char *data, size_t size) = 0;
+	virtual size_t output(char *buf, size_t size, boost::system::error_code &ec) = 0;
+	virtual bool done() const = 0;
+    };
+}
+
+#endif
@@ -1,36 +1,90 @@
 #ifndef _DispatchContext_h
 #define _DispatchContext_h
 
+#include <memory>
+
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include "AuthToken.h"
 #include "Logging.h"
+#include "Tracing.h"
+
+/*
+ * Admission classes for database work. Each class has its own budget
+ * of requests allowed to be queued for or running in the database
+ * threads, so a burst of bulk operations cannot starve interactive
+ * ones. Internal work (timers etc.) is never refused.
+ */
+enum class WorkClass
+{
+    internal,
+    interactive,
+    standard,
+    bulk,
+};
+const int n_work_classes = 4;
 
 class DispatchContext
 {
+    /*
+     * The session's token, or null if the request is to be treated
+     * as carrying none. We refer to it rather than hold a copy as an
+     * AuthToken is some kilobytes and a batch has a context per entry.
+     */
+    AuthToken *token_;
+    std::shared_ptr<const AuthToken> shared_token_;
+
+    static const AuthToken &no_token() {
+	static const AuthToken empty;
+	return empty;
+    }
+
 public:
-    DispatchContext(boost::asio::yield_context &y,  boost::asio::executor e, const AuthToken &t, wslog::logger &logger)
-	: yield(y)
+    DispatchContext(boost::asio::yield_context &y,  boost::asio::executor e, AuthToken *t, wslog::logger &logger)
+	: token_(t)
+	, yield(y)
 	, timer(e)
-	, token(t)
 	, admin_mode(false)
 	, lg_(logger)
     {}
-    DispatchContext(boost::asio::yield_context &y,  boost::asio::io_context &ioc, const AuthToken &t, wslog::logger &logger)
-	: yield(y)
+    DispatchContext(boost::asio::yield_context &y,  boost::asio::io_context &ioc, AuthToken *t, wslog::logger &logger)
+	: token_(t)
+	, yield(y)
 	, timer(ioc)
-	, token(t)
 	, admin_mode(false)
 	, lg_(logger)
     {}
 
+    const AuthToken &token() const { return token_ ? *token_ : no_token(); }
+
+    /*
+     * Parse the session's token in place. It is parsed only once
+     * however many entries of a batch share it.
+     */
+    void parse_token() { if (token_) token_->parse(); }
+
+    /*
+     * Drop the token for this request only; the session's token is
+     * left alone for the other entries of a batch.
+     */
+    void clear_token() { token_ = nullptr; shared_token_.reset(); }
+
+    /*
+     * A copy of the token for state that outlives the request, made
+     * at most once per request.
+     */
+    std::shared_ptr<const AuthToken> shared_token() {
+	if (!shared_token_)
+	    shared_token_ = std::make_shared<const AuthToken>(token());
+	return shared_token_;
+    }
     
     boost::asio::yield_context yield;
     boost::asio::deadline_timer timer;
-    AuthToken token;
     bool admin_mode;
+    // Spans recorded for this request, here and in the database and Shock code it calls.
+    tracing::Trace trace;
     wslog::logger &lg_;
 };
 
-
 #endif
@@ -0,0 +1,148 @@
+#include "FileCopy.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+namespace {
+
+    /*
+     * Closes the descriptor when we leave the scope.
+     */
+    struct FD
+    {
+	int fd;
+	explicit FD(int f) : fd(f) {}
+	~FD() { if (fd >= 0) ::close(fd); }
+	FD(const FD &) = delete;
+	FD &operator=(const FD &) = delete;
+    };
+
+    bool write_all(int fd, const char *buf, size_t n)
+    {
+	while (n > 0)
+	{
+	    ssize_t w = ::write(fd, buf, n);
+	    if (w < 0)
+	    {
+		if (errno == EINTR)
+		    continue;
+		return false;
+	    }
+	    buf += w;
+	    n -= w;
+	}
+	return true;
+    }
+
+    /*
+     * Copy with copy_file_range. Returns false with errno set if the
+     * kernel could not; copied says how far it got.
+     */
+    bool kernel_copy(int in, int out, size_t size, size_t &copied)
+    {
+	copied = 0;
+#ifdef SYS_copy_file_range
+	while (copied < size)
+	{
+	    ssize_t n = ::syscall(SYS_copy_file_range, in, nullptr, out, nullptr, size - copied, 0u);
+	    if (n < 0)
+	    {
+		if (errno == EINTR)
+		    continue;
+		return false;
+	    }
+	    if (n == 0)
+		break;
+	    copied += n;
+	}
+	return true;
+#else
+	errno = ENOSYS;
+	return false;
+#endif
+    }
+
+    bool userspace_copy(int in, int out)
+    {
+	std::vector<char> buf(1 << 20);
+	while (1)
+	{
+	    ssize_t n = ::read(in, buf.data(), buf.size());
+	    if (n < 0)
+	    {
+		if (errno == EINTR)
+		    continue;
+		return false;
+	    }
+	    if (n == 0)
+		return true;
+	    if (!write_all(out, buf.data(), n))
+		return false;
+	}
+    }
+}
+
+filecopy::Result filecopy::copy_file(const boost::filesystem::path &from, const boost::filesystem::path &to)
+{
+    Result res;
+
+    FD in(::open(from.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (in.fd < 0 || ::fstat(in.fd, &st) < 0)
+    {
+	res.error = std::string("cannot open source: ") + std::strerror(errno);
+	return res;
+    }
+
+    FD out(::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777));
+    if (out.fd < 0)
+    {
+	res.error = std::string("cannot create destination: ") + std::strerror(errno);
+	return res;
+    }
+
+    bool ok = false;
+#ifdef FICLONE
+    if (::ioctl(out.fd, FICLONE, in.fd) == 0)
+    {
+	res.method = Method::reflink;
+	ok = true;
+    }
+#endif
+    if (!ok)
+    {
+	size_t copied;
+	if (kernel_copy(in.fd, out.fd, st.st_size, copied))
+	{
+	    res.method = Method::kernel;
+	    ok = true;
+	}
+	else if (copied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+				 errno == EOPNOTSUPP || errno == EBADF))
+	{
+	    // Not supported here; nothing has been written yet.
+	    res.method = Method::userspace;
+	    ok = userspace_copy(in.fd, out.fd);
+	}
+    }
+
+    if (!ok)
+    {
+	res.error = std::string("copy failed: ") + std::strerror(errno);
+	::unlink(to.c_str());
+	return res;
+    }
+
+    struct stat ost;
+    res.size = ::fstat(out.fd, &ost) == 0 ? ost.st_size : st.st_size;
+    res.ok = true;
+    return res;
+}
@@ -0,0 +1,44 @@
+#ifndef _FileCopy_h
+#define _FileCopy_h
+
+/*
+ * Copying the data of filesystem-backed objects.
+ *
+ * We first ask the filesystem to share the source's blocks with the new
+ * file (FICLONE, a reflink on btrfs, XFS and the like), which costs no
+ * data I/O at all. Failing that we have the kernel copy the data with
+ * copy_file_range, which NFS and some others can do on the server; and
+ * only when neither is available do we read and write it ourselves.
+ */
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace filecopy {
+
+    enum class Method
+    {
+	reflink,
+	kernel,
+	userspace,
+    };
+
+    struct Result
+    {
+	bool ok;
+	size_t size;
+	Method method;
+	std::string error;
+
+	Result() : ok(false), size(0), method(Method::userspace) {}
+    };
+
+    /*
+     * Copy from to a new file to, replacing anything there. On failure
+     * nothing is left at to.
+     */
+    Result copy_file(const boost::filesystem::path &from, const boost::filesystem::path &to);
+}
+
+#endif
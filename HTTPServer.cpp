@@ -1,16 +1,189 @@
 #include "HTTPServer.h"
 #include <thread>
 #include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include <boost/asio/error.hpp>
 
 #include "parse_url.h"
+#include "ByteRange.h"
 #include "Shock.h"
+#include "Metrics.h"
 
 using namespace ws_http_server;
 
+/*
+ * Close a file descriptor when it goes out of scope.
+ */
+struct FileDescriptor
+{
+    int fd;
+    explicit FileDescriptor(int f) : fd(f) {}
+    ~FileDescriptor() { if (fd >= 0) ::close(fd); }
+    FileDescriptor(const FileDescriptor &) = delete;
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+};
+
+/*
+ * Send length bytes of the file fd, starting at offset, to the client.
+ *
+ * This generic version reads the file through the caller's buffer and
+ * is used for any stream that we cannot hand a socket descriptor for
+ * (e.g. an SSL stream).
+ */
+template <class Stream>
+static void send_file_range(Stream &stream, int fd, off_t offset, size_t length,
+			    char *buf, size_t buf_size,
+			    net::yield_context yield, boost::system::error_code &ec)
+{
+    while (length > 0)
+    {
+	ssize_t n = ::pread(fd, buf, std::min(length, buf_size), offset);
+	if (n < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    ec.assign(errno, boost::system::system_category());
+	    return;
+	}
+	if (n == 0)
+	{
+	    // File is shorter than we were told.
+	    ec = net::error::eof;
+	    return;
+	}
+	net::async_write(stream, net::buffer(buf, n), yield[ec]);
+	if (ec)
+	    return;
+	metrics::download_bytes().inc(n);
+	offset += n;
+	length -= n;
+    }
+}
+
+/*
+ * Plain TCP version. Use sendfile(2) to move the data from the page
+ * cache to the socket without copying it through user space. The socket
+ * is switched to non-blocking mode for the duration and we yield
+ * to the event loop whenever the socket buffer is full.
+ *
+ * If the kernel can't sendfile from this file (EINVAL/ENOSYS, e.g. some
+ * network filesystems) we fall back to the buffered copy for whatever
+ * remains.
+ */
+static void send_file_range(beast::tcp_stream &stream, int fd, off_t offset, size_t length,
+			    char *buf, size_t buf_size,
+			    net::yield_context yield, boost::system::error_code &ec)
+{
+    // Largest single transfer the kernel will perform.
+    const size_t max_sendfile = 0x7ffff000;
+
+    auto &sock = stream.socket();
+    bool was_non_blocking = sock.native_non_blocking();
+    sock.native_non_blocking(true, ec);
+    if (ec)
+	return;
+
+    bool fallback = false;
+    while (length > 0)
+    {
+	ssize_t n = ::sendfile(sock.native_handle(), fd, &offset, std::min(length, max_sendfile));
+	if (n > 0)
+	{
+	    length -= n;
+	    metrics::download_bytes().inc(n);
+	}
+	else if (n == 0)
+	{
+	    ec = net::error::eof;
+	    break;
+	}
+	else if (errno == EINTR)
+	{
+	    continue;
+	}
+	else if (errno == EAGAIN || errno == EWOULDBLOCK)
+	{
+	    sock.async_wait(tcp::socket::wait_write, yield[ec]);
+	    if (ec)
+		break;
+	}
+	else if (errno == EINVAL || errno == ENOSYS)
+	{
+	    fallback = true;
+	    break;
+	}
+	else
+	{
+	    ec.assign(errno, boost::system::system_category());
+	    break;
+	}
+    }
+
+    boost::system::error_code ec2;
+    sock.native_non_blocking(was_non_blocking, ec2);
+
+    if (fallback)
+    {
+	send_file_range<beast::tcp_stream>(stream, fd, offset, length, buf, buf_size, yield, ec);
+    }
+}
+
+/*
+ * Format t as an HTTP-date (RFC 7231 IMF-fixdate).
+ */
+static std::string http_date(time_t t)
+{
+    struct tm tm;
+    char buf[64];
+    ::gmtime_r(&t, &tm);
+    size_t n = ::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+/*
+ * Evaluate an If-Range header against the current validators for an object.
+ * If-Range requires a strong comparison, so a weak entity tag never matches,
+ * and a date must match the Last-Modified value exactly.
+ */
+static bool if_range_matches(boost::string_view if_range, const std::string &etag, const std::string &last_modified)
+{
+    if (if_range.empty())
+	return true;
+    if (if_range.front() == '"')
+	return !etag.empty() && if_range == etag;
+    if (if_range.size() >= 2 && if_range.substr(0, 2) == "W/")
+	return false;
+    return !last_modified.empty() && if_range == last_modified;
+}
+
+/*
+ * Boundary string for multipart/byteranges responses.
+ */
+static std::string make_boundary()
+{
+    static thread_local std::mt19937_64 rng{std::random_device{}()};
+    std::ostringstream ostr;
+    ostr << "p4x-" << std::hex << std::setfill('0') << std::setw(16) << rng() << std::setw(16) << rng();
+    return ostr.str();
+}
+
 void Server::run(net::ip::address address, unsigned short port, int threads) {
 	    
+    if (reuse_port_)
+    {
+	run_sharded(address, port, threads);
+	return;
+    }
+
     boost::asio::spawn(ioc_,
 		       [listener = std::make_shared<Listener>(ioc_,
 							      tcp::endpoint{address, port},
@@ -32,13 +205,499 @@ void Server::run(net::ip::address address, unsigned short port, int threads) {
 	t.join();
 }
 
-void Session::handle_get(decltype(Session::header_parser_)::value_type &req, net::yield_context yield) {
+/*
+ * One io_context per thread, each with its own SO_REUSEPORT listener.
+ * The main thread serves the shared ioc_ (which also carries the
+ * Shock and user agent work); the other threads get private contexts.
+ */
+void Server::run_sharded(net::ip::address address, unsigned short port, int threads) {
+
+    std::vector<std::unique_ptr<net::io_context>> shard_iocs;
+    for (auto i = threads - 1; i > 0; --i)
+	shard_iocs.emplace_back(std::make_unique<net::io_context>(1));
+
+    auto start_listener = [this, address, port](net::io_context &ioc) {
+	boost::asio::spawn(ioc,
+			   [listener = std::make_shared<Listener>(ioc,
+								  tcp::endpoint{address, port},
+								  *this, true)](net::yield_context yield) {
+			       listener->run(yield);
+			   });
+    };
+
+    start_listener(ioc_);
+    for (auto &ioc: shard_iocs)
+	start_listener(*ioc);
+
+    std::vector<std::thread> v;
+    v.reserve(shard_iocs.size());
+    for (auto &ioc: shard_iocs)
+    {
+	v.emplace_back([&ioc] { ioc->run(); });
+    }
+	
+    ioc_.run();
+
+    // The shards have their listeners still waiting; stop them with ioc_.
+    for (auto &ioc: shard_iocs)
+	ioc->stop();
+
+    // Block until all the threads exit
+    for (auto& t : v)
+	t.join();
+}
+
+void Session::write_json_response(json::value &response_value, int http_code, unsigned version,
+				  compression::Encoding encoding, bool retry_later, net::yield_context yield)
+{
+    boost::system::error_code ec;
+    boost::json::serializer sr(response_value);
+
+    http::response<http::empty_body> http_resp{static_cast<http::status>(http_code), version};
+    http_resp.set(http::field::access_control_allow_origin, "*");
+    http_resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    http_resp.set(http::field::content_type, "application/json");
+    if (http_code == 503 || retry_later)
+	http_resp.set(http::field::retry_after, std::to_string(server_.retry_after()));
+    if (server_.compression_min_size() >= 0)
+	http_resp.set(http::field::vary, "Accept-Encoding");
+
+    /*
+     * Fill the first buffer. If that completes the serialization
+     * we know the length and can send a plain response, unless it is
+     * large enough to be worth compressing.
+     */
+    auto n = sr.read(buffer_.data(), buffer_.size());
+
+    std::unique_ptr<compression::Compressor> comp;
+    if (encoding != compression::Encoding::identity &&
+	(!sr.is_done() || n >= static_cast<size_t>(server_.compression_min_size())))
+    {
+	comp = compression::Compressor::create(encoding);
+	http_resp.set(http::field::content_encoding, compression::encoding_name(encoding));
+	if (!zbuffer_)
+	    zbuffer_ = std::make_unique<std::array<char, 65536>>();
+    }
+
+    /*
+     * A complete response is also sent with a Content-Length if
+     * it compresses into a single buffer.
+     */
+    const char *body = buffer_.data();
+    size_t body_size = n;
+    if (comp && sr.is_done())
+    {
+	comp->input(buffer_.data(), n);
+	body = zbuffer_->data();
+	body_size = comp->output(zbuffer_->data(), zbuffer_->size(), true, ec);
+	if (ec)
+	{
+	    fail(ec, "response compress");
+	    keep_alive_ = false;
+	    return;
+	}
+    }
+
+    if (sr.is_done() && (!comp || comp->done()))
+    {
+	http_resp.content_length(body_size);
+	http_resp.keep_alive(keep_alive_);
+	http::response_serializer<http::empty_body> hsr{http_resp};
+	http::async_write_header(stream_, hsr, yield[ec]);
+	if (!ec)
+	    net::async_write(stream_, net::buffer(body, body_size), yield[ec]);
+	if (ec)
+	{
+	    fail(ec, "response write");
+	    keep_alive_ = false;
+	}
+	return;
+    }
+
+    bool chunked = version >= 11;
+    if (chunked)
+	http_resp.chunked(true);
+    else
+	keep_alive_ = false;
+    http_resp.keep_alive(keep_alive_);
+
+    http::response_serializer<http::empty_body> hsr{http_resp};
+    http::async_write_header(stream_, hsr, yield[ec]);
+    if (ec)
+    {
+	fail(ec, "response header write");
+	keep_alive_ = false;
+	return;
+    }
+
+    auto write_data = [this, chunked, &yield, &ec](const char *data, size_t size) {
+	// An empty chunk would signal the end of the body.
+	if (size == 0)
+	    return;
+	if (chunked)
+	    net::async_write(stream_, http::make_chunk(net::buffer(data, size)), yield[ec]);
+	else
+	    net::async_write(stream_, net::buffer(data, size), yield[ec]);
+    };
+
+    /*
+     * Write compressor output until it has consumed its pending
+     * input, or, if last is set, until the compressed stream is complete.
+     */
+    auto drain = [this, &comp, &write_data, &ec](bool last) {
+	while (1)
+	{
+	    size_t m = comp->output(zbuffer_->data(), zbuffer_->size(), last, ec);
+	    if (ec)
+		return;
+	    write_data(zbuffer_->data(), m);
+	    if (ec)
+		return;
+	    if (last ? comp->done() : m < zbuffer_->size())
+		return;
+	}
+    };
+
+    if (comp && sr.is_done())
+    {
+	// The whole response went to the compressor above but didn't fit one buffer.
+	write_data(body, body_size);
+	if (!ec)
+	    drain(true);
+    }
+    else if (comp)
+    {
+	while (1)
+	{
+	    bool last = sr.is_done();
+	    comp->input(buffer_.data(), n);
+	    drain(last);
+	    if (ec || last)
+		break;
+	    n = sr.read(buffer_.data(), buffer_.size());
+	}
+    }
+    else
+    {
+	while (1)
+	{
+	    write_data(buffer_.data(), n);
+	    if (ec || sr.is_done())
+		break;
+	    n = sr.read(buffer_.data(), buffer_.size());
+	}
+    }
+    if (ec)
+    {
+	fail(ec, "response chunk write");
+	keep_alive_ = false;
+	return;
+    }
+
+    if (chunked)
+    {
+	net::async_write(stream_, http::make_chunk_last(), yield[ec]);
+	if (ec)
+	{
+	    fail(ec, "response final chunk write");
+	    keep_alive_ = false;
+	}
+    }
+}
+
+json::value Session::handle_batch(json::array &batch, json::storage_ptr sp, int &http_code,
+				  bool &retry_later, net::yield_context yield)
+{
+    json::value response_value(sp);
+
+    if (batch.empty())
+    {
+	JsonRpcRequest rpc_req(sp);
+	JsonRpcResponse rpc_resp(rpc_req);
+	rpc_resp.set_error(-32600, "Invalid Request");
+	response_value = rpc_resp.release_response();
+	return response_value;
+    }
+
+    struct BatchEntry
+    {
+	json::monotonic_resource arena;
+	JsonRpcRequest req;
+	boost::optional<JsonRpcResponse> resp;
+	bool valid;
+	int http_code;
+
+	BatchEntry()
+	    : req(&arena)
+	    , valid(false)
+	    , http_code(200) {}
+    };
+
+    std::vector<std::unique_ptr<BatchEntry>> entries;
+    entries.reserve(batch.size());
+    for (auto &elt: batch)
+    {
+	entries.emplace_back(std::make_unique<BatchEntry>());
+	auto &entry = *entries.back();
+	boost::system::error_code ec;
+	entry.req.parse(elt, ec);
+	entry.resp.emplace(entry.req);
+	if (ec)
+	    entry.resp->set_error(-32600, "Invalid Request");
+	else
+	    entry.valid = true;
+    }
+
+    WSLOG(lg_, wslog::debug) << "batch of " << entries.size() << " requests\n";
+
+    /*
+     * Run a fixed number of workers, each taking the next entry
+     * when it finishes one. Everything here runs in the session strand
+     * so the shared counters need no locking. The last worker to
+     * finish wakes us by cancelling done_timer.
+     */
+    size_t next = 0;
+    size_t n_workers = entries.size();
+    if (server_.batch_concurrency() > 0)
+	n_workers = std::min<size_t>(n_workers, server_.batch_concurrency());
+    size_t running = n_workers;
+    net::deadline_timer done_timer(stream_.get_executor());
+    done_timer.expires_at(boost::posix_time::pos_infin);
+
+    for (size_t w = 0; w < n_workers; w++)
+    {
+	net::spawn(stream_.get_executor(),
+		   [this, &entries, &next, &running, &done_timer](net::yield_context worker_yield) {
+		       wslog::logger disp_logger(wslog::channel = name_logger("dispatch", stream_.socket()));
+		       while (next < entries.size())
+		       {
+			   auto &entry = *entries[next++];
+			   if (!entry.valid)
+			       continue;
+			   /*
+			    * A failure here must not end the worker, or the
+			    * count of running workers never reaches zero and
+			    * the batch never completes.
+			    */
+			   try {
+			       DispatchContext dc(worker_yield, stream_.get_executor(), &token_, disp_logger);
+			       dc.trace = trace_;
+			       server_.dispatcher().dispatch(entry.req, *entry.resp, dc, entry.http_code);
+			   } catch (std::exception &e) {
+			       WSLOG(lg_, wslog::error) << "Batch req " << entry.req << " failed: " << e.what() << "\n";
+			       entry.resp->set_error(-32603, "Internal error");
+			       entry.http_code = 500;
+			   }
+			   WSLOG(lg_, wslog::debug) << "Batch req " << entry.req << " had code " << entry.http_code << "\n";
+		       }
+		       if (--running == 0)
+			   done_timer.cancel_one();
+		   });
+    }
+
+    // Workers that never had to wait may already have finished.
+    if (running > 0)
+    {
+	boost::system::error_code ec;
+	done_timer.async_wait(yield[ec]);
+    }
+
+    size_t n_refused = 0;
+    for (auto &entry: entries)
+    {
+	if (entry->http_code == 503)
+	    n_refused++;
+    }
+    if (n_refused > 0)
+    {
+	retry_later = true;
+	if (n_refused == entries.size())
+	    http_code = 503;
+    }
+
+    json::array responses(sp);
+    responses.reserve(entries.size());
+    for (auto &entry: entries)
+    {
+	if (entry->valid && entry->req.is_notification())
+	    continue;
+	responses.emplace_back(entry->resp->release_response());
+    }
+    if (!responses.empty())
+	response_value = std::move(responses);
+    return response_value;
+}
+
+void Session::send_download(Session::request_type &req, const std::string &name, uint64_t size,
+			    const std::string &etag, const std::string &last_modified,
+			    Session::range_sender send_range, net::yield_context yield)
+{
+    tracing::Span span(trace_, "send_download");
+    boost::system::error_code ec;
+
+    std::vector<ByteRange> ranges;
+    auto range_result = RangeParseResult::Ignore;
+    auto range_hdr = req[http::field::range];
+    if (!range_hdr.empty() && if_range_matches(req[http::field::if_range], etag, last_modified))
+	range_result = parse_byte_ranges(range_hdr, size, ranges);
+
+    http::response<http::empty_body> resp{http::status::ok, req.version()};
+    resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    resp.set(http::field::accept_ranges, "bytes");
+    if (!etag.empty())
+	resp.set(http::field::etag, etag);
+    if (!last_modified.empty())
+	resp.set(http::field::last_modified, last_modified);
+
+    /*
+     * For a multipart response we need the part headers up front
+     * to compute the Content-Length.
+     */
+    std::vector<std::string> part_headers;
+    std::string closing;
+
+    if (range_result == RangeParseResult::Unsatisfiable)
+    {
+	resp.result(http::status::range_not_satisfiable);
+	resp.set(http::field::content_range, "bytes */" + std::to_string(size));
+	resp.content_length(0);
+    }
+    else if (range_result == RangeParseResult::Ignore)
+    {
+	resp.set(http::field::content_type, "application/octet-stream");
+	resp.content_length(size);
+	ranges.clear();
+	if (size > 0)
+	    ranges.push_back(ByteRange{0, size - 1});
+    }
+    else if (ranges.size() == 1)
+    {
+	resp.result(http::status::partial_content);
+	resp.set(http::field::content_type, "application/octet-stream");
+	resp.set(http::field::content_range, ranges[0].content_range(size));
+	resp.content_length(ranges[0].length());
+    }
+    else
+    {
+	std::string boundary = make_boundary();
+	resp.result(http::status::partial_content);
+	resp.set(http::field::content_type, "multipart/byteranges; boundary=" + boundary);
+
+	uint64_t total = 0;
+	for (auto &r: ranges)
+	{
+	    part_headers.emplace_back("\r\n--" + boundary + "\r\n"
+				      "Content-Type: application/octet-stream\r\n"
+				      "Content-Range: " + r.content_range(size) + "\r\n\r\n");
+	    total += part_headers.back().size() + r.length();
+	}
+	closing = "\r\n--" + boundary + "--\r\n";
+	total += closing.size();
+	resp.content_length(total);
+    }
+    if (range_result != RangeParseResult::Unsatisfiable)
+	resp.set(http::field::content_disposition, "attachment; filename=" + name);
+    resp.keep_alive(keep_alive_);
+
+    http::response_serializer<http::empty_body> sr{resp};
+    http::async_write_header(stream_, sr, yield[ec]);
+    if (ec)
+    {
+	fail(ec, "download header write failed");
+	keep_alive_ = false;
+	return;
+    }
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+	if (!part_headers.empty())
+	{
+	    net::async_write(stream_, net::buffer(part_headers[i]), yield[ec]);
+	    if (ec)
+		break;
+	}
+	send_range(ranges[i].first, ranges[i].length(), yield, ec);
+	if (ec)
+	    break;
+    }
+    if (!ec && !closing.empty())
+	net::async_write(stream_, net::buffer(closing), yield[ec]);
+
+    if (ec)
+    {
+	fail(ec, "download write failed");
+	keep_alive_ = false;
+    }
+}
+
+void Session::send_shock_range(const std::string &shock_node, const std::string &token,
+			       uint64_t offset, uint64_t length, bool whole,
+			       net::yield_context yield, boost::system::error_code &ec)
+{
+    const int buf_size = 100000;
+    beast::flat_buffer buf{ buf_size };
+    beast::tcp_stream shock_stream{ stream_.get_executor() };
+
+    /*
+     * For the whole object we don't ask Shock for a range, but we
+     * still send no more than we advertised.
+     */
+    if (whole)
+	server_.shock().start_download(shock_node, token, shock_stream, buf, ec, yield, 0, 0, trace_);
+    else
+	server_.shock().start_download(shock_node, token, shock_stream, buf, ec, yield, offset, length, trace_);
+    if (ec)
+	return;
+
+    while (length > 0)
+    {
+	// We may have leftover bytes from reading the header.
+	if (buf.size() == 0)
+	{
+	    auto n_bytes = shock_stream.async_read_some(buf.prepare(buf_size), yield[ec]);
+	    buf.commit(n_bytes);
+	    if (ec == net::error::eof || (!ec && n_bytes == 0))
+	    {
+		// Shock sent less than we expected.
+		ec = net::error::eof;
+		return;
+	    }
+	    if (ec)
+		return;
+	}
+
+	auto data = beast::buffers_prefix(std::min<uint64_t>(length, buf.size()), buf.data());
+	auto n_written = net::async_write(stream_, data, yield[ec]);
+	if (ec)
+	    return;
+	buf.consume(n_written);
+	length -= n_written;
+	metrics::download_bytes().inc(n_written);
+    }
+}
+
+void Session::handle_get(Session::request_type &req, net::yield_context yield) {
     auto path = req.target();
     if (path == "/quit")
     {
 	server_.quit_server();
+	keep_alive_ = false;
 	stream_.close();
     }
+    else if (path == "/metrics")
+    {
+	http::response<http::string_body> res{http::status::ok, req.version()};
+	res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+	res.set(http::field::content_type, "text/plain; version=0.0.4");
+	res.set(http::field::cache_control, "no-cache");
+	res.keep_alive(keep_alive_);
+	res.body() = metrics::Registry::instance().render();
+	res.prepare_payload();
+	boost::system::error_code ec;
+	http::async_write(stream_, res, yield[ec]);
+	if (ec)
+	    fail(ec, "write metrics");
+    }
     else
     {
 	// 50e67cb9-b680-42a6-b031-c5251cbca298
@@ -48,13 +707,14 @@ void Session::handle_get(decltype(Session::header_parser_)::value_type &req, net
 
 	if (boost::regex_match(path.begin(), path.end(), match, dl_regex))
 	{
-	    std::cerr << "Have DL match " << match[1] << " with name " << match[2] << "\n";
+	    WSLOG(lg_, wslog::debug) << "Have DL match " << match[1] << " with name " << match[2] << "\n";
 
 	    std::string url_filename;
 	    url_decode(match[2], url_filename);
 
 	    wslog::logger disp_logger(wslog::channel = name_logger("dispatch", stream_.socket()));
-	    DispatchContext dc(yield, stream_.get_executor(), token_, disp_logger);
+	    DispatchContext dc(yield, stream_.get_executor(), &token_, disp_logger);
+	    dc.trace = trace_;
 	    bool ok;
 	    std::string name, shock_node, token, file_path;
 	    size_t size{0L};
@@ -66,116 +726,64 @@ void Session::handle_get(decltype(Session::header_parser_)::value_type &req, net
 		});
 	    if (!ok)
 	    {
-		std::cerr << "lookup failed\n";
+		WSLOG(lg_, wslog::debug) << "lookup failed\n";
 		error_response(404, "File not found", yield);
 		return;
 	    }
 	    else if (url_filename != name)
 	    {
-		std::cerr << "name mismatch\n";
+		WSLOG(lg_, wslog::debug) << "name mismatch\n";
 		error_response(404, "File not found", yield);
 		return;
 	    }
 	    else if (file_path.empty())
 	    {
-		std::cerr << "got shock " << name << " " << size << " " << shock_node << " " << token << "\n";
-
-		http::response<http::empty_body> resp{http::status::ok, 11};
-		resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-		resp.set(http::field::content_type, "application/octet-stream");
-		resp.set(http::field::content_length, size);
-		resp.set(http::field::content_disposition, "attachment; filename=" + name);
-		resp.keep_alive(false);
-
-		http::response_serializer<http::empty_body> sr{resp};
-
-		boost::system::error_code ec;
-		
-		http::async_write_header(stream_, sr, yield[ec]);
-		if (ec)
-		{
-		    fail(ec, "shock header write");
-		}
-
-		// Set up to stream shock data.
-		const int buf_size = 100000;
-		beast::flat_buffer buf{ buf_size };	
-		beast::tcp_stream shock_stream{ net::make_strand(server_.ioc()) };
-		server_.shock().start_download(shock_node, token, shock_stream, buf, ec, yield);
+		WSLOG(lg_, wslog::debug) << "got shock " << name << " " << size << " " << shock_node << " " << token << "\n";
 
-		// We may have leftover bytes from reading the header.
-		while (buf.size())
-		{
-		    int n_written = stream_.async_write_some(buf.data(), yield[ec]);
-		    if (ec)
-		    {
-			fail(ec, "first async_write_some");
-			return;
-		    }
-		    buf.consume(n_written);
-		}
+		/*
+		 * The size recorded for a Shock object may not match what Shock
+		 * actually sends, so we don't reuse the connection after streaming.
+		 * Shock node data is immutable, so the node URL serves as its entity tag.
+		 */
+		keep_alive_ = false;
 
-		while (1)
-		{
-		    auto n_bytes = shock_stream.async_read_some(buf.prepare(buf_size), yield[ec]);
-		    buf.commit(n_bytes);
-		    if (ec == net::error::eof || n_bytes == 0)
-			break;
-		    if (ec)
-		    {
-			fail(ec, "async_read_some");
-			stream_.close();
-			return;
-		    }
-
-		    while (buf.size() > 0)
-		    {
-			int n_written = stream_.async_write_some(buf.data(), yield[ec]);
-			if (ec)
-			{
-			    fail(ec, "async_write_some");
-			    stream_.close();
-			    return;
-			}
-			if (n_written == 0)
-			{
-			    std::cerr << "empty write\n";
-			    stream_.close();
-			    return;
-			}
-			buf.consume(n_written);
-		    }
-		}
+		send_download(req, name, size, "\"" + shock_node + "\"", "",
+			      [this, &shock_node, &token, size](uint64_t offset, uint64_t length,
+								 net::yield_context yield, boost::system::error_code &ec) {
+				  send_shock_range(shock_node, token, offset, length, offset == 0 && length == size, yield, ec);
+			      }, yield);
 		stream_.close();
 		return;
 	    }
 	    else
 	    {
-		std::cerr << "got file " << name << " " << size << " " << file_path << "\n";
-		http::file_body::value_type file;
+		WSLOG(lg_, wslog::debug) << "got file " << name << " " << size << " " << file_path << "\n";
 		boost::system::error_code ec;
-		file.open(file_path.c_str(), boost::beast::file_mode::read, ec);
-		if (ec)
+		FileDescriptor file(::open(file_path.c_str(), O_RDONLY | O_CLOEXEC));
+		struct stat st;
+		if (file.fd < 0 || ::fstat(file.fd, &st) < 0)
 		{
+		    ec.assign(errno, boost::system::system_category());
 		    fail(ec, "file open failed");
 		    error_response(404, "File not found", yield);
 		    return;
 		}
-		http::response<http::file_body> resp;
-		resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-		resp.set(http::field::content_type, "application/octet-stream");
-		resp.set(http::field::content_length, size);
-		resp.set(http::field::content_disposition, "attachment; filename=" + name);
-		resp.keep_alive(false);
-		resp.body() = std::move(file);
-		resp.prepare_payload();
-		http::async_write(stream_, resp, yield[ec]);
-		if (ec)
-		{
-		    fail(ec, "file write failed");
-		}
+		::posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		std::ostringstream etag;
+		etag << std::hex << "\"" << st.st_ino << "-" << st.st_size << "-" << st.st_mtime << "\"";
+
+		send_download(req, name, st.st_size, etag.str(), http_date(st.st_mtime),
+			      [this, &file](uint64_t offset, uint64_t length,
+					    net::yield_context yield, boost::system::error_code &ec) {
+				  send_file_range(stream_, file.fd, offset, length, buffer_.data(), buffer_.size(), yield, ec);
+			      }, yield);
 	    }
 	}
+	else
+	{
+	    error_response(404, "Not found", yield);
+	}
     }
 }
 
@@ -11,21 +11,29 @@
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/config.hpp>
+#include <boost/optional.hpp>
 
 #include <boost/json.hpp>
 #include <boost/regex.hpp>
 
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <string>
 #include <functional>
 
+#include <sys/socket.h>
+
 #include "Logging.h"
 #include "ServiceDispatcher.h"
 #include "DispatchContext.h"
 #include "AuthToken.h"
 #include "WorkspaceService.h"
 #include "WorkspaceDB.h"
+#include "Compression.h"
+#include "Metrics.h"
+#include "Tracing.h"
 
 class Shock;
 
@@ -47,6 +55,41 @@ namespace ws_http_server {
 	Shock &shock_;
 	bool quit_;
 
+	/*
+	 * Persistent connection limits. A value of zero for the
+	 * request limit means connections are not limited in the
+	 * number of requests they may carry.
+	 */
+	int max_requests_per_connection_;
+	std::chrono::seconds idle_timeout_;
+
+	/*
+	 * If set, each I/O thread gets its own io_context and its own
+	 * SO_REUSEPORT acceptor, and sessions stay on the thread that
+	 * accepted them. Otherwise all threads share ioc_ and a single
+	 * acceptor.
+	 */
+	bool reuse_port_;
+
+	/*
+	 * Seconds a client refused for overload is told to wait.
+	 */
+	int retry_after_;
+
+	/*
+	 * JSON responses smaller than this are not compressed. A
+	 * negative value disables response compression.
+	 */
+	int compression_min_size_;
+
+	/*
+	 * Maximum number of entries of one JSON-RPC batch executing
+	 * at once.
+	 */
+	int batch_concurrency_;
+
+	void run_sharded(net::ip::address address, unsigned short port, int threads);
+
     public:
 	explicit Server(net::io_context &ioc, std::string api_root, ServiceDispatcher &dispatcher, WorkspaceService &svc, Shock &shock)
 	    : ioc_(ioc)
@@ -54,13 +97,31 @@ namespace ws_http_server {
 	    , dispatcher_(dispatcher)
 	    , workspace_service_(svc)
 	    , shock_(shock)
-	    , quit_(false) {
+	    , quit_(false)
+	    , max_requests_per_connection_(100)
+	    , idle_timeout_(15)
+	    , reuse_port_(false)
+	    , retry_after_(2)
+	    , compression_min_size_(1400)
+	    , batch_concurrency_(4) {
 
 	}
 	
 	void run(net::ip::address address, unsigned short port, int threads);
 	bool quit() { return quit_; }
 	void quit_server() { quit_ = true; }
+	int max_requests_per_connection() const { return max_requests_per_connection_; }
+	void max_requests_per_connection(int n) { max_requests_per_connection_ = n; }
+	std::chrono::seconds idle_timeout() const { return idle_timeout_; }
+	void idle_timeout(std::chrono::seconds t) { idle_timeout_ = t; }
+	bool reuse_port() const { return reuse_port_; }
+	void reuse_port(bool b) { reuse_port_ = b; }
+	int retry_after() const { return retry_after_; }
+	void retry_after(int s) { retry_after_ = s; }
+	int compression_min_size() const { return compression_min_size_; }
+	void compression_min_size(int n) { compression_min_size_ = n; }
+	int batch_concurrency() const { return batch_concurrency_; }
+	void batch_concurrency(int n) { batch_concurrency_ = n; }
 	ServiceDispatcher &dispatcher() { return dispatcher_; }
 	WorkspaceService &workspace_service() { return workspace_service_; }
 	Shock &shock() { return shock_; }
@@ -78,31 +139,77 @@ namespace ws_http_server {
     
     /*
      * Session class. Read and process HTTP requests.
+     *
+     * A session serves requests from a single connection until the
+     * client asks for the connection to be closed, the per-connection
+     * request limit is reached, or the connection sits idle for longer
+     * than the server's idle timeout. Pipelined requests are handled
+     * in the order they arrive.
      */
     class Session
 	: public std::enable_shared_from_this<Session>
 	, public wslog::LoggerBase
     {
+	using request_parser_type = http::request_parser<http::buffer_body>;
+	using request_type = request_parser_type::value_type;
+
 	Server &server_;
 	beast::tcp_stream stream_;
 	beast::flat_static_buffer<10000> buf_;
-	http::request_parser<http::buffer_body> header_parser_;
+	boost::optional<request_parser_type> header_parser_;
 	std::shared_ptr<void> res_;
-	std::array<char, 10240> buffer_;
+	std::array<char, 65536> buffer_;
+
+	/*
+	 * Initial block for the per-request JSON arena. Everything
+	 * allocated while parsing and answering an API request comes
+	 * from a monotonic resource over this block (spilling to the
+	 * heap as needed) and is freed in one step when the request
+	 * completes.
+	 */
+	std::array<unsigned char, 65536> json_arena_;
+
+	/*
+	 * Output buffer for response compression and request body
+	 * decompression; allocated the first time it is needed.
+	 */
+	std::unique_ptr<std::array<char, 65536>> zbuffer_;
+
+	/*
+	 * Limit on the inflated size of a compressed request body.
+	 */
+	static const size_t max_decoded_body_size = 256 * 1024 * 1024;
 	
 	AuthToken token_;
+
+	// The trace for the current request.
+	tracing::Trace trace_;
+
+	/*
+	 * Whether the connection is to be kept open after the
+	 * current response. Handlers that cannot leave the stream
+	 * positioned at the start of the next request clear this.
+	 */
+	bool keep_alive_;
 	
     public:
 	explicit Session(tcp::socket &&socket,
 			 Server &server)
 	    : server_(server)
 	    , stream_(std::move(socket))
+	    , keep_alive_(false)
 	    , wslog::LoggerBase(name_logger("session", socket)) {
-	    header_parser_.body_limit(1000000);
 	}
 
 	void run(net::yield_context yield) {
-	    loop(yield);
+	    metrics::active_sessions().inc();
+	    try {
+		loop(yield);
+	    } catch (...) {
+		metrics::active_sessions().dec();
+		throw;
+	    }
+	    metrics::active_sessions().dec();
 	}
 
     private:
@@ -112,34 +219,98 @@ namespace ws_http_server {
 	 * We for now have a /quit that quits the server
 	 * TODO this should require admin authentication or connect only from localhost.
 	 *
+	 * /metrics returns the service metrics in the Prometheus text format.
+	 *
 	 * The /dl resource handles the downloads as defined by the
 	 * Workspace.get_download_url method. It expects URLs of the form
 	 * /dl/{UUID}/filename
 	 */
 
-	void handle_get(decltype(header_parser_)::value_type &req, net::yield_context yield);
+	void handle_get(request_type &req, net::yield_context yield);
+
+	/*
+	 * Send a download to the client, honoring any Range and If-Range
+	 * headers in the request.
+	 *
+	 * A single satisfiable range is sent as a 206 response, several
+	 * as a 206 multipart/byteranges response. send_range is invoked
+	 * to write the object bytes for each range, in ascending order.
+	 * The etag and last_modified values, if not empty, are sent with
+	 * the response and used to evaluate If-Range.
+	 */
+	using range_sender = std::function<void(uint64_t offset, uint64_t length,
+						 net::yield_context yield, boost::system::error_code &ec)>;
+	void send_download(request_type &req, const std::string &name, uint64_t size,
+			   const std::string &etag, const std::string &last_modified,
+			   range_sender send_range, net::yield_context yield);
+
+	/*
+	 * Copy length bytes starting at offset of a Shock node to the client.
+	 */
+	void send_shock_range(const std::string &shock_node, const std::string &token,
+			      uint64_t offset, uint64_t length, bool whole,
+			      net::yield_context yield, boost::system::error_code &ec);
+
+	/*
+	 * Serialize a JSON response to the client.
+	 *
+	 * The serializer writes through buffer_ directly to the socket. If
+	 * the whole response fits in one buffer it is sent with a
+	 * Content-Length; otherwise it is sent with chunked transfer
+	 * encoding (or, for HTTP/1.0 clients, delimited by closing the
+	 * connection). The serialized text is never held in memory in full.
+	 *
+	 * If encoding is not identity and the response is at least the
+	 * server's compression threshold, each serialized buffer is passed
+	 * through a streaming compressor on its way out.
+	 *
+	 * A 503 response, or one with retry_later set, carries a
+	 * Retry-After header.
+	 */
+	void write_json_response(json::value &response_value, int http_code, unsigned version,
+				 compression::Encoding encoding, bool retry_later, net::yield_context yield);
+
+	/*
+	 * Execute a JSON-RPC 2.0 batch, returning the array of responses
+	 * (allocated from sp) in the order of the requests.
+	 *
+	 * Entries are dispatched concurrently on coroutines in this
+	 * session's strand, at most the server's batch concurrency at a
+	 * time. Each entry gets its own arena since its database work
+	 * may allocate from it in another thread while other entries
+	 * are running.
+	 *
+	 * Notifications get no entry in the response; if the batch was
+	 * all notifications the result is null and nothing is sent. Entries
+	 * refused for overload set retry_later, and if every entry was
+	 * refused http_code is set to 503 so the whole batch may be retried.
+	 */
+	json::value handle_batch(json::array &batch, json::storage_ptr sp, int &http_code,
+				 bool &retry_later, net::yield_context yield);
 	
 	void error_response(int code, const std::string &msg, net::yield_context yield) {
 	    http::response<http::empty_body> http_resp;
 	    http_resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
 	    http_resp.set(http::field::content_type, "text/plain");
 	    http_resp.result(code);
+	    http_resp.keep_alive(keep_alive_);
 	    http_resp.prepare_payload();
 	    boost::system::error_code ec;
 	    http::async_write(stream_, http_resp, yield[ec]);
 	    if (ec)
 	    {
 		fail(ec, "response write");
+		keep_alive_ = false;
 	    }
 	}
 
-	void handle_options(decltype(header_parser_)::value_type &req, net::yield_context yield) {
+	void handle_options(request_type &req, net::yield_context yield) {
 
 	    http::response<http::empty_body> http_resp;
 	    http_resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
 	    http_resp.set(http::field::content_type, "text/plain");
 
-	    std::cerr << "Handling options " << req.base() << "\n";
+	    WSLOG(lg_, wslog::debug) << "Handling options " << req.base() << "\n";
 
 	    auto &org = req[http::field::origin];
 	    if (!org.empty())
@@ -153,6 +324,7 @@ namespace ws_http_server {
 	    http_resp.set(http::field::access_control_max_age, "86400");
 	
 	    http_resp.result(204);
+	    http_resp.keep_alive(keep_alive_);
 	
 	    http_resp.prepare_payload();
 
@@ -161,114 +333,181 @@ namespace ws_http_server {
 	    if (ec)
 	    {
 		fail(ec, "response write");
+		keep_alive_ = false;
 	    }
 	
 	}
 
-	void handle_api(decltype(header_parser_)::value_type &req, net::yield_context yield) {
+	void handle_api(request_type &req, net::yield_context yield) {
 	    beast::error_code ec;
-	
+
+	    // Must outlive every JSON value built for this request.
+	    json::monotonic_resource arena(json_arena_.data(), json_arena_.size());
+	    json::storage_ptr sp(&arena);
+
+	    /*
+	     * A compressed request body is inflated through zbuffer_
+	     * on its way to the JSON parser.
+	     */
+	    compression::Encoding body_encoding;
+	    if (!compression::parse_content_encoding(req[http::field::content_encoding], body_encoding))
+	    {
+		keep_alive_ = false;
+		error_response(415, "Unsupported content encoding", yield);
+		return;
+	    }
+	    std::unique_ptr<compression::Decompressor> decomp;
+	    size_t decoded_size = 0;
+	    if (body_encoding != compression::Encoding::identity)
+	    {
+		decomp = compression::Decompressor::create(body_encoding);
+		if (!zbuffer_)
+		    zbuffer_ = std::make_unique<std::array<char, 65536>>();
+	    }
+
 	    json::parser parser;
 
-	    parser.start();
+	    parser.start(sp);
+	    tracing::Span body_span(trace_, "read_body");
 
-	    auto &message = header_parser_.get();
+	    auto &message = header_parser_->get();
 	    auto &body_remaining = message.body();
 
 	    body_remaining.data = buffer_.data();
 	    body_remaining.size = buffer_.size();
 
-	    while (body_remaining.size && !header_parser_.is_done())
+	    while (body_remaining.size && !header_parser_->is_done())
 	    {
-		http::async_read_some(stream_, buf_, header_parser_, yield[ec]);
-		// BOOST_LOG_SEV(lg_, wslog::debug) << "read returns " << ec << "\n";
+		http::async_read_some(stream_, buf_, *header_parser_, yield[ec]);
+		// WSLOG(lg_, wslog::debug) << "read returns " << ec << "\n";
 		if (ec == http::error::need_buffer || ec == http::error::need_buffer)
 		{
 		}
 		else if (ec)
 		{
 		    fail(ec, "async_read");
+		    keep_alive_ = false;
 		    return;
 		}
 		size_t n = buffer_.size() - body_remaining.size;
 	    
 		// std::cerr << "Read: " << n << std::string(buffer_.data(), n);
 		try {
-		    parser.write(static_cast<const char *>(buffer_.data()), n);
+		    if (decomp)
+		    {
+			decomp->input(buffer_.data(), n);
+			while (1)
+			{
+			    beast::error_code dec_ec;
+			    size_t m = decomp->output(zbuffer_->data(), zbuffer_->size(), dec_ec);
+			    if (dec_ec)
+			    {
+				ec = dec_ec;
+				break;
+			    }
+			    decoded_size += m;
+			    if (decoded_size > max_decoded_body_size)
+			    {
+				ec = http::error::body_limit;
+				break;
+			    }
+			    parser.write(zbuffer_->data(), m);
+			    if (m < zbuffer_->size() || decomp->done())
+				break;
+			}
+		    }
+		    else
+		    {
+			parser.write(static_cast<const char *>(buffer_.data()), n);
+		    }
 		} catch (std::exception e) {
-		    BOOST_LOG_SEV(lg_, wslog::error) << "jsonrpc parse error " << e.what() << "\n";
+		    WSLOG(lg_, wslog::error) << "jsonrpc parse error " << e.what() << "\n";
+		    keep_alive_ = false;
 		    return;
 		}
 		
 		if (ec && ec != http::error::need_buffer)
 		{
 		    fail(ec, "json parse");
+		    keep_alive_ = false;
 		    return;
 		}
 		body_remaining.data = buffer_.data();
 		body_remaining.size = buffer_.size();
 	    }
 
+	    if (decomp && !decomp->done())
+	    {
+		WSLOG(lg_, wslog::notification) << "compressed request body was truncated\n";
+		keep_alive_ = false;
+		return;
+	    }
+
 	    parser.finish();
+	    body_span.end();
 	    if (parser.is_complete())
 	    {
 		// std::cerr << "parse complete\n";
 		auto v = parser.release();
 		// std::cerr << v << "\n";
-		JsonRpcRequest rpc_req;
-		rpc_req.parse(v, ec);
-		if (ec)
+
+		int http_code = 200;
+		bool retry_later = false;
+		boost::json::value response_value(sp);
+
+		if (v.is_array())
 		{
-		    fail(ec, "request parse");
-		    return;
+		    response_value = handle_batch(v.as_array(), sp, http_code, retry_later, yield);
 		}
-		BOOST_LOG_SEV(lg_, wslog::debug) << "request: " << rpc_req << "\n";
-		JsonRpcResponse rpc_resp(rpc_req);
+		else
+		{
+		    JsonRpcRequest rpc_req(sp);
+		    {
+			tracing::Span span(trace_, "parse_request");
+			rpc_req.parse(v, ec);
+		    }
+		    if (ec)
+		    {
+			fail(ec, "request parse");
+			keep_alive_ = false;
+			return;
+		    }
+		    WSLOG(lg_, wslog::debug) << "request: " << rpc_req << "\n";
+		    JsonRpcResponse rpc_resp(rpc_req);
 
 
-		wslog::logger disp_logger(wslog::channel = name_logger("dispatch", stream_.socket()));
-		DispatchContext dc(yield, stream_.get_executor(), token_, disp_logger);
+		    wslog::logger disp_logger(wslog::channel = name_logger("dispatch", stream_.socket()));
+		    DispatchContext dc(yield, stream_.get_executor(), &token_, disp_logger);
+		    dc.trace = trace_;
 
-		int http_code = 200;
-		server_.dispatcher().dispatch(rpc_req, rpc_resp, dc, http_code);
+		    server_.dispatcher().dispatch(rpc_req, rpc_resp, dc, http_code);
 
-		boost::json::value response_value = rpc_resp.full_response();
+		    response_value = rpc_resp.release_response();
 
-		BOOST_LOG_SEV(lg_, wslog::debug) << "Req " << rpc_req << " had code " << http_code << "\n";
-//		BOOST_LOG_SEV(lg_, wslog::debug) << "Req " << rpc_req << " had code " << http_code << " with response " << response_value << "\n";
+		    WSLOG(lg_, wslog::debug) << "Req " << rpc_req << " had code " << http_code << "\n";
+//		    WSLOG(lg_, wslog::debug) << "Req " << rpc_req << " had code " << http_code << " with response " << response_value << "\n";
+		}
+
+		auto response_encoding = compression::Encoding::identity;
+		if (server_.compression_min_size() >= 0)
+		    response_encoding = compression::negotiate(req[http::field::accept_encoding]);
 
-		/*
-		 * Chunked responses will take some more thought.
-	     
-		 boost::json::serializer sr(response_value);
-		 while (!sr.is_done())
-		 {
-		 char buf[10240];
-		 auto const n = sr.read(buf, sizeof(buf));
-		 }
-		*/
-
-		http::response<http::string_body> http_resp;
-		boost::json::string response_string = boost::json::to_string(response_value);
-		http_resp.body() = std::string(response_string.data(), response_string.size());
-		http_resp.set(http::field::access_control_allow_origin, "*");
-		http_resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-		http_resp.set(http::field::content_type, "application/json");
-		http_resp.set(http::field::connection, "close");
-		http_resp.result(http_code);
-		http_resp.prepare_payload();
-		http::async_write(stream_, http_resp, yield[ec]);
-		if (ec)
 		{
-		    fail(ec, "response write");
+		    tracing::Span span(trace_, "write_response");
+		    if (response_value.is_null())
+			error_response(static_cast<int>(http::status::no_content), "", yield);
+		    else
+			write_json_response(response_value, http_code, req.version(), response_encoding,
+					    retry_later, yield);
 		}
+
 		auto peer = stream_.socket().remote_endpoint(ec);
-		BOOST_LOG_SEV(lg_, wslog::debug) << "Completed request from " << peer;
-		stream_.close();
+		WSLOG(lg_, wslog::debug) << "Completed request from " << peer;
 	    }
 	    else
 	    {
-		BOOST_LOG_SEV(lg_, wslog::notification) << "at end of stream parse was not complete\n";
+		WSLOG(lg_, wslog::notification) << "at end of stream parse was not complete\n";
+		keep_alive_ = false;
 	    }
 	
 	}
@@ -276,71 +515,127 @@ namespace ws_http_server {
 	void loop(net::yield_context yield) {
 
 	    beast::error_code ec;
-	
-	    http::async_read_header(stream_, buf_, header_parser_, yield[ec]);
+	    int n_requests = 0;
 
-	    if (ec)
+	    while (!server_.quit())
 	    {
-		fail(ec, "async_read_header");
-		return;
-	    }
-	    auto &req = header_parser_.get();
-	    // std::cerr << "incoming: " << req.base() << "\n";
+		/*
+		 * Each request gets a fresh parser. The read buffer buf_
+		 * persists across requests so that any bytes of a pipelined
+		 * request that arrived with the previous one are consumed
+		 * here in order.
+		 */
+		header_parser_.emplace();
+		header_parser_->body_limit(1000000);
+		token_.clear();
 
-	    // Handle Expect: 100-continue if present
-	    if (req[http::field::expect] == "100-continue")
-	    {
-		// std::cerr << " process continue\n";
+		stream_.expires_after(server_.idle_timeout());
 
-		http::response<http::empty_body> res;
-		res.version(11);
-		res.result(http::status::continue_);
-		res.set(http::field::server, "tesT");
-		http::async_write(stream_, res, yield[ec]);
-		if (ec)
+		/*
+		 * Wait for the first bytes of the request before starting
+		 * the clock, so the header read span doesn't include
+		 * the time the connection sat idle.
+		 */
+		if (buf_.size() == 0)
 		{
-		    fail(ec, "async_write 100-continue");
-		    return;
+		    size_t n = stream_.async_read_some(buf_.prepare(buf_.max_size()), yield[ec]);
+		    buf_.commit(n);
 		}
-	    }
+		trace_ = tracing::Trace::start();
+		tracing::Span header_span(trace_, "read_header");
+		if (!ec)
+		    http::async_read_header(stream_, buf_, *header_parser_, yield[ec]);
+		header_span.end();
+		stream_.expires_never();
+
+		if (ec == http::error::end_of_stream || ec == net::error::eof || ec == beast::error::timeout)
+		{
+		    // Client closed or went idle between requests.
+		    WSLOG(lg_, wslog::debug) << "closing after " << n_requests << " requests: " << ec.message();
+		    break;
+		}
+		else if (ec)
+		{
+		    fail(ec, "async_read_header");
+		    break;
+		}
+		auto &req = header_parser_->get();
+		// std::cerr << "incoming: " << req.base() << "\n";
 
-	    /*
-	     * Extract token from headers if present.
-	     */
-	    auto auth_hdr = req["Authorization"];
-	    if (auth_hdr != "")
-	    {
-		token_.parse(auth_hdr);
-		// We just parse into the token here.
-		// The decision about if we even need to validate
-		// it is left to the called code
-	    }
+		n_requests++;
+		int max_requests = server_.max_requests_per_connection();
+		keep_alive_ = req.keep_alive() && (max_requests <= 0 || n_requests < max_requests);
 
-	    /*
-	     * Process requests. We vector GET to handle_get,
-	     * POST to the API URL to handle_api,
-	     * and mark anything else as an error.
-	     */
+		// Handle Expect: 100-continue if present
+		if (req[http::field::expect] == "100-continue")
+		{
+		    // std::cerr << " process continue\n";
+
+		    http::response<http::empty_body> res;
+		    res.version(11);
+		    res.result(http::status::continue_);
+		    res.set(http::field::server, "tesT");
+		    http::async_write(stream_, res, yield[ec]);
+		    if (ec)
+		    {
+			fail(ec, "async_write 100-continue");
+			break;
+		    }
+		}
+
+		/*
+		 * Extract token from headers if present.
+		 */
+		auto auth_hdr = req["Authorization"];
+		if (auth_hdr != "")
+		{
+		    token_.assign(auth_hdr);
+		    // We just copy the token here. Parsing it, and the
+		    // decision about if we even need to validate it,
+		    // is left to the called code
+		}
+
+		/*
+		 * Process requests. We vector GET to handle_get,
+		 * POST to the API URL to handle_api,
+		 * and mark anything else as an error.
+		 */
        
-	    if (req.method() == http::verb::get)
-	    {
-		handle_get(req, yield);
-	    }
-	    if (req.method() == http::verb::options)
-	    {
-		if (req.target() == server_.api_root())
+		if (req.method() == http::verb::get)
+		{
+		    handle_get(req, yield);
+		}
+		else if (req.method() == http::verb::options && req.target() == server_.api_root())
 		{
 		    handle_options(req, yield);
 		}
-	    }
-	    else if (req.method() == http::verb::post)
-	    {
-		if (req.target() == server_.api_root())
+		else if (req.method() == http::verb::post && req.target() == server_.api_root())
 		{
 		    //std::cerr << "handle api req\n";
 
 		    handle_api(req, yield);
 		}
+		else
+		{
+		    // We have not read the body of the request so cannot continue.
+		    keep_alive_ = false;
+		    error_response(404, "Not found", yield);
+		}
+
+		/*
+		 * If the handler left any of the request body unread we can't
+		 * find the start of the next request.
+		 */
+		if (!header_parser_->is_done())
+		    keep_alive_ = false;
+
+		if (!keep_alive_)
+		    break;
+	    }
+
+	    if (stream_.socket().is_open())
+	    {
+		stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
 	    }
 	}
     };
@@ -357,9 +652,15 @@ namespace ws_http_server {
 	tcp::socket socket_;
 	Server &server_;
     public:
+	/*
+	 * If reuse_port is set the acceptor is bound with SO_REUSEPORT so
+	 * that several listeners may share the endpoint, with the kernel
+	 * distributing incoming connections among them.
+	 */
 	Listener(net::io_context &ioc,
 		 tcp::endpoint endpoint,
-		 Server &server)
+		 Server &server,
+		 bool reuse_port = false)
 	    : ioc_(ioc)
 	    , acceptor_(net::make_strand(ioc))
 	    , socket_(net::make_strand(ioc))
@@ -384,6 +685,17 @@ namespace ws_http_server {
 		return;
 	    }
 
+	    // Asio has no public option for SO_REUSEPORT.
+	    if (reuse_port)
+	    {
+		int one = 1;
+		if (::setsockopt(acceptor_.native_handle(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+		{
+		    fail(beast::error_code(errno, boost::system::system_category()), "set_option reuse_port");
+		    return;
+		}
+	    }
+
 	    // Bind to address and write listening port
 	    acceptor_.bind(endpoint, ec);
 	    if (ec)
@@ -397,7 +709,7 @@ namespace ws_http_server {
 		fail(ec, "local_endpoint");
 		return;
 	    }
-	    BOOST_LOG_SEV(lg_, wslog::debug) << "listening on " << local << "\n";
+	    WSLOG(lg_, wslog::debug) << "listening on " << local << "\n";
 
 	    // Start listening
 	    acceptor_.listen(net::socket_base::max_listen_connections, ec);
@@ -432,7 +744,7 @@ namespace ws_http_server {
 			fail(ec, "remote_endpoint");
 		    }
 		
-		    BOOST_LOG_SEV(lg_, wslog::debug) << "connection from " << peer << "\n";
+		    WSLOG(lg_, wslog::debug) << "connection from " << peer << "\n";
 		
 		
 		    // Create the session and run it
@@ -2,12 +2,18 @@
 #define _JSONRPC_h
 
 // Wrap a JSON-RPC message.
+//
+// A request and its response share a storage pointer, normally the
+// per-request arena set up by the HTTP session. All of their values are
+// allocated from it, and it is released in one step when the request
+// completes, so it must outlive both objects.
 
 #include <string>
 #include <boost/json.hpp>
 #include <iostream>
 
 #include "WorkspaceErrors.h"
+#include "Logging.h"
 
 class JsonRpcRequest
 {
@@ -16,21 +22,35 @@ class JsonRpcRequest
     boost::json::string method_;
     boost::json::string service_;
     boost::json::array params_;
+    bool notification_;
 
 public:
-    JsonRpcRequest() {}
+    explicit JsonRpcRequest(boost::json::storage_ptr sp = {})
+	: id_(sp)
+	, raw_method_(sp)
+	, method_(sp)
+	, service_(sp)
+	, params_(sp)
+	, notification_(false) {}
+
+    /*
+     * Parse the request. The params are moved out of req rather
+     * than copied, so req should have been allocated from our storage.
+     */
     void parse(boost::json::value &req, boost::system::error_code &ec) {
 	try {
 	    auto &obj = req.as_object();
 
-	    auto &id = obj["id"];
-	    if (id.kind() == boost::json::kind::int64)
-		id_ = std::to_string(id.as_int64());
-	    else if (id.kind() == boost::json::kind::string)
-		id_ = id.as_string();
+	    // A request without an id is a notification and gets no response.
+	    auto id = obj.if_contains("id");
+	    notification_ = !id;
+	    if (id && id->kind() == boost::json::kind::int64)
+		id_ = std::to_string(id->as_int64());
+	    else if (id && id->kind() == boost::json::kind::string)
+		id_ = id->as_string();
 	    
 	    raw_method_ = obj["method"].as_string();
-	    params_ = obj["params"].as_array();
+	    params_ = std::move(obj["params"].as_array());
 
 	    size_t n = raw_method_.find('.');
 	    if (n == boost::json::string::npos)
@@ -47,19 +67,19 @@ public:
 	    
 	}
 	catch (boost::json::type_error e) {
-	    std::cerr << "parse error " << e.what() << "\n";
-	    std::cerr << req << "\n";
+	    WSLOG(wslog::thread_logger("jsonrpc"), wslog::notification) << "parse error " << e.what() << "\n";
+	    WSLOG(wslog::thread_logger("jsonrpc"), wslog::debug) << req << "\n";
 	    ec = WorkspaceErrc::InvalidJsonRpcRequest;
 	    return;
 	}
 	catch (std::exception e) {
-	    std::cerr << "other error " << e.what() << "\n";
+	    WSLOG(wslog::thread_logger("jsonrpc"), wslog::notification) << "other error " << e.what() << "\n";
 	    ec = WorkspaceErrc::InvalidJsonRpcRequest;
 	    return;
 	}
 	catch(...)
 	{
-	    std::cerr << "other error!\n";
+	    WSLOG(wslog::thread_logger("jsonrpc"), wslog::notification) << "other error!\n";
 	    ec = WorkspaceErrc::InvalidJsonRpcRequest;
 	    return;
 	}
@@ -70,6 +90,8 @@ public:
     const boost::json::string &method() const { return method_; }
     const boost::json::string &service() const { return service_; }
     const boost::json::array &params() const { return params_; }
+    const boost::json::storage_ptr &storage() const { return params_.storage(); }
+    bool is_notification() const { return notification_; }
     
     friend std::ostream &operator<<(std::ostream &os, const JsonRpcRequest &req);
 };
@@ -82,12 +104,15 @@ class JsonRpcResponse
 
 public:
     JsonRpcResponse(const JsonRpcRequest &req)
-	: id_(req.id()) {}
+	: id_(req.id(), req.storage())
+	, error_(req.storage())
+	, result_(req.storage()) {}
 
     const boost::json::string &id() const { return id_; }
     const boost::json::object &error() const { return error_; }
     const boost::json::array &result() const { return result_; }
     boost::json::array &result() { return result_; }
+    const boost::json::storage_ptr &storage() const { return result_.storage(); }
     
     void id(const boost::json::string &id) { id_ = id; }
     void error(const boost::json::object &error) { error_ = error; }
@@ -99,28 +124,49 @@ public:
 		{ "message", message },
 		{ "data", data },
 	};
-	std::cerr << error_ << "\n";
+	WSLOG(wslog::thread_logger("jsonrpc"), wslog::debug) << error_ << "\n";
 
     }
 
+    /**
+     * Build the complete response object, leaving this response intact.
+     */
     boost::json::value full_response() {
+	boost::json::storage_ptr sp = storage();
 	if (!error_.empty())
 	{
-	    return {
+	    return boost::json::value({
 		{ "jsonrpc", "2.0" },
 		{ "id", id_ },
 		{ "error", error_ }
-	    };
+		}, sp);
 	}
 	else
 	{
-	    return {
+	    return boost::json::value({
 		{ "jsonrpc", "2.0" },
 		{ "id", id_ },
 		{ "result", result_ }
-	    };
+		}, sp);
 	}
     }
+
+    /**
+     * Build the complete response object by moving the result or error
+     * into it. This avoids a deep copy of a potentially large result;
+     * the response is left empty afterwards.
+     */
+    boost::json::value release_response() {
+	boost::json::value v(storage());
+	auto &obj = v.emplace_object();
+	obj.emplace("jsonrpc", "2.0");
+	obj.emplace("id", id_);
+	if (!error_.empty())
+	    obj.emplace("error", std::move(error_));
+	else
+	    obj.emplace("result", std::move(result_));
+	return v;
+    }
 	
     friend std::ostream &operator<<(std::ostream &os, const JsonRpcResponse &req);
 };
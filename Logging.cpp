@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
 #include <ostream>
 #include <fstream>
 #include <boost/smart_ptr/shared_ptr.hpp>
@@ -14,7 +15,8 @@
 #include <boost/log/sources/basic_logger.hpp>
 #include <boost/log/sources/severity_channel_logger.hpp>
 #include <boost/log/sources/record_ostream.hpp>
-#include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/unbounded_fifo_queue.hpp>
 #include <boost/log/sinks/text_ostream_backend.hpp>
 #include <boost/log/attributes/scoped_attribute.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
@@ -30,10 +32,16 @@ namespace attrs = boost::log::attributes;
 namespace keywords = boost::log::keywords;
 
 
+/*
+ * The asynchronous frontend hands each record to a lock-free queue
+ * and returns; a dedicated thread per sink formats and writes them.
+ */
+typedef sinks::asynchronous_sink< sinks::text_ostream_backend, sinks::unbounded_fifo_queue > text_sink;
+
+static std::vector< boost::shared_ptr< text_sink > > active_sinks;
+
 void wslog::init(std::string output_file, severity_level file_sev, severity_level console_sev)
 {
-    typedef sinks::synchronous_sink< sinks::text_ostream_backend > text_sink;
-
     // Console output
 
     boost::shared_ptr< text_sink > sink = boost::make_shared< text_sink >();
@@ -53,6 +61,7 @@ void wslog::init(std::string output_file, severity_level file_sev, severity_leve
 	    expr::attr<severity_level>("Severity").or_throw() >= console_sev
 	);
     logging::core::get()->add_sink(sink);
+    active_sinks.push_back(sink);
 
 
     // File output
@@ -80,6 +89,7 @@ void wslog::init(std::string output_file, severity_level file_sev, severity_leve
 		);
 	
 	logging::core::get()->add_sink(sink);
+	active_sinks.push_back(sink);
     }
     
 
@@ -88,3 +98,15 @@ void wslog::init(std::string output_file, severity_level file_sev, severity_leve
     logging::core::get()->add_global_attribute("Scope", attrs::named_scope());
 }
 
+
+void wslog::shutdown()
+{
+    auto core = logging::core::get();
+    for (auto &sink: active_sinks)
+    {
+	core->remove_sink(sink);
+	sink->stop();
+	sink->flush();
+    }
+    active_sinks.clear();
+}
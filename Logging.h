@@ -1,12 +1,29 @@
 #ifndef _Logging_h
 #define _Logging_h
 
+#include <map>
 #include <ostream>
+#include <boost/system/error_code.hpp>
 #include <boost/log/expressions/keyword.hpp>
 #include <boost/log/sources/severity_channel_logger.hpp>
 #include <boost/log/keywords/channel.hpp>
 #include <boost/log/sources/record_ostream.hpp>
 
+/*
+ * Records below WSLOG_MIN_SEVERITY are removed at compile time,
+ * along with the formatting of their arguments. Build with e.g.
+ * -DWSLOG_MIN_SEVERITY=1 to drop debug logging.
+ */
+#ifndef WSLOG_MIN_SEVERITY
+#define WSLOG_MIN_SEVERITY 0
+#endif
+
+/*
+ * Log to lg at severity sev; use in place of BOOST_LOG_SEV.
+ */
+#define WSLOG(lg, sev) \
+    if (static_cast<int>(sev) < WSLOG_MIN_SEVERITY) {} else BOOST_LOG_SEV(lg, sev)
+
 namespace wslog {
 
     using namespace boost::log::keywords;
@@ -49,8 +66,31 @@ namespace wslog {
 
     typedef boost::log::sources::severity_channel_logger<severity_level, std::string> logger;
 
+    /*
+     * Set up the console sink and, if output_file is given, a file sink.
+     * Sinks are asynchronous: records are queued and written by a
+     * background thread per sink, so logging never blocks on I/O.
+     */
     void init(std::string output_file, severity_level file_sev, severity_level console_sev);
 
+    /*
+     * Write out queued records and stop the sink threads.
+     */
+    void shutdown();
+
+    /*
+     * Logger for code without a LoggerBase of its own. Loggers are not
+     * thread safe, so each thread has its own instance per channel.
+     * channel is expected to be a string literal.
+     */
+    inline logger &thread_logger(const char *channel) {
+	thread_local std::map<const char *, logger> loggers;
+	auto iter = loggers.find(channel);
+	if (iter == loggers.end())
+	    iter = loggers.emplace(channel, logger(wslog::channel = std::string(channel))).first;
+	return iter->second;
+    }
+
     class LoggerBase
     {
     protected:
@@ -61,7 +101,7 @@ namespace wslog {
 	    : lg_(wslog::channel = channel) {}
 
 	void fail(boost::system::error_code ec, char const* what) {
-	    BOOST_LOG_SEV(lg_, wslog::critical) << what << ": " << ec.message();
+	    WSLOG(lg_, wslog::critical) << what << ": " << ec.message();
 	}
     };
 
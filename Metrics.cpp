@@ -0,0 +1,144 @@
+#include "Metrics.h"
+
+#include <sstream>
+
+using namespace metrics;
+
+const double Histogram::bounds[Histogram::n_buckets] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+void Histogram::observe(std::chrono::nanoseconds d)
+{
+    double secs = std::chrono::duration<double>(d).count();
+    int b = 0;
+    while (b < n_buckets && secs > bounds[b])
+	b++;
+    auto &s = stripes_[stripe_index()];
+    s.counts[b].fetch_add(1, std::memory_order_relaxed);
+    s.sum_ns.fetch_add(d.count() > 0 ? d.count() : 0, std::memory_order_relaxed);
+}
+
+void Histogram::snapshot(std::array<uint64_t, n_buckets + 1> &counts, double &sum) const
+{
+    counts.fill(0);
+    uint64_t sum_ns = 0;
+    for (auto &s: stripes_)
+    {
+	for (int b = 0; b <= n_buckets; b++)
+	    counts[b] += s.counts[b].load(std::memory_order_relaxed);
+	sum_ns += s.sum_ns.load(std::memory_order_relaxed);
+    }
+    sum = sum_ns / 1e9;
+}
+
+Registry &Registry::instance()
+{
+    static Registry registry;
+    return registry;
+}
+
+Registry::Family &Registry::family(const std::string &name, Type type, const std::string &help)
+{
+    auto iter = families_.find(name);
+    if (iter == families_.end())
+    {
+	iter = families_.emplace(name, Family()).first;
+	iter->second.type = type;
+	iter->second.help = help;
+    }
+    else if (iter->second.type != type)
+    {
+	throw std::logic_error("metric " + name + " registered with conflicting types");
+    }
+    return iter->second;
+}
+
+Counter &Registry::counter(const std::string &name, const std::string &help, const std::string &labels)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto &m = family(name, Type::counter, help).counters[labels];
+    if (!m)
+	m = std::make_unique<Counter>();
+    return *m;
+}
+
+Gauge &Registry::gauge(const std::string &name, const std::string &help, const std::string &labels)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto &m = family(name, Type::gauge, help).gauges[labels];
+    if (!m)
+	m = std::make_unique<Gauge>();
+    return *m;
+}
+
+Histogram &Registry::histogram(const std::string &name, const std::string &help, const std::string &labels)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto &m = family(name, Type::histogram, help).histograms[labels];
+    if (!m)
+	m = std::make_unique<Histogram>();
+    return *m;
+}
+
+/*
+ * name{labels} with an optional extra label appended.
+ */
+static std::string series(const std::string &name, const std::string &labels, const std::string &extra = "")
+{
+    std::string l = labels;
+    if (!extra.empty())
+	l = l.empty() ? extra : l + "," + extra;
+    return l.empty() ? name : name + "{" + l + "}";
+}
+
+std::string Registry::render()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::ostringstream os;
+
+    for (auto &fam: families_)
+    {
+	auto &name = fam.first;
+	auto &f = fam.second;
+	os << "# HELP " << name << " " << f.help << "\n";
+	switch (f.type)
+	{
+	case Type::counter:
+	    os << "# TYPE " << name << " counter\n";
+	    for (auto &m: f.counters)
+		os << series(name, m.first) << " " << m.second->value() << "\n";
+	    break;
+
+	case Type::gauge:
+	    os << "# TYPE " << name << " gauge\n";
+	    for (auto &m: f.gauges)
+		os << series(name, m.first) << " " << m.second->value() << "\n";
+	    break;
+
+	case Type::histogram:
+	    os << "# TYPE " << name << " histogram\n";
+	    for (auto &m: f.histograms)
+	    {
+		std::array<uint64_t, Histogram::n_buckets + 1> counts;
+		double sum;
+		m.second->snapshot(counts, sum);
+		uint64_t cumulative = 0;
+		for (int b = 0; b < Histogram::n_buckets; b++)
+		{
+		    cumulative += counts[b];
+		    std::ostringstream le;
+		    le << "le=\"" << Histogram::bounds[b] << "\"";
+		    os << series(name + "_bucket", m.first, le.str()) << " " << cumulative << "\n";
+		}
+		cumulative += counts[Histogram::n_buckets];
+		os << series(name + "_bucket", m.first, "le=\"+Inf\"") << " " << cumulative << "\n";
+		os << series(name + "_sum", m.first) << " " << sum << "\n";
+		os << series(name + "_count", m.first) << " " << cumulative << "\n";
+	    }
+	    break;
+	}
+    }
+    return os.str();
+}
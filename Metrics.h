@@ -0,0 +1,180 @@
+#ifndef _Metrics_h
+#define _Metrics_h
+
+/*
+ * Service metrics, exported in the Prometheus text format from
+ * the /metrics endpoint.
+ *
+ * Counters and histograms are striped: each thread updates its own
+ * cache line with relaxed atomics, and the stripes are only summed
+ * when the metrics are rendered. Updates therefore never take a lock
+ * or contend with other threads.
+ *
+ * Metrics are created through the Registry, which owns them for the
+ * life of the process; callers look a metric up once and keep the
+ * reference.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace metrics {
+
+    const int n_stripes = 16;
+
+    /*
+     * The stripe used by the calling thread.
+     */
+    inline int stripe_index() {
+	static std::atomic<unsigned> next{0};
+	thread_local int idx = next++ % n_stripes;
+	return idx;
+    }
+
+    class Counter
+    {
+	struct alignas(64) Stripe
+	{
+	    std::atomic<uint64_t> value{0};
+	};
+	std::array<Stripe, n_stripes> stripes_;
+
+    public:
+	void inc(uint64_t n = 1) {
+	    stripes_[stripe_index()].value.fetch_add(n, std::memory_order_relaxed);
+	}
+	uint64_t value() const {
+	    uint64_t v = 0;
+	    for (auto &s: stripes_)
+		v += s.value.load(std::memory_order_relaxed);
+	    return v;
+	}
+    };
+
+    /*
+     * A value that goes up and down, such as the number of open
+     * sessions. Gauges change rarely enough that a single atomic is fine.
+     */
+    class Gauge
+    {
+	std::atomic<int64_t> value_{0};
+    public:
+	void inc() { value_.fetch_add(1, std::memory_order_relaxed); }
+	void dec() { value_.fetch_sub(1, std::memory_order_relaxed); }
+	void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+	int64_t value() const { return value_.load(std::memory_order_relaxed); }
+    };
+
+    /*
+     * Latency histogram with fixed bucket bounds in seconds.
+     */
+    class Histogram
+    {
+    public:
+	static const int n_buckets = 14;
+	static const double bounds[n_buckets];
+
+    private:
+	struct alignas(64) Stripe
+	{
+	    std::atomic<uint64_t> counts[n_buckets + 1];
+	    std::atomic<uint64_t> sum_ns{0};
+	    Stripe() {
+		for (auto &c: counts)
+		    c.store(0, std::memory_order_relaxed);
+	    }
+	};
+	std::array<Stripe, n_stripes> stripes_;
+
+    public:
+	void observe(std::chrono::nanoseconds d);
+	void observe(double seconds) {
+	    observe(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(seconds)));
+	}
+
+	/*
+	 * Sum the stripes; counts has n_buckets + 1 entries, the last
+	 * being the overflow (+Inf) bucket. Counts are not cumulative.
+	 */
+	void snapshot(std::array<uint64_t, n_buckets + 1> &counts, double &sum) const;
+    };
+
+    /*
+     * Observe the time from construction to destruction.
+     */
+    class ScopedTimer
+    {
+	Histogram &hist_;
+	std::chrono::steady_clock::time_point start_;
+    public:
+	explicit ScopedTimer(Histogram &h)
+	    : hist_(h)
+	    , start_(std::chrono::steady_clock::now()) {}
+	~ScopedTimer() {
+	    hist_.observe(std::chrono::steady_clock::now() - start_);
+	}
+    };
+
+    class Registry
+    {
+	enum class Type { counter, gauge, histogram };
+	struct Family
+	{
+	    Type type;
+	    std::string help;
+	    // Keyed by the rendered label set, e.g. method="ls"
+	    std::map<std::string, std::unique_ptr<Counter>> counters;
+	    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+	    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+	};
+
+	std::mutex mtx_;
+	std::map<std::string, Family> families_;
+
+	Family &family(const std::string &name, Type type, const std::string &help);
+
+    public:
+	static Registry &instance();
+
+	/*
+	 * Find or create the metric name{labels}. labels is in
+	 * Prometheus form without the braces (e.g. "pool=\"sync\"").
+	 */
+	Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+	Gauge &gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+	Histogram &histogram(const std::string &name, const std::string &help, const std::string &labels = "");
+
+	/*
+	 * Render all metrics in the Prometheus text exposition format.
+	 */
+	std::string render();
+    };
+
+    /*
+     * The metrics shared across the service.
+     */
+    inline Gauge &active_sessions() {
+	static Gauge &g = Registry::instance().gauge("ws_active_sessions", "Open HTTP connections");
+	return g;
+    }
+    inline Counter &download_bytes() {
+	static Counter &c = Registry::instance().counter("ws_download_bytes_total", "Bytes of object data sent from /dl/");
+	return c;
+    }
+    inline Histogram &shock_request_seconds() {
+	static Histogram &h = Registry::instance().histogram("ws_shock_request_seconds", "Latency of requests to Shock");
+	return h;
+    }
+    inline Gauge &pending_uploads() {
+	static Gauge &g = Registry::instance().gauge("ws_pending_uploads", "Shock uploads awaiting completion");
+	return g;
+    }
+}
+
+#endif
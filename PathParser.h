@@ -184,7 +184,7 @@ public:
 	}
 	if (!err.empty())
 	{
-	    std::cerr << "Error found: " << err << "\n";
+	    WSLOG(wslog::thread_logger("pathparser"), wslog::debug) << "Error found: " << err << "\n";
 	    /*
 	    if (on_error_)
 	    {
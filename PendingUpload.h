@@ -3,9 +3,12 @@
 
 #include <boost/chrono/include.hpp>
 #include <boost/chrono/chrono_io.hpp>
+#include <memory>
 #include <string>
 #include <iostream>
 
+#include "AuthToken.h"
+
 /**
  * A PendingUpload represents a workspace object which has been
  * created with createUploadNodes=true and whose actual
@@ -20,16 +23,18 @@ private:
     
     std::string object_id_;
     std::string shock_url_;
-    AuthToken auth_token_;
+    // Shared with the other uploads created by the same request.
+    std::shared_ptr<const AuthToken> auth_token_;
     mutable size_t size_;
     mutable bool updated_;
     clock::time_point creation_time_;
     
 public:
-    explicit PendingUpload(const std::string &object_id, const std::string &shock_url, const AuthToken &token)
+    explicit PendingUpload(const std::string &object_id, const std::string &shock_url,
+			   std::shared_ptr<const AuthToken> token)
 	: object_id_(object_id)
 	, shock_url_(shock_url)
-	, auth_token_(token)
+	, auth_token_(std::move(token))
 	, size_{}
 	, updated_{false}
 	, creation_time_{clock::now()} {
@@ -37,7 +42,7 @@ public:
 
     const std::string &object_id() const { return object_id_; }
     const std::string &shock_url() const { return shock_url_; }
-    const AuthToken &auth_token() const { return auth_token_; }
+    const AuthToken &auth_token() const { return *auth_token_; }
     size_t size() const { return size_; }
     bool updated() const { return updated_; }
 
@@ -0,0 +1,137 @@
+#include "Reclaimer.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/filesystem.hpp>
+
+#include "WorkspaceDB.h"
+#include "WorkspaceState.h"
+
+namespace fs = boost::filesystem;
+
+Reclaimer::Reclaimer(WorkspaceDB &db, WorkspaceState &state, int threads, int max_shock_workers)
+    : wslog::LoggerBase("reclaim")
+    , db_(db)
+    , state_(state)
+    , pool_(std::max(1, threads))
+    , shock_workers_(0)
+    , max_shock_workers_(std::max(1, max_shock_workers))
+{
+}
+
+void Reclaimer::submit(RemovalRequest &&req)
+{
+    if (req.empty())
+	return;
+
+    for (auto &p: req.files())
+    {
+	boost::asio::post(pool_, [this, p]() {
+	    boost::system::error_code ec;
+	    fs::remove(p, ec);
+	    if (ec)
+		WSLOG(lg_, wslog::error) << "cannot remove " << p << ": " << ec.message() << "\n";
+	});
+    }
+    for (auto &p: req.directories())
+    {
+	boost::asio::post(pool_, [this, p]() {
+	    boost::system::error_code ec;
+	    fs::remove_all(p, ec);
+	    if (ec)
+		WSLOG(lg_, wslog::error) << "cannot remove " << p << ": " << ec.message() << "\n";
+	});
+    }
+
+    if (!req.shock_objects().empty())
+    {
+	auto shared_req = std::make_shared<RemovalRequest>(std::move(req));
+	boost::asio::post(pool_, [this, shared_req]() { reclaim_shock_nodes(*shared_req); });
+    }
+}
+
+/*
+ * Queue the nodes in req that no object refers to any longer. Runs
+ * on the pool, as the check is a blocking query.
+ */
+void Reclaimer::reclaim_shock_nodes(const RemovalRequest &req)
+{
+    std::vector<std::string> urls;
+    for (auto &s: req.shock_objects())
+	urls.push_back(s.shock_url);
+    std::sort(urls.begin(), urls.end());
+    urls.erase(std::unique(urls.begin(), urls.end()), urls.end());
+
+    std::set<std::string> referenced;
+    try {
+	auto qobj = db_.make_query(no_token_, true);
+	referenced = qobj->referenced_shock_nodes(urls);
+    } catch (std::exception &e) {
+	// Better to leak the nodes than to delete data still in use.
+	WSLOG(lg_, wslog::error) << "cannot check references of " << urls.size() << " Shock nodes: " << e.what() << "\n";
+	return;
+    }
+
+    {
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (auto &u: urls)
+	{
+	    if (referenced.count(u))
+		WSLOG(lg_, wslog::debug) << "Shock node " << u << " still in use\n";
+	    else
+		shock_queue_.push_back(u);
+	}
+    }
+    start_shock_workers();
+}
+
+void Reclaimer::start_shock_workers()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    while (shock_workers_ < max_shock_workers_ && static_cast<size_t>(shock_workers_) < shock_queue_.size())
+    {
+	shock_workers_++;
+	boost::asio::spawn(state_.ioc(), [this](boost::asio::yield_context yield) { shock_worker(yield); });
+    }
+}
+
+/*
+ * Delete queued nodes until the queue is empty. A worker leaves under
+ * the same lock that submitters take to queue, so no node is left
+ * queued with no worker to take it.
+ */
+void Reclaimer::shock_worker(boost::asio::yield_context yield)
+{
+    while (1)
+    {
+	std::string url;
+	{
+	    std::lock_guard<std::mutex> lock(mtx_);
+	    if (shock_queue_.empty())
+	    {
+		shock_workers_--;
+		return;
+	    }
+	    url = std::move(shock_queue_.front());
+	    shock_queue_.pop_front();
+	}
+	// Fetched per node as the queue may outlast a token.
+	auto token = state_.ws_auth(yield);
+	if (!token->valid())
+	{
+	    WSLOG(lg_, wslog::error) << "no service token, cannot delete Shock node " << url << "\n";
+	    continue;
+	}
+	try {
+	    if (state_.shock().delete_node(url, *token, yield))
+		WSLOG(lg_, wslog::debug) << "deleted Shock node " << url << "\n";
+	    else
+		WSLOG(lg_, wslog::error) << "cannot delete Shock node " << url << "\n";
+	} catch (std::exception &e) {
+	    WSLOG(lg_, wslog::error) << "cannot delete Shock node " << url << ": " << e.what() << "\n";
+	}
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef _Reclaimer_h
+#define _Reclaimer_h
+
+/*
+ * Background removal of the storage of deleted objects.
+ *
+ * A delete or overwrite commits its database changes and returns to the
+ * client; the files, directories and Shock nodes it collected in its
+ * RemovalRequest are handed to submit() and removed here afterwards.
+ *
+ * The database layer has already moved files and directories out of
+ * the workspace tree (see WorkspaceDBQuery::move_to_trash), so nothing
+ * created at the same path in the meantime is at risk. They are removed
+ * on a pool of threads, one entry per task.
+ *
+ * Shock nodes may be shared by copies of an object, so a node is
+ * deleted only if no object still refers to it; that is checked with
+ * one query per request. The deletes themselves are made by up to
+ * max_shock_workers coroutines, each taking the next node from a
+ * shared queue until it is empty.
+ */
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "AuthToken.h"
+#include "Logging.h"
+#include "WorkspaceTypes.h"
+
+class WorkspaceDB;
+class WorkspaceState;
+
+class Reclaimer
+    : public wslog::LoggerBase
+{
+    WorkspaceDB &db_;
+    WorkspaceState &state_;
+    boost::asio::thread_pool pool_;
+
+    // Queries made here act for no user.
+    AuthToken no_token_;
+
+    std::mutex mtx_;
+    std::deque<std::string> shock_queue_;
+    int shock_workers_;
+    int max_shock_workers_;
+
+    void reclaim_shock_nodes(const RemovalRequest &req);
+    void start_shock_workers();
+    void shock_worker(boost::asio::yield_context yield);
+
+public:
+    Reclaimer(WorkspaceDB &db, WorkspaceState &state, int threads, int max_shock_workers);
+    ~Reclaimer() { pool_.join(); }
+
+    /*
+     * Remove everything in req. Returns at once.
+     */
+    void submit(RemovalRequest &&req);
+};
+
+#endif
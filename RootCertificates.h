@@ -8,6 +8,8 @@
 #include <sstream>
 #include <array>
 
+#include "Logging.h"
+
 inline void load_root_certificates(std::istream &istr, boost::asio::ssl::context &ctx,
 				   boost::system::error_code &ec)
 {
@@ -36,7 +38,7 @@ inline void load_root_certificates(std::istream &istr, boost::asio::ssl::context
 		    boost::asio::buffer(cert.data(), cert.size()), ec);
 		if (ec)
 		{
-		    std::cerr << "error loading cert: " << ec.message() << "\n";
+		    WSLOG(wslog::thread_logger("ssl"), wslog::error) << "error loading cert: " << ec.message() << "\n";
 		}
 
 		cert.clear();
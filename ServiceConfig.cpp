@@ -1,4 +1,5 @@
 #include "ServiceConfig.h"
+#include "Logging.h"
 
 ServiceConfig::ServiceConfig(const std::string &service)
   : service_name_(service)
@@ -14,14 +15,14 @@ bool ServiceConfig::parse()
 {
     if (config_file_.empty())
     {
-	std::cerr << "ServiceConfig::parse: no file set\n";
+	WSLOG(wslog::thread_logger("config"), wslog::error) << "ServiceConfig::parse: no file set\n";
 	return false;
     }
     parser_ = std::make_unique<INIReader>(config_file_);
 
     if (parser_->ParseError() != 0)
     {
-	std::cerr << "ServiceConfig::parse failed\n";
+	WSLOG(wslog::thread_logger("config"), wslog::error) << "ServiceConfig::parse failed\n";
 	return false;
     }
 
@@ -0,0 +1,162 @@
+#include "ServiceTokenManager.h"
+
+#include <ctime>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/json.hpp>
+
+#include "Base64.h"
+#include "Logging.h"
+
+ServiceTokenManager::ServiceTokenManager(boost::asio::io_context &ioc, WorkspaceConfig &config, UserAgent &user_agent)
+    : ioc_(ioc)
+    , config_(config)
+    , user_agent_(user_agent)
+    , timer_(ioc)
+    , token_(std::make_shared<const AuthToken>())
+    , invalid_token_(token_)
+    , fetching_(false)
+{
+}
+
+void ServiceTokenManager::start()
+{
+    boost::asio::spawn(ioc_, [this](boost::asio::yield_context yield) { run(yield); });
+}
+
+/*
+ * The current token if it is valid and unexpired, otherwise null.
+ */
+std::shared_ptr<const AuthToken> ServiceTokenManager::current()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (token_->valid() && !token_->is_expired())
+	return token_;
+    return nullptr;
+}
+
+std::shared_ptr<const AuthToken> ServiceTokenManager::get(boost::asio::yield_context yield)
+{
+    auto tok = current();
+    if (tok)
+	return tok;
+
+    refresh(yield);
+    tok = current();
+    return tok ? tok : invalid_token_;
+}
+
+/*
+ * Request a new token from the auth service.
+ */
+std::shared_ptr<const AuthToken> ServiceTokenManager::fetch(boost::asio::yield_context yield)
+{
+    std::string auth = "Basic " + base64EncodeText(config_.get_string("wsuser") + ":" +
+						   config_.get_string("wspassword"));
+    std::string body;
+    URL u("https://rast.nmpdr.org/goauth/token?grant_type=client_credentials");
+    try {
+	user_agent_.request("GET", u, {{ "Authorization", auth }}, [&body] (const UserAgent::Response &r)
+	    {
+		body = r.body();
+	    }, yield);
+	auto doc = boost::json::parse(body);
+	auto obj = doc.as_object();
+	auto tok = obj["access_token"].as_string();
+	auto result = std::make_shared<AuthToken>(std::string(tok.data(), tok.size()));
+	if (result->valid())
+	    return result;
+	WSLOG(wslog::thread_logger("servicetoken"), wslog::error) << "Invalid WS token received\n";
+    } catch (std::exception &e) {
+	WSLOG(wslog::thread_logger("servicetoken"), wslog::error) << "Cannot fetch WS token: " << e.what() << "\n";
+    }
+    return nullptr;
+}
+
+/*
+ * Fetch a new token, or if a fetch is already in progress wait for it
+ * to finish. A failed fetch leaves the current token in place.
+ */
+void ServiceTokenManager::refresh(boost::asio::yield_context yield)
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (fetching_)
+    {
+	wait_for_fetch(lock, yield);
+	return;
+    }
+    fetching_ = true;
+    lock.unlock();
+
+    auto tok = fetch(yield);
+
+    lock.lock();
+    if (tok)
+	token_ = tok;
+    fetching_ = false;
+    std::vector<std::function<void()>> waiters;
+    waiters.swap(waiters_);
+    lock.unlock();
+
+    for (auto &wake: waiters)
+	wake();
+}
+
+/*
+ * Suspend the calling coroutine until the in-flight fetch completes.
+ * The wake-up is posted to the coroutine's own executor. lock is
+ * released once we are registered, so the fetch cannot complete
+ * unseen.
+ */
+void ServiceTokenManager::wait_for_fetch(std::unique_lock<std::mutex> &lock, boost::asio::yield_context yield)
+{
+    boost::asio::async_completion<boost::asio::yield_context, void(boost::system::error_code)> init(yield);
+    auto handler = std::move(init.completion_handler);
+    auto ex = boost::asio::get_associated_executor(handler);
+    waiters_.emplace_back([handler, ex]() mutable {
+	boost::asio::post(ex, [handler]() mutable { handler(boost::system::error_code()); });
+    });
+    lock.unlock();
+    init.result.get();
+}
+
+void ServiceTokenManager::run(boost::asio::yield_context yield)
+{
+    long margin = config_.ws_token_refresh_margin();
+    while (1)
+    {
+	std::shared_ptr<const AuthToken> tok;
+	{
+	    std::lock_guard<std::mutex> lock(mtx_);
+	    tok = token_;
+	}
+	long remaining = tok->valid() ? static_cast<long>(tok->expiry()) - static_cast<long>(std::time(nullptr)) : 0;
+	if (remaining <= margin)
+	{
+	    refresh(yield);
+	    std::lock_guard<std::mutex> lock(mtx_);
+	    tok = token_;
+	    remaining = tok->valid() ? static_cast<long>(tok->expiry()) - static_cast<long>(std::time(nullptr)) : 0;
+	}
+
+	/*
+	 * Sleep until the token enters its refresh margin. A token that
+	 * is already inside the margin (it was issued with a shorter
+	 * lifetime) is refreshed at half its remaining life instead.
+	 */
+	long delay = remaining > margin ? remaining - margin : remaining / 2;
+	if (delay < retry_interval)
+	    delay = retry_interval;
+
+	boost::system::error_code ec;
+	timer_.expires_from_now(boost::posix_time::seconds(delay), ec);
+	timer_.async_wait(yield[ec]);
+	if (ec)
+	{
+	    if (ec != boost::asio::error::operation_aborted)
+		WSLOG(wslog::thread_logger("servicetoken"), wslog::error) << "token refresh wait failed: " << ec.message() << "\n";
+	    return;
+	}
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _ServiceTokenManager_h
+#define _ServiceTokenManager_h
+
+/*
+ * The service's own auth token, used as the owner of the Shock nodes
+ * we create and for public downloads.
+ *
+ * A background coroutine fetches the token at startup and fetches a
+ * new one refresh_margin seconds before the current one expires, so
+ * requests normally find a fresh token already in place. Fetches are
+ * single-flight: a caller that needs a token while a fetch is in
+ * progress waits for that fetch rather than starting another.
+ *
+ * The current token is held by shared_ptr and replaced, never modified,
+ * so a caller may keep using the token it was given while a refresh
+ * installs a new one. get() may be called from any thread.
+ */
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include "AuthToken.h"
+#include "UserAgent.h"
+#include "WorkspaceConfig.h"
+
+class ServiceTokenManager
+{
+    boost::asio::io_context &ioc_;
+    WorkspaceConfig &config_;
+    UserAgent &user_agent_;
+    boost::asio::deadline_timer timer_;
+
+    std::mutex mtx_;
+    std::shared_ptr<const AuthToken> token_;
+    // Returned by get() when we have no usable token.
+    std::shared_ptr<const AuthToken> invalid_token_;
+    bool fetching_;
+    // Wake-ups for coroutines waiting on the in-flight fetch.
+    std::vector<std::function<void()>> waiters_;
+
+    // Seconds between attempts while we have no usable token.
+    static const int retry_interval = 60;
+
+    std::shared_ptr<const AuthToken> current();
+    std::shared_ptr<const AuthToken> fetch(boost::asio::yield_context yield);
+    void refresh(boost::asio::yield_context yield);
+    void wait_for_fetch(std::unique_lock<std::mutex> &lock, boost::asio::yield_context yield);
+    void run(boost::asio::yield_context yield);
+
+public:
+    ServiceTokenManager(boost::asio::io_context &ioc, WorkspaceConfig &config, UserAgent &user_agent);
+    ~ServiceTokenManager() { timer_.cancel(); }
+
+    /*
+     * Start the background refresh.
+     */
+    void start();
+
+    /*
+     * The current token. Only if we have no unexpired token does this
+     * wait for a fetch; if that fails the token returned is invalid,
+     * never the expired one, so callers must check valid() before use.
+     */
+    std::shared_ptr<const AuthToken> get(boost::asio::yield_context yield);
+};
+
+#endif
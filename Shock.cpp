@@ -20,14 +20,17 @@ using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 static void
 fail(beast::error_code ec, char const* what)
 {
-    std::cerr << what << ": " << ec.message() << "\n";
+    WSLOG(wslog::thread_logger("shock"), wslog::error) << what << ": " << ec.message() << "\n";
 }
 
 
 void Shock::request(const std::string &method, const URL &url, const AuthToken &token, const std::string &body,
 		    boost::asio::yield_context yield,
-		    std::function<void(boost::json::object)> cb)
+		    std::function<void(boost::json::object)> cb,
+		    const tracing::Trace &trace)
 {
+    metrics::ScopedTimer timer(metrics::shock_request_seconds());
+    tracing::Span span(trace, "shock_request", method.c_str());
     // TODO - perhaps resolver should be local here and part of the strand
     beast::tcp_stream stream(net::make_strand(ioc_));
     beast::flat_buffer buffer;
@@ -38,7 +41,7 @@ void Shock::request(const std::string &method, const URL &url, const AuthToken &
     req.target(url.path_query());
     req.set(http::field::host, url.domain());
     req.set(http::field::user_agent, "p4x-shock");
-    req.set(http::field::authorization, "OAuth " + token.token());
+    req.set(http::field::authorization, "OAuth " + token.token().to_string());
     if (!body.empty())
 	req.set(http::field::content_type, "multipart/form-data; boundary=XXX");
     req.body() = "--XXX\r\nContent-Disposition: form-data; name=\"attributes_str\"\r\n\r\n" + body + "--XXX\r\n";
@@ -80,17 +83,20 @@ void Shock::request(const std::string &method, const URL &url, const AuthToken &
 	else
 	{
 	    auto error = obj["error"];
-	    std::cerr << "error on request: " << error << "\n";
+	    WSLOG(wslog::thread_logger("shock"), wslog::error) << "error on request: " << error << "\n";
 	}
     } catch (std::exception &e) {
-	std::cerr << "Exception processing request result: " << e.what() << "\n";
+	WSLOG(wslog::thread_logger("shock"), wslog::error) << "Exception processing request result: " << e.what() << "\n";
     }
 }
 
 void Shock::request_ssl(const std::string &method, const URL &url, const AuthToken &token, const std::string &body,
 			boost::asio::yield_context yield,
-			std::function<void(boost::json::object)> cb)
+			std::function<void(boost::json::object)> cb,
+			const tracing::Trace &trace)
 {
+    metrics::ScopedTimer timer(metrics::shock_request_seconds());
+    tracing::Span span(trace, "shock_request", method.c_str());
     beast::ssl_stream<beast::tcp_stream> stream(net::make_strand(ioc_), ssl_ctx_);
     beast::flat_buffer buffer;
     http::request<http::string_body> req;
@@ -99,7 +105,7 @@ void Shock::request_ssl(const std::string &method, const URL &url, const AuthTok
     if (!SSL_set_tlsext_host_name(stream.native_handle(), url.domain().c_str()))
     {
 	beast::error_code ec{static_cast<int>(::ERR_get_error()), net::error::get_ssl_category()};
-	std::cerr << ec.message() << "\n";
+	WSLOG(wslog::thread_logger("shock"), wslog::error) << ec.message() << "\n";
 	return;
     }
     
@@ -107,7 +113,7 @@ void Shock::request_ssl(const std::string &method, const URL &url, const AuthTok
     req.target(url.path_query());
     req.set(http::field::host, url.domain());
     req.set(http::field::user_agent, "p4x-shock");
-    req.set(http::field::authorization, "OAuth " + token.token());
+    req.set(http::field::authorization, "OAuth " + token.token().to_string());
     if (!body.empty())
 	req.set(http::field::content_type, "multipart/form-data; boundary=XXX");
     req.body() = "--XXX\r\nContent-Disposition: form-data; name=\"attributes_str\"\r\n\r\n" + body + "--XXX";
@@ -142,7 +148,7 @@ void Shock::request_ssl(const std::string &method, const URL &url, const AuthTok
     {
 	fail(ec, "read");
     }
-    std::cerr << res << "\n";
+    WSLOG(wslog::thread_logger("shock"), wslog::debug) << res << "\n";
 
     try {
 	auto doc = boost::json::parse(res.body());
@@ -156,11 +162,11 @@ void Shock::request_ssl(const std::string &method, const URL &url, const AuthTok
 	else
 	{
 	    auto error = obj["error"];
-	    std::cerr << "error on request: " << error << "\n";
-	    std::cerr << req << "\n";
+	    WSLOG(wslog::thread_logger("shock"), wslog::error) << "error on request: " << error << "\n";
+	    WSLOG(wslog::thread_logger("shock"), wslog::debug) << req << "\n";
 	}
     } catch (std::exception &e) {
-	std::cerr << "Exception processing request result: " << e.what() << "\n";
+	WSLOG(wslog::thread_logger("shock"), wslog::error) << "Exception processing request result: " << e.what() << "\n";
     }
 }
 
@@ -14,6 +14,9 @@
 #include "AuthToken.h"
 #include "parse_url.h"
 #include "WorkspaceErrors.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "Tracing.h"
 
 class Shock
 {
@@ -37,54 +40,72 @@ public:
 	// std::cerr << "shock move construct\n";
     }
 
-    void acl_add_user(const std::string &node_url, const AuthToken &token, const std::string &username, boost::asio::yield_context yield) {
+    void acl_add_user(const std::string &node_url, const AuthToken &token, const std::string &username, boost::asio::yield_context yield,
+		      const tracing::Trace &trace = tracing::Trace()) {
 	URL url(node_url);
 	url.path_append("/acl/all");
 	url.query("users=" + username);
-	std::cerr << url.construct() << "\n";
+	WSLOG(wslog::thread_logger("shock"), wslog::debug) << url.construct() << "\n";
 
 	if (url.protocol() == "http")
-	    request("PUT", url, token, "", yield, nullptr);
+	    request("PUT", url, token, "", yield, nullptr, trace);
 	else  if (url.protocol() == "https")
-	    request_ssl("PUT", url, token, "", yield, nullptr);
+	    request_ssl("PUT", url, token, "", yield, nullptr, trace);
 
     }
 
-    boost::json::object get_node(const AuthToken &token, const std::string &url_str, boost::asio::yield_context yield) {
+    /*
+     * Delete a node. Returns true if Shock reported success.
+     */
+    bool delete_node(const std::string &node_url, const AuthToken &token, boost::asio::yield_context yield,
+		     const tracing::Trace &trace = tracing::Trace()) {
+	URL url(node_url);
+	bool ok = false;
+	auto cb = [&ok](boost::json::object) { ok = true; };
+	if (url.protocol() == "http")
+	    request("DELETE", url, token, "", yield, cb, trace);
+	else  if (url.protocol() == "https")
+	    request_ssl("DELETE", url, token, "", yield, cb, trace);
+	return ok;
+    }
+
+    boost::json::object get_node(const AuthToken &token, const std::string &url_str, boost::asio::yield_context yield,
+				 const tracing::Trace &trace = tracing::Trace()) {
 	URL url(url_str);
 
 	boost::json::object node_obj;
 	
 	auto cb = [&node_obj](boost::json::object obj) {
-	    std::cerr << "get node got " << obj << "\n";
+	    WSLOG(wslog::thread_logger("shock"), wslog::debug) << "get node got " << obj << "\n";
 	    
 	    try {
 		node_obj = obj["data"].as_object();
 	    } catch (std::invalid_argument e) {
-		std::cerr << "error extracting node id: " << e.what() << "\n";
+		WSLOG(wslog::thread_logger("shock"), wslog::error) << "error extracting node id: " << e.what() << "\n";
 	    }
 	};
 
 	// this is a hack; we really need to have a form interface here.
 	if (url.protocol() == "http")
-	    request("GET", url, token, "", yield, cb);
+	    request("GET", url, token, "", yield, cb, trace);
 	else  if (url.protocol() == "https")
-	    request_ssl("GET", url, token, "", yield, cb);
+	    request_ssl("GET", url, token, "", yield, cb, trace);
 	return node_obj;
     }
 
-    std::string create_node(const AuthToken &token, const std::string &ws_node, boost::asio::yield_context yield) {
+    std::string create_node(const AuthToken &token, const std::string &ws_node, boost::asio::yield_context yield,
+			    const tracing::Trace &trace = tracing::Trace()) {
 	URL url(default_server_ + "/node");
 
 	std::string node;
 	auto cb = [&node](boost::json::object obj) {
-	    std::cerr << "create node got " << obj << "\n";
+	    WSLOG(wslog::thread_logger("shock"), wslog::debug) << "create node got " << obj << "\n";
 
 	    try {
 		auto data = obj["data"].as_object();
 		node = data["id"].as_string().c_str();
 	    } catch (std::invalid_argument e) {
-		std::cerr << "error extracting node id: " << e.what() << "\n";
+		WSLOG(wslog::thread_logger("shock"), wslog::error) << "error extracting node id: " << e.what() << "\n";
 		node = "";
 	    }
 	};
@@ -92,15 +113,25 @@ public:
 	// this is a hack; we really need to have a form interface here.
 	std::string body = "{\"ws_id\": [\"" + ws_node + "\"]}";
 	if (url.protocol() == "http")
-	    request("POST", url, token, body, yield, cb);
+	    request("POST", url, token, body, yield, cb, trace);
 	else  if (url.protocol() == "https")
-	    request_ssl("POST", url, token, body, yield, cb);
+	    request_ssl("POST", url, token, body, yield, cb, trace);
 	return node;
     }
 
+    /*
+     * Connect to Shock and request the data for the given node, reading
+     * the response header. On return buffer may hold the first bytes of
+     * the body; the rest is to be read from stream.
+     *
+     * If length is nonzero only that many bytes starting at offset
+     * are requested.
+     */
     template <typename Buf>
     void start_download(const std::string &node_url, const std::string &token,
-			boost::beast::tcp_stream &stream, Buf &buffer, boost::system::error_code &ec, boost::asio::yield_context yield) {
+			boost::beast::tcp_stream &stream, Buf &buffer, boost::system::error_code &ec, boost::asio::yield_context yield,
+			uint64_t offset = 0, uint64_t length = 0,
+			const tracing::Trace &trace = tracing::Trace()) {
 
 	namespace beast = boost::beast;         // from <boost/beast.hpp>
 	namespace http = beast::http;           // from <boost/beast/http.hpp>
@@ -108,7 +139,9 @@ public:
 	namespace ssl = boost::asio::ssl;       // from <boost/asio/ssl.hpp>
 	using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 
-
+	// Measures time to the response header; the body is streamed by the caller.
+	metrics::ScopedTimer timer(metrics::shock_request_seconds());
+	tracing::Span span(trace, "shock_download");
 
 	// We will parse out the node ID and use the internal Shock address to pull the data
 	static const boost::regex shock_node_regex(".*/node/([0-9a-fA-F]{8}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{12})");
@@ -119,11 +152,14 @@ public:
 	    return;
 	}
 
-	std::cerr << "node is " << match[1] << "\n";
+	WSLOG(wslog::thread_logger("shock"), wslog::debug) << "node is " << match[1] << "\n";
 
 	// TODO make this a config item
-	URL dl_url{"http://walnut.mcs.anl.gov:7078/node/" + match[1] + "?download"};
-	std::cerr << "dl " << dl_url << "\n";
+	std::string query = "?download";
+	if (length > 0)
+	    query += "&seek=" + std::to_string(offset) + "&length=" + std::to_string(length);
+	URL dl_url{"http://walnut.mcs.anl.gov:7078/node/" + match[1] + query};
+	WSLOG(wslog::thread_logger("shock"), wslog::debug) << "dl " << dl_url << "\n";
     
 	http::request<http::empty_body> req;
 
@@ -136,7 +172,7 @@ public:
 	boost::asio::ip::tcp::resolver resolver { ioc_ };
 
 	auto fail = [](beast::error_code ec, char const* what) {
-	    std::cerr << what << ": " << ec.message() << "\n";
+	    WSLOG(wslog::thread_logger("shock"), wslog::error) << what << ": " << ec.message() << "\n";
 	};
 
 
@@ -166,16 +202,18 @@ public:
 	    fail(ec, "read");
 	}
 	auto &resp = header_parser.get();
-	std::cerr << "shock read" << resp.base() << "\n";
+	WSLOG(wslog::thread_logger("shock"), wslog::debug) << "shock read" << resp.base() << "\n";
     
     }
 
     void request(const std::string &method, const URL &url, const AuthToken &token,
 		 const std::string &body, boost::asio::yield_context yield,
-		 std::function<void(boost::json::object)> cb);
+		 std::function<void(boost::json::object)> cb,
+		 const tracing::Trace &trace = tracing::Trace());
     void request_ssl(const std::string &method, const URL &url, const AuthToken &token,
 		     const std::string &body, boost::asio::yield_context yield,
-		     std::function<void(boost::json::object)> cb);
+		     std::function<void(boost::json::object)> cb,
+		     const tracing::Trace &trace = tracing::Trace());
 	  
 };
 
@@ -0,0 +1,105 @@
+#include "TokenCache.h"
+
+#include <mutex>
+
+TokenCache::TokenCache(size_t capacity)
+    : shards_(new Shard[n_shards])
+    , slots_per_shard_((capacity + n_shards - 1) / n_shards)
+    , hits_(metrics::Registry::instance().counter("ws_token_cache_hits_total",
+						   "Token validations answered from the cache"))
+    , misses_(metrics::Registry::instance().counter("ws_token_cache_misses_total",
+						     "Token validations that required signature verification"))
+{
+    for (int i = 0; i < n_shards; i++)
+    {
+	shards_[i].slots = std::vector<Slot>(slots_per_shard_);
+	shards_[i].index.reserve(slots_per_shard_);
+    }
+}
+
+/*
+ * FNV-1a over the signature bytes.
+ */
+uint64_t TokenCache::signature_hash(const AuthToken &tok)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: tok.binary_signature())
+    {
+	h ^= c;
+	h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool TokenCache::lookup(const AuthToken &tok)
+{
+    if (slots_per_shard_ == 0)
+	return false;
+
+    uint64_t hash = signature_hash(tok);
+    Shard &shard = shard_for(hash);
+    {
+	std::shared_lock<std::shared_timed_mutex> lock(shard.mtx);
+	auto iter = shard.index.find(hash);
+	if (iter != shard.index.end())
+	{
+	    Slot &slot = shard.slots[iter->second];
+	    if (slot.token == tok.token() && std::time(nullptr) < slot.expiry)
+	    {
+		slot.referenced.store(true, std::memory_order_relaxed);
+		hits_.inc();
+		return true;
+	    }
+	}
+    }
+    misses_.inc();
+    return false;
+}
+
+void TokenCache::insert(const AuthToken &tok)
+{
+    if (slots_per_shard_ == 0)
+	return;
+
+    uint64_t hash = signature_hash(tok);
+    Shard &shard = shard_for(hash);
+    std::unique_lock<std::shared_timed_mutex> lock(shard.mtx);
+
+    size_t pos;
+    auto iter = shard.index.find(hash);
+    if (iter != shard.index.end())
+    {
+	pos = iter->second;
+    }
+    else
+    {
+	/*
+	 * Advance the clock hand to a free slot or one that has not
+	 * been referenced since the hand last passed it. Expired
+	 * entries are taken regardless.
+	 */
+	std::time_t now = std::time(nullptr);
+	while (1)
+	{
+	    Slot &slot = shard.slots[shard.hand];
+	    if (!slot.used || slot.expiry <= now ||
+		!slot.referenced.exchange(false, std::memory_order_relaxed))
+		break;
+	    shard.hand = (shard.hand + 1) % slots_per_shard_;
+	}
+	pos = shard.hand;
+	shard.hand = (shard.hand + 1) % slots_per_shard_;
+
+	Slot &victim = shard.slots[pos];
+	if (victim.used)
+	    shard.index.erase(victim.hash);
+	shard.index.emplace(hash, pos);
+    }
+
+    Slot &slot = shard.slots[pos];
+    slot.hash = hash;
+    slot.token.assign(tok.token().data(), tok.token().size());
+    slot.expiry = tok.expiry();
+    slot.referenced.store(false, std::memory_order_relaxed);
+    slot.used = true;
+}
@@ -0,0 +1,89 @@
+#ifndef _TokenCache_h
+#define _TokenCache_h
+
+/*
+ * Cache of tokens whose signatures have been verified.
+ *
+ * Clients send the same token on every request for its whole lifetime,
+ * so once a token has passed the RSA verification we remember it until
+ * it expires. Entries are keyed by a hash of the signature bytes; the
+ * full token text is kept and compared on lookup so a hash collision
+ * can never validate a different token.
+ *
+ * The cache is split into shards, each with its own reader-writer lock,
+ * so concurrent lookups do not contend. Each shard has a fixed number
+ * of slots and evicts with the CLOCK policy: a lookup sets the slot's
+ * reference bit (an atomic, so readers need only the shared lock) and
+ * the eviction hand clears bits until it finds an unreferenced slot.
+ *
+ * Only successful verifications are cached, so a stream of forged
+ * tokens cannot push out the valid ones.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AuthToken.h"
+#include "Metrics.h"
+
+class TokenCache
+{
+    static const int n_shards = 16;
+
+    struct Slot
+    {
+	uint64_t hash;
+	std::string token;
+	std::time_t expiry;
+	std::atomic<bool> referenced;
+	bool used;
+
+	Slot() : hash(0), expiry(0), referenced(false), used(false) {}
+    };
+
+    struct Shard
+    {
+	std::shared_timed_mutex mtx;
+	std::vector<Slot> slots;
+	std::unordered_map<uint64_t, size_t> index;
+	size_t hand;
+
+	Shard() : hand(0) {}
+    };
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t slots_per_shard_;
+
+    metrics::Counter &hits_;
+    metrics::Counter &misses_;
+
+    static uint64_t signature_hash(const AuthToken &tok);
+    Shard &shard_for(uint64_t hash) { return shards_[hash % n_shards]; }
+
+public:
+    /*
+     * capacity is the total number of tokens held; zero disables the cache.
+     */
+    explicit TokenCache(size_t capacity);
+
+    /*
+     * True if tok is in the cache and has not expired.
+     */
+    bool lookup(const AuthToken &tok);
+
+    /*
+     * Remember that tok has been verified.
+     */
+    void insert(const AuthToken &tok);
+
+    uint64_t hits() const { return hits_.value(); }
+    uint64_t misses() const { return misses_.value(); }
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "Tracing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace tracing;
+
+namespace {
+
+    struct Record
+    {
+	uint64_t request_id;
+	const char *name;
+	char detail[40];
+	clock::time_point start;
+	clock::duration duration;
+    };
+
+    class Tracer
+    {
+	std::ofstream out_;
+	int sample_every_;
+
+	// Maps steady clock readings back to wall clock time for output.
+	clock::time_point steady_base_;
+	std::chrono::system_clock::time_point system_base_;
+
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::vector<Record> ring_;
+	size_t head_;		// next slot to write
+	size_t count_;		// unwritten records
+	uint64_t dropped_;
+	bool stop_;
+	std::thread writer_;
+
+	void run();
+	void write(const Record &r);
+
+    public:
+	std::atomic<uint64_t> next_id;
+
+	Tracer(const std::string &path, int sample_every, size_t buffer_size)
+	    : out_(path, std::ios::app)
+	    , sample_every_(sample_every > 0 ? sample_every : 1)
+	    , steady_base_(clock::now())
+	    , system_base_(std::chrono::system_clock::now())
+	    , ring_(buffer_size > 0 ? buffer_size : 1)
+	    , head_(0)
+	    , count_(0)
+	    , dropped_(0)
+	    , stop_(false)
+	    , next_id(1) {
+	    if (!out_)
+		throw std::runtime_error("cannot open trace file " + path);
+	    writer_ = std::thread([this]() { run(); });
+	}
+
+	~Tracer() {
+	    {
+		std::lock_guard<std::mutex> lock(mtx_);
+		stop_ = true;
+	    }
+	    cv_.notify_one();
+	    writer_.join();
+	}
+
+	bool sampled(uint64_t id) const { return id % sample_every_ == 0; }
+
+	void add(const Record &r) {
+	    std::lock_guard<std::mutex> lock(mtx_);
+	    ring_[head_] = r;
+	    head_ = (head_ + 1) % ring_.size();
+	    if (count_ == ring_.size())
+		dropped_++;
+	    else
+		count_++;
+	}
+    };
+
+    std::unique_ptr<Tracer> tracer;
+}
+
+void Tracer::run()
+{
+    std::vector<Record> batch;
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (1)
+    {
+	cv_.wait_for(lock, std::chrono::seconds(1), [this]() { return stop_; });
+
+	batch.clear();
+	size_t first = (head_ + ring_.size() - count_) % ring_.size();
+	for (size_t i = 0; i < count_; i++)
+	    batch.push_back(ring_[(first + i) % ring_.size()]);
+	count_ = 0;
+	uint64_t dropped = dropped_;
+	dropped_ = 0;
+	bool stop = stop_;
+
+	// Don't hold up request threads while we write.
+	lock.unlock();
+	if (dropped)
+	    out_ << "{\"dropped\":" << dropped << "}\n";
+	for (auto &r: batch)
+	    write(r);
+	out_.flush();
+	lock.lock();
+
+	if (stop)
+	    break;
+    }
+}
+
+void Tracer::write(const Record &r)
+{
+    using namespace std::chrono;
+    auto wall = system_base_ + duration_cast<system_clock::duration>(r.start - steady_base_);
+    out_ << "{\"req\":" << r.request_id
+	 << ",\"span\":\"" << r.name << "\""
+	 << ",\"detail\":\"";
+    // Details are method names, paths and the like; escape just enough to keep the line valid JSON.
+    for (const char *p = r.detail; *p; p++)
+    {
+	if (*p == '"' || *p == '\\')
+	    out_ << '\\' << *p;
+	else if (static_cast<unsigned char>(*p) >= 0x20)
+	    out_ << *p;
+    }
+    out_ << "\",\"start_us\":" << duration_cast<microseconds>(wall.time_since_epoch()).count()
+	 << ",\"dur_us\":" << duration_cast<microseconds>(r.duration).count()
+	 << "}\n";
+}
+
+void tracing::init(const std::string &path, int sample_every, size_t buffer_size)
+{
+    if (path.empty())
+	return;
+    tracer = std::make_unique<Tracer>(path, sample_every, buffer_size);
+}
+
+void tracing::shutdown()
+{
+    tracer.reset();
+}
+
+Trace Trace::start()
+{
+    if (!tracer)
+	return Trace();
+    uint64_t id = tracer->next_id.fetch_add(1, std::memory_order_relaxed);
+    return tracer->sampled(id) ? Trace(id) : Trace();
+}
+
+void Trace::record(const char *name, clock::time_point start, clock::time_point end,
+		   const char *detail) const
+{
+    if (!id_ || !tracer)
+	return;
+    Record r;
+    r.request_id = id_;
+    r.name = name;
+    strncpy(r.detail, detail ? detail : "", sizeof(r.detail) - 1);
+    r.detail[sizeof(r.detail) - 1] = 0;
+    r.start = start;
+    r.duration = end - start;
+    tracer->add(r);
+}
@@ -0,0 +1,105 @@
+#ifndef _Tracing_h
+#define _Tracing_h
+
+/*
+ * Per-request tracing.
+ *
+ * A Trace is started for each HTTP request and carried in the
+ * DispatchContext to everything that does work for the request. Each
+ * phase of the work records a timed span tagged with the request ID.
+ *
+ * Spans are recorded into a fixed-size ring buffer; a background
+ * thread periodically writes them to the trace file as one JSON
+ * object per line:
+ *
+ *   {"req":42,"span":"db_exec","detail":"","start_us":...,"dur_us":...}
+ *
+ * If the writer falls behind the oldest unwritten spans are overwritten.
+ *
+ * Tracing is off unless a trace file is configured. Only one request
+ * in every sample_every is traced; spans of untraced requests cost a
+ * single test.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace tracing {
+
+    using clock = std::chrono::steady_clock;
+
+    /*
+     * Start the trace writer. Spans go to path; an empty path
+     * leaves tracing disabled.
+     */
+    void init(const std::string &path, int sample_every = 1, size_t buffer_size = 65536);
+
+    /*
+     * Write any remaining spans and stop the writer.
+     */
+    void shutdown();
+
+    class Trace
+    {
+	uint64_t id_;
+
+	explicit Trace(uint64_t id) : id_(id) {}
+
+    public:
+	// An untraced request.
+	Trace() : id_(0) {}
+
+	/*
+	 * Assign a new request ID. The result is untraced if tracing is
+	 * disabled or the request is not sampled.
+	 */
+	static Trace start();
+
+	uint64_t id() const { return id_; }
+	explicit operator bool() const { return id_ != 0; }
+
+	/*
+	 * Record a span. detail is copied and may be truncated.
+	 */
+	void record(const char *name, clock::time_point start, clock::time_point end,
+		    const char *detail = "") const;
+    };
+
+    /*
+     * Record the time from construction to end() or destruction as a span.
+     * name and detail must remain valid until the span ends.
+     */
+    class Span
+    {
+	const Trace &trace_;
+	const char *name_;
+	const char *detail_;
+	clock::time_point start_;
+	bool open_;
+
+    public:
+	Span(const Trace &trace, const char *name, const char *detail = "")
+	    : trace_(trace)
+	    , name_(name)
+	    , detail_(detail)
+	    , open_(static_cast<bool>(trace)) {
+	    if (open_)
+		start_ = clock::now();
+	}
+	~Span() { end(); }
+
+	Span(const Span &) = delete;
+	Span &operator=(const Span &) = delete;
+
+	void end() {
+	    if (open_)
+	    {
+		trace_.record(name_, start_, clock::now(), detail_);
+		open_ = false;
+	    }
+	}
+    };
+}
+
+#endif
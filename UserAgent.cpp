@@ -1,4 +1,5 @@
 #include "UserAgent.h"
+#include "Logging.h"
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
@@ -21,7 +22,7 @@ using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 static void
 fail(beast::error_code ec, char const* what)
 {
-    std::cerr << what << ": " << ec.message() << "\n";
+    WSLOG(wslog::thread_logger("useragent"), wslog::error) << what << ": " << ec.message() << "\n";
 }
 
 void UserAgent::do_request(const std::string &method, const URL &url, const std::string &token, std::map<std::string, std::string> headers,
@@ -69,7 +70,7 @@ void UserAgent::do_request(const std::string &method, const URL &url, const std:
     try {
 	handle_response(res);
     } catch (std::exception &e) {
-	std::cerr << "Exception processing request result: " << e.what() << "\n";
+	WSLOG(wslog::thread_logger("useragent"), wslog::error) << "Exception processing request result: " << e.what() << "\n";
     }
 }
 
@@ -84,7 +85,7 @@ void UserAgent::do_request_ssl(const std::string &method, const URL &url, const
     if (!SSL_set_tlsext_host_name(stream.native_handle(), url.domain().c_str()))
     {
 	beast::error_code ec{static_cast<int>(::ERR_get_error()), net::error::get_ssl_category()};
-	std::cerr << ec.message() << "\n";
+	WSLOG(wslog::thread_logger("useragent"), wslog::error) << ec.message() << "\n";
 	return;
     }
 
@@ -127,12 +128,12 @@ void UserAgent::do_request_ssl(const std::string &method, const URL &url, const
     {
 	fail(ec, "read");
     }
-    std::cerr << res << "\n";
+    WSLOG(wslog::thread_logger("useragent"), wslog::debug) << res << "\n";
 
     try {
 	handle_response(res);
     } catch (std::exception &e) {
-	std::cerr << "Exception processing request result: " << e.what() << "\n";
+	WSLOG(wslog::thread_logger("useragent"), wslog::error) << "Exception processing request result: " << e.what() << "\n";
     }
 }
 
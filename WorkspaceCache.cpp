@@ -0,0 +1,151 @@
+#include "WorkspaceCache.h"
+
+#include <mutex>
+
+WorkspaceCache::WorkspaceCache(size_t capacity, std::chrono::seconds ttl)
+    : shards_(new Shard[n_shards])
+    , slots_per_shard_((capacity + n_shards - 1) / n_shards)
+    , ttl_(ttl)
+    , hits_(metrics::Registry::instance().counter("ws_workspace_cache_hits_total",
+						   "Workspace lookups answered from the cache"))
+    , misses_(metrics::Registry::instance().counter("ws_workspace_cache_misses_total",
+						     "Workspace lookups that went to the database"))
+{
+    for (int i = 0; i < n_shards; i++)
+    {
+	shards_[i].slots = std::vector<Slot>(slots_per_shard_);
+	shards_[i].index.reserve(slots_per_shard_);
+	shards_[i].uuid_index.reserve(slots_per_shard_);
+    }
+}
+
+bool WorkspaceCache::lookup(WSWorkspace &ws)
+{
+    if (slots_per_shard_ == 0)
+	return false;
+
+    std::string key = make_key(ws.owner, ws.name);
+    Shard &shard = shard_for(key);
+    {
+	std::shared_lock<std::shared_timed_mutex> lock(shard.mtx);
+	auto iter = shard.index.find(key);
+	if (iter != shard.index.end())
+	{
+	    Slot &slot = shard.slots[iter->second];
+	    if (clock::now() < slot.expires)
+	    {
+		slot.referenced.store(true, std::memory_order_relaxed);
+		ws = *slot.ws;
+		hits_.inc();
+		return true;
+	    }
+	}
+    }
+    misses_.inc();
+    return false;
+}
+
+uint64_t WorkspaceCache::generation(const std::string &owner, const std::string &name)
+{
+    if (slots_per_shard_ == 0)
+	return 0;
+    return shard_for(make_key(owner, name)).generation.load();
+}
+
+void WorkspaceCache::erase_slot(Shard &shard, size_t pos)
+{
+    Slot &slot = shard.slots[pos];
+    if (!slot.used)
+	return;
+    shard.index.erase(slot.key);
+    shard.uuid_index.erase(slot.uuid);
+    slot.ws.reset();
+    slot.used = false;
+}
+
+void WorkspaceCache::insert(const WSWorkspace &ws, uint64_t generation)
+{
+    if (slots_per_shard_ == 0 || ws.uuid.empty())
+	return;
+
+    std::string key = make_key(ws.owner, ws.name);
+    auto entry = std::make_shared<const WSWorkspace>(ws);
+    Shard &shard = shard_for(key);
+    std::unique_lock<std::shared_timed_mutex> lock(shard.mtx);
+
+    if (shard.generation.load() != generation)
+	return;
+
+    size_t pos;
+    auto iter = shard.index.find(key);
+    if (iter != shard.index.end())
+    {
+	pos = iter->second;
+	shard.uuid_index.erase(shard.slots[pos].uuid);
+    }
+    else
+    {
+	/*
+	 * Advance the clock hand to a free or expired slot, or one that
+	 * has not been referenced since the hand last passed it.
+	 */
+	auto now = clock::now();
+	while (1)
+	{
+	    Slot &slot = shard.slots[shard.hand];
+	    if (!slot.used || slot.expires <= now ||
+		!slot.referenced.exchange(false, std::memory_order_relaxed))
+		break;
+	    shard.hand = (shard.hand + 1) % slots_per_shard_;
+	}
+	pos = shard.hand;
+	shard.hand = (shard.hand + 1) % slots_per_shard_;
+
+	erase_slot(shard, pos);
+	shard.index.emplace(key, pos);
+    }
+
+    Slot &slot = shard.slots[pos];
+    slot.key = key;
+    slot.uuid = ws.uuid;
+    slot.ws = std::move(entry);
+    slot.expires = clock::now() + ttl_;
+    slot.referenced.store(false, std::memory_order_relaxed);
+    slot.used = true;
+    shard.uuid_index[ws.uuid] = pos;
+}
+
+void WorkspaceCache::invalidate(const std::string &owner, const std::string &name)
+{
+    if (slots_per_shard_ == 0)
+	return;
+
+    std::string key = make_key(owner, name);
+    Shard &shard = shard_for(key);
+    std::unique_lock<std::shared_timed_mutex> lock(shard.mtx);
+    shard.generation++;
+    auto iter = shard.index.find(key);
+    if (iter != shard.index.end())
+	erase_slot(shard, iter->second);
+}
+
+/*
+ * Shards are chosen by owner and name, so the workspace may be in any
+ * of them; look in all, and advance every generation since a read of
+ * it may be in flight in any shard.
+ */
+void WorkspaceCache::invalidate_uuid(const std::string &uuid)
+{
+    if (slots_per_shard_ == 0)
+	return;
+
+    for (int i = 0; i < n_shards; i++)
+    {
+	Shard &shard = shards_[i];
+	std::unique_lock<std::shared_timed_mutex> lock(shard.mtx);
+	shard.generation++;
+	auto iter = shard.uuid_index.find(uuid);
+	if (iter != shard.uuid_index.end())
+	    erase_slot(shard, iter->second);
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef _WorkspaceCache_h
+#define _WorkspaceCache_h
+
+/*
+ * Cache of workspace records, in front of the workspaces collection.
+ *
+ * Every path we parse needs its workspace's uuid and permissions, and
+ * a request usually names many paths in the same few workspaces. We
+ * keep recently read workspaces keyed by owner and name, with a
+ * secondary index by uuid for invalidation.
+ *
+ * Entries expire after ttl so that changes made by other servers are
+ * seen eventually; changes made through this server invalidate the
+ * entry immediately. A read that raced with an invalidation is not
+ * cached: insert() is given the generation observed before the read
+ * and drops the entry if the shard has been invalidated since.
+ *
+ * As in TokenCache, the cache is split into shards each with a
+ * reader-writer lock and a fixed number of slots evicted by CLOCK.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "WorkspaceTypes.h"
+#include "Metrics.h"
+
+class WorkspaceCache
+{
+    static const int n_shards = 16;
+    using clock = std::chrono::steady_clock;
+
+    struct Slot
+    {
+	std::string key;
+	std::string uuid;
+	std::shared_ptr<const WSWorkspace> ws;
+	clock::time_point expires;
+	std::atomic<bool> referenced;
+	bool used;
+
+	Slot() : referenced(false), used(false) {}
+    };
+
+    struct Shard
+    {
+	std::shared_timed_mutex mtx;
+	std::vector<Slot> slots;
+	std::unordered_map<std::string, size_t> index;
+	std::unordered_map<std::string, size_t> uuid_index;
+	size_t hand;
+	std::atomic<uint64_t> generation;
+
+	Shard() : hand(0), generation(0) {}
+    };
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t slots_per_shard_;
+    clock::duration ttl_;
+
+    metrics::Counter &hits_;
+    metrics::Counter &misses_;
+
+    static std::string make_key(const std::string &owner, const std::string &name) { return owner + "/" + name; }
+    Shard &shard_for(const std::string &key) { return shards_[std::hash<std::string>()(key) % n_shards]; }
+    void erase_slot(Shard &shard, size_t pos);
+
+public:
+    /*
+     * capacity is the total number of workspaces held; zero disables the cache.
+     */
+    WorkspaceCache(size_t capacity, std::chrono::seconds ttl);
+
+    /*
+     * Fill ws (whose owner and name are set) from the cache. Returns
+     * false on a miss.
+     */
+    bool lookup(WSWorkspace &ws);
+
+    /*
+     * The generation of the shard holding owner/name. Read this before
+     * querying the database and pass it to insert().
+     */
+    uint64_t generation(const std::string &owner, const std::string &name);
+
+    /*
+     * Remember ws, unless its shard has been invalidated since generation.
+     */
+    void insert(const WSWorkspace &ws, uint64_t generation);
+
+    void invalidate(const std::string &owner, const std::string &name);
+    void invalidate_uuid(const std::string &uuid);
+};
+
+#endif
@@ -23,12 +23,59 @@ class WorkspaceConfig
     std::string api_root_;
     std::set<std::string> valid_types_;
     std::string shock_server_;
+    int max_requests_per_connection_;
+    int keepalive_timeout_;
+    bool reuse_port_;
+    int interactive_request_limit_;
+    int standard_request_limit_;
+    int bulk_request_limit_;
+    int overload_retry_after_;
+    int compression_min_size_;
+    int batch_concurrency_;
+    std::string trace_file_;
+    int trace_sample_every_;
+    int trace_buffer_size_;
+    int token_cache_size_;
+    int ws_token_refresh_margin_;
+    int workspace_cache_size_;
+    int workspace_cache_ttl_;
+    int fetch_concurrency_;
+    int file_io_threads_;
+    int delete_chunk_size_;
+    int reclaim_threads_;
+    int shock_delete_concurrency_;
+    int copy_batch_size_;
+    int sync_shards_;
+    int ls_max_limit_;
     
 public:
     WorkspaceConfig()
 	: ServiceConfig("Workspace")
 	, download_lifetime_(3600)
-	, mongodb_client_threads_(1) {
+	, mongodb_client_threads_(1)
+	, max_requests_per_connection_(100)
+	, keepalive_timeout_(15)
+	, reuse_port_(false)
+	, interactive_request_limit_(256)
+	, standard_request_limit_(64)
+	, bulk_request_limit_(8)
+	, overload_retry_after_(2)
+	, compression_min_size_(1400)
+	, batch_concurrency_(4)
+	, trace_sample_every_(1)
+	, trace_buffer_size_(65536)
+	, token_cache_size_(4096)
+	, ws_token_refresh_margin_(6 * 3600)
+	, workspace_cache_size_(10000)
+	, workspace_cache_ttl_(10)
+	, fetch_concurrency_(8)
+	, file_io_threads_(4)
+	, delete_chunk_size_(5000)
+	, reclaim_threads_(4)
+	, shock_delete_concurrency_(8)
+	, copy_batch_size_(1000)
+	, sync_shards_(16)
+	, ls_max_limit_(10000) {
     }
 
     bool parse() {
@@ -55,6 +102,80 @@ public:
 	shock_server_ = get_string("shock-url");
 	api_root_ = get_string("api-root", "/api");
 
+	max_requests_per_connection_ = get_long("max-requests-per-connection", max_requests_per_connection_);
+	keepalive_timeout_ = get_long("keepalive-timeout", keepalive_timeout_);
+	reuse_port_ = get_long("reuse-port", reuse_port_) != 0;
+
+	/*
+	 * Limits on requests admitted to the database per work class.
+	 * Zero means unlimited.
+	 */
+	interactive_request_limit_ = get_long("interactive-request-limit", interactive_request_limit_);
+	standard_request_limit_ = get_long("standard-request-limit", standard_request_limit_);
+	bulk_request_limit_ = get_long("bulk-request-limit", bulk_request_limit_);
+	overload_retry_after_ = get_long("overload-retry-after", overload_retry_after_);
+
+	// Negative disables compression of responses.
+	compression_min_size_ = get_long("compression-min-size", compression_min_size_);
+	batch_concurrency_ = get_long("batch-concurrency", batch_concurrency_);
+
+	/*
+	 * Request tracing is enabled by naming a trace file; one request
+	 * in every trace-sample-every is traced.
+	 */
+	trace_file_ = get_string("trace-file", "");
+	trace_sample_every_ = get_long("trace-sample-every", trace_sample_every_);
+	trace_buffer_size_ = get_long("trace-buffer-size", trace_buffer_size_);
+
+	// Number of verified tokens remembered; zero disables the cache.
+	token_cache_size_ = get_long("token-cache-size", token_cache_size_);
+
+	// Seconds before expiry at which the service's own token is renewed.
+	ws_token_refresh_margin_ = get_long("ws-token-refresh-margin", ws_token_refresh_margin_);
+
+	/*
+	 * Workspace records are cached for workspace-cache-ttl seconds;
+	 * this bounds how long a change made by another server goes unseen.
+	 * A size of zero disables the cache.
+	 */
+	workspace_cache_size_ = get_long("workspace-cache-size", workspace_cache_size_);
+	workspace_cache_ttl_ = get_long("workspace-cache-ttl", workspace_cache_ttl_);
+
+	/*
+	 * Object data for a get is read by up to fetch-concurrency workers
+	 * at once; file reads run on file-io-threads threads.
+	 */
+	fetch_concurrency_ = get_long("fetch-concurrency", fetch_concurrency_);
+	file_io_threads_ = get_long("file-io-threads", file_io_threads_);
+
+	/*
+	 * A recursive delete removes documents delete-chunk-size at a time.
+	 * Files of deleted objects are removed afterwards on reclaim-threads
+	 * threads, and their Shock nodes with up to shock-delete-concurrency
+	 * requests at once.
+	 */
+	delete_chunk_size_ = get_long("delete-chunk-size", delete_chunk_size_);
+	reclaim_threads_ = get_long("reclaim-threads", reclaim_threads_);
+	shock_delete_concurrency_ = get_long("shock-delete-concurrency", shock_delete_concurrency_);
+
+	/*
+	 * A recursive copy creates objects copy-batch-size at a time; the
+	 * file data of each batch is copied on the file-io-threads threads.
+	 */
+	copy_batch_size_ = get_long("copy-batch-size", copy_batch_size_);
+
+	/*
+	 * Metadata operations are serialized per workspace, on sync-shards
+	 * threads; workspaces are spread across them by hash.
+	 */
+	sync_shards_ = get_long("sync-shards", sync_shards_);
+
+	/*
+	 * The largest page an ls may ask for; a larger limit is taken as
+	 * this. A listing without a limit is not paged.
+	 */
+	ls_max_limit_ = get_long("ls-max-limit", ls_max_limit_);
+
 	std::string types_file = get_string("types-file", "");
 	if (types_file.empty())
 	    throw std::runtime_error("Missing types file in configuration");
@@ -104,6 +225,30 @@ public:
     int mongodb_client_threads() const { return mongodb_client_threads_; }
     const std::string &api_root()  const { return api_root_; }
     const std::string &shock_server()  const { return shock_server_; }
+    int max_requests_per_connection() const { return max_requests_per_connection_; }
+    int keepalive_timeout() const { return keepalive_timeout_; }
+    bool reuse_port() const { return reuse_port_; }
+    int interactive_request_limit() const { return interactive_request_limit_; }
+    int standard_request_limit() const { return standard_request_limit_; }
+    int bulk_request_limit() const { return bulk_request_limit_; }
+    int overload_retry_after() const { return overload_retry_after_; }
+    int compression_min_size() const { return compression_min_size_; }
+    int batch_concurrency() const { return batch_concurrency_; }
+    const std::string &trace_file() const { return trace_file_; }
+    int trace_sample_every() const { return trace_sample_every_; }
+    int trace_buffer_size() const { return trace_buffer_size_; }
+    int token_cache_size() const { return token_cache_size_; }
+    int ws_token_refresh_margin() const { return ws_token_refresh_margin_; }
+    int workspace_cache_size() const { return workspace_cache_size_; }
+    int workspace_cache_ttl() const { return workspace_cache_ttl_; }
+    int fetch_concurrency() const { return fetch_concurrency_; }
+    int file_io_threads() const { return file_io_threads_; }
+    int delete_chunk_size() const { return delete_chunk_size_; }
+    int reclaim_threads() const { return reclaim_threads_; }
+    int shock_delete_concurrency() const { return shock_delete_concurrency_; }
+    int copy_batch_size() const { return copy_batch_size_; }
+    int sync_shards() const { return sync_shards_; }
+    int ls_max_limit() const { return ls_max_limit_; }
 };
 
 
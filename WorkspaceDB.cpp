@@ -3,14 +3,23 @@
 #include "parse_url.h"
 #include "WorkspaceConfig.h"
 #include "WorkspaceTypes.h"
+#include "WorkspaceSchema.h"
+#include "FileCopy.h"
 
 #include <mongocxx/collection.hpp>
 #include <mongocxx/database.hpp>
 #include <mongocxx/client.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/options/insert.hpp>
+#include <mongocxx/exception/exception.hpp>
 #include <bsoncxx/json.hpp>
 
 #include <algorithm>
+#include <condition_variable>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
 #include <vector>
 
 #include <boost/asio.hpp>
@@ -22,8 +31,10 @@
 #include <bsoncxx/builder/stream/array.hpp>
 #include <bsoncxx/builder/stream/document.hpp>
 
+#include <bsoncxx/builder/basic/array.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
 #include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
 #include <bsoncxx/types.hpp>
 
 // namespace beast = boost::beast;         // from <boost/beast.hpp>
@@ -189,26 +200,68 @@ bool WorkspaceDB::init_database(const std::string &uri, int threads, const std::
     pool_ = std::make_unique<mongocxx::pool>(uri_);
     n_threads_ = threads;
     thread_pool_ = std::make_unique<boost::asio::thread_pool>(threads);
+    workspace_cache_ = std::make_unique<WorkspaceCache>(config_.workspace_cache_size(),
+							std::chrono::seconds(config_.workspace_cache_ttl()));
 
-    // Start up our sync thread
-    sync_thread_ = std::thread([this]() {
-	net::executor_work_guard<net::io_context::executor_type> guard
-	    = net::make_work_guard(sync_ioc_);
-	sync_ioc_.run(); 
-    });
+    budgets_[static_cast<int>(WorkClass::interactive)].limit = config_.interactive_request_limit();
+    budgets_[static_cast<int>(WorkClass::standard)].limit = config_.standard_request_limit();
+    budgets_[static_cast<int>(WorkClass::bulk)].limit = config_.bulk_request_limit();
+
+    // Start up our sync threads
+    int n_shards = std::max(1, config_.sync_shards());
+    for (int i = 0; i < n_shards; i++)
+    {
+	sync_shards_.emplace_back(std::make_unique<SyncShard>());
+	SyncShard *shard = sync_shards_.back().get();
+	shard->thread = std::thread([shard]() {
+	    net::executor_work_guard<net::io_context::executor_type> guard
+		= net::make_work_guard(shard->ioc);
+	    shard->ioc.run(); 
+	});
+    }
        
     return true;
 }
 
+/*
+ * The shards of the workspaces named in paths, in ascending order and
+ * without duplicates. A path that does not parse is given to shard 0;
+ * the operation will fail on it anyway.
+ */
+std::vector<size_t> WorkspaceDB::sync_shards_for(const std::vector<std::string> &paths)
+{
+    std::vector<size_t> shards;
+    for (auto &p: paths)
+    {
+	WSPathParser parser;
+	size_t s = 0;
+	if (parser.parse(p) && !parser.owner().empty())
+	    s = std::hash<std::string>()(parser.owner() + "/" + parser.wsname()) % sync_shards_.size();
+	shards.push_back(s);
+    }
+    if (shards.empty())
+	shards.push_back(0);
+    std::sort(shards.begin(), shards.end());
+    shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+    return shards;
+}
+
 /*
  * Query needs to post into the thread pool,
  * passing the yield context. 
  */
 
-std::unique_ptr<WorkspaceDBQuery> WorkspaceDB::make_query(const AuthToken &token, bool admin_mode)
+std::unique_ptr<WorkspaceDBQuery> WorkspaceDB::make_query(const AuthToken &token, bool admin_mode,
+							  const tracing::Trace &trace)
 {
+    static metrics::Histogram &pool_wait = metrics::Registry::instance()
+	.histogram("ws_mongo_pool_wait_seconds", "Time spent acquiring a MongoDB pool connection");
+    auto start = std::chrono::steady_clock::now();
     auto pe = pool_->acquire();
-    return std::make_unique<WorkspaceDBQuery>(token, admin_mode, std::move(pe), *this);
+    auto end = std::chrono::steady_clock::now();
+    pool_wait.observe(end - start);
+    trace.record("mongo_pool_wait", start, end);
+    return std::make_unique<WorkspaceDBQuery>(token, admin_mode, std::move(pe), *this, trace);
 }
 
 inline std::string to_string(boost::json::string s)
@@ -264,13 +317,15 @@ ObjectMeta WorkspaceDBQuery::lookup_object_meta(const WSPath &o)
 	qry.append(kvp("name", o.name));
 	qry.append(kvp("workspace_uuid", o.workspace.uuid));
 
-	BOOST_LOG_SEV(lg_, wslog::debug) << "qry: " << bsoncxx::to_json(qry.view()) << "\n";
+	WSLOG(lg_, wslog::debug) << "qry: " << bsoncxx::to_json(qry.view()) << "\n";
+	tracing::Span span(trace_, "mongo_find", "objects");
 	auto cursor = coll.find(qry.view());
 
 	auto ent = cursor.begin();
+	span.end();
 	if (ent == cursor.end())
 	{
-	    BOOST_LOG_SEV(lg_, wslog::debug) << "Not found\n";
+	    WSLOG(lg_, wslog::debug) << "Not found\n";
 	    return meta;
 	}
 	auto &obj = *ent;
@@ -281,7 +336,88 @@ ObjectMeta WorkspaceDBQuery::lookup_object_meta(const WSPath &o)
     return meta;
 }
 
-ObjectMeta WorkspaceDBQuery::metadata_from_db(const WSWorkspace &ws, const bsoncxx::document::view &obj)
+/*
+ * Objects are grouped by workspace and folder; each group is one term
+ * of an $or with the names in an $in, so the lookups use the same index
+ * as lookup_object_meta.
+ */
+std::vector<ObjectMeta> WorkspaceDBQuery::lookup_object_metas(const std::vector<WSPath> &paths,
+							      WSPermission min_permission)
+{
+    std::vector<ObjectMeta> metas(paths.size());
+    std::map<std::pair<std::string, std::string>, std::vector<size_t>> groups;
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+	const WSPath &o = paths[i];
+	if (!(o.workspace.name.empty() || user_has_permission(o.workspace, min_permission)))
+	    continue;
+	if (o.name.empty())
+	    metas[i] = lookup_object_meta(o);
+	else if (!o.workspace.uuid.empty())
+	    groups[std::make_pair(o.workspace.uuid, o.path)].push_back(i);
+    }
+
+    if (groups.empty())
+	return metas;
+
+    builder::basic::array terms;
+    for (auto &g: groups)
+    {
+	builder::basic::array names;
+	for (size_t i: g.second)
+	    names.append(paths[i].name);
+	builder::basic::document in;
+	in.append(kvp("$in", names.view()));
+
+	builder::basic::document term;
+	term.append(kvp("workspace_uuid", g.first.first),
+		    kvp("path", g.first.second),
+		    kvp("name", in.view()));
+	terms.append(term.view());
+    }
+    builder::basic::document qry;
+    qry.append(kvp("$or", terms.view()));
+
+    auto coll = object_collection();
+    tracing::Span span(trace_, "mongo_find", "objects");
+    auto cursor = coll.find(qry.view());
+    for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
+    {
+	auto &obj = *ent;
+	auto iter = groups.find(std::make_pair(get_string(obj, "workspace_uuid"), get_string(obj, "path")));
+	if (iter == groups.end())
+	    continue;
+	std::string name = get_string(obj, "name");
+	for (size_t i: iter->second)
+	{
+	    if (paths[i].name == name)
+		metas[i] = metadata_from_db(paths[i].workspace, obj);
+	}
+    }
+    return metas;
+}
+
+/*
+ * The fields metadata_from_db reads in compact mode.
+ */
+static bsoncxx::document::value compact_projection()
+{
+    return builder::basic::make_document(kvp("_id", 0),
+					 kvp("name", 1),
+					 kvp("type", 1),
+					 kvp("path", 1),
+					 kvp("creation_date", 1),
+					 kvp("uuid", 1),
+					 kvp("owner", 1),
+					 kvp("size", 1));
+}
+
+/*
+ * In compact mode only the fields needed by ObjectMeta::serialize_compact
+ * are filled in; obj need only hold those in compact_projection.
+ */
+ObjectMeta WorkspaceDBQuery::metadata_from_db(const WSWorkspace &ws, const bsoncxx::document::view &obj, bool compact)
 {
     ObjectMeta meta;
 
@@ -302,6 +438,10 @@ ObjectMeta WorkspaceDBQuery::metadata_from_db(const WSWorkspace &ws, const bsonc
     meta.id = get_string(obj, "uuid");
     meta.owner = get_string(obj, "owner");
     meta.size = get_int64(obj, "size");
+    meta.valid = true;
+    if (compact)
+	return meta;
+
     meta.user_metadata = get_map(obj, "metadata");
     meta.auto_metadata = get_map(obj, "autometadata");
     meta.user_permission = effective_permission(ws);
@@ -310,7 +450,6 @@ ObjectMeta WorkspaceDBQuery::metadata_from_db(const WSWorkspace &ws, const bsonc
     {
 	meta.shockurl = get_string(obj, "shocknode");
     }
-    meta.valid = true;
     return meta;
 }
 
@@ -336,7 +475,7 @@ void WorkspaceDBQuery::populate_workspace_from_db_obj(WSWorkspace &ws, const bso
     ss >> std::get_time(&ws.creation_time, "%Y-%m-%dT%H:%M:%SZ");
     if (ss.fail())
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "creation date parse failed '" << creation_time << "'\n";
+	WSLOG(lg_, wslog::debug) << "creation date parse failed '" << creation_time << "'\n";
     }
 
     for (auto p: all_perms)
@@ -346,23 +485,30 @@ void WorkspaceDBQuery::populate_workspace_from_db_obj(WSWorkspace &ws, const bso
 	if (url_decode(p.first, user))
 	{
 	    ws.user_permission.insert(std::make_pair(user, p.second));
-	    // BOOST_LOG_SEV(lg_, wslog::debug) << user << ": " << p.second << "\n";
+	    // WSLOG(lg_, wslog::debug) << user << ": " << p.second << "\n";
 	}
     }
 }
 
 void WorkspaceDBQuery::populate_workspace_from_db(WSWorkspace &ws)
 {
+    auto &cache = db_.workspace_cache();
+    if (cache.lookup(ws))
+	return;
+    uint64_t generation = cache.generation(ws.owner, ws.name);
+
     auto coll = workspace_collection();
     auto qry = builder::basic::document{};
 
     qry.append(kvp("owner", ws.owner));
     qry.append(kvp("name", ws.name));
 
-    // BOOST_LOG_SEV(lg_, wslog::debug) << "qry: " << bsoncxx::to_json(qry.view()) << "\n";
+    // WSLOG(lg_, wslog::debug) << "qry: " << bsoncxx::to_json(qry.view()) << "\n";
 
+    tracing::Span span(trace_, "mongo_find", "workspaces");
     auto cursor = coll.find(qry.view());
     auto ent = cursor.begin();
+    span.end();
 
     if (ent == cursor.end())
 	return;
@@ -374,8 +520,9 @@ void WorkspaceDBQuery::populate_workspace_from_db(WSWorkspace &ws)
     ent++;
     if (ent != cursor.end())
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "nonunique workspace!\n";
+	WSLOG(lg_, wslog::debug) << "nonunique workspace!\n";
     }
+    cache.insert(ws, generation);
 }
 
 WSPath WorkspaceDBQuery::parse_path(const boost::json::value &pstr)
@@ -391,9 +538,12 @@ WSPath WorkspaceDBQuery::parse_path(const boost::json::string &pstr)
     return parse_path(std::string(pstr.c_str()));
 }
 
-WSPath WorkspaceDBQuery::parse_path(const std::string &pstr)
+/*
+ * Parse pstr without looking up its workspace.
+ */
+WSPath WorkspaceDBQuery::parse_path_syntax(const std::string &pstr)
 {
-    BOOST_LOG_SEV(lg_, wslog::debug) << "validating " << pstr << "\n";
+    WSLOG(lg_, wslog::debug) << "validating " << pstr << "\n";
 
     WSPathParser parser;
     WSPath path;
@@ -401,40 +551,96 @@ WSPath WorkspaceDBQuery::parse_path(const std::string &pstr)
     if (parser.parse(pstr))
     {
 	path = parser.extract_path();
-
-	if (!path.workspace.owner.empty() && !path.workspace.name.empty())
-	{
-	    populate_workspace_from_db(path.workspace);
-	}
 	path.empty = false;
     }
     else
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "Path parse failed for '" << pstr << "'\n";
+	WSLOG(lg_, wslog::debug) << "Path parse failed for '" << pstr << "'\n";
     }
     
     return path;
 }
 
+WSPath WorkspaceDBQuery::parse_path(const std::string &pstr)
+{
+    WSPath path = parse_path_syntax(pstr);
+
+    if (!path.workspace.owner.empty() && !path.workspace.name.empty())
+    {
+	populate_workspace_from_db(path.workspace);
+    }
+    return path;
+}
+
+std::vector<WSPath> WorkspaceDBQuery::parse_paths(const boost::json::array &paths)
+{
+    std::vector<WSPath> parsed;
+    parsed.reserve(paths.size());
+    for (auto &p: paths)
+    {
+	if (p.kind() == boost::json::kind::string)
+	    parsed.emplace_back(parse_path_syntax(std::string(p.as_string().c_str())));
+	else
+	    parsed.emplace_back();
+    }
+    resolve_workspaces(parsed);
+    return parsed;
+}
+
+std::vector<WSPath> WorkspaceDBQuery::parse_paths(const std::vector<std::string> &paths)
+{
+    std::vector<WSPath> parsed;
+    parsed.reserve(paths.size());
+    for (auto &p: paths)
+	parsed.emplace_back(parse_path_syntax(p));
+    resolve_workspaces(parsed);
+    return parsed;
+}
+
+/*
+ * Fill in the workspaces of parsed paths, looking up each distinct
+ * workspace once.
+ */
+void WorkspaceDBQuery::resolve_workspaces(std::vector<WSPath> &parsed)
+{
+    std::map<std::pair<std::string, std::string>, WSWorkspace> workspaces;
+    for (auto &path: parsed)
+    {
+	auto &ws = path.workspace;
+	if (!ws.owner.empty() && !ws.name.empty())
+	    workspaces.emplace(std::make_pair(ws.owner, ws.name), ws);
+    }
+
+    for (auto &w: workspaces)
+	populate_workspace_from_db(w.second);
+
+    for (auto &path: parsed)
+    {
+	auto iter = workspaces.find(std::make_pair(path.workspace.owner, path.workspace.name));
+	if (iter != workspaces.end())
+	    path.workspace = iter->second;
+    }
+}
+
 WSPermission WorkspaceDBQuery::effective_permission(const WSWorkspace &w)
 {
-    // BOOST_LOG_SEV(lg_, wslog::debug) << "compute permission for user " << token() << " and workspace owned by " << w.owner << "\n";
+    // WSLOG(lg_, wslog::debug) << "compute permission for user " << token() << " and workspace owned by " << w.owner << "\n";
 
     if (!token().valid())
     {
-	// BOOST_LOG_SEV(lg_, wslog::debug) << "  global fallback for invalid token\n";
+	// WSLOG(lg_, wslog::debug) << "  global fallback for invalid token\n";
 	return w.global_permission;
     }
 
     if (w.global_permission == WSPermission::public_)
     {
-	// BOOST_LOG_SEV(lg_, wslog::debug) << "  is public\n";
+	// WSLOG(lg_, wslog::debug) << "  is public\n";
 	return WSPermission::public_;
     }
 
     if (w.owner == token().user())
     {
-	// BOOST_LOG_SEV(lg_, wslog::debug) << "  is owner\n";
+	// WSLOG(lg_, wslog::debug) << "  is owner\n";
 	return WSPermission::owner;
     }
 
@@ -450,7 +656,7 @@ WSPermission WorkspaceDBQuery::effective_permission(const WSWorkspace &w)
 
     if (token().valid())
     {
-	auto has_perm = w.user_permission.find(token().user());
+	auto has_perm = w.user_permission.find(token().user().to_string());
 	if (has_perm != w.user_permission.end())
 	{
 	    WSPermission user_perm = has_perm->second;
@@ -459,12 +665,12 @@ WSPermission WorkspaceDBQuery::effective_permission(const WSWorkspace &w)
 	    
 	    if (rank_user > rank_global)
 	    {
-		// BOOST_LOG_SEV(lg_, wslog::debug) << "  ranks " << rank_user << " " << rank_global << " determined " << user_perm << "\n";
+		// WSLOG(lg_, wslog::debug) << "  ranks " << rank_user << " " << rank_global << " determined " << user_perm << "\n";
 		return user_perm;
 	    }
 	}
     }
-    // BOOST_LOG_SEV(lg_, wslog::debug) << "  global fallback\n";
+    // WSLOG(lg_, wslog::debug) << "  global fallback\n";
     return w.global_permission;
 }
 
@@ -488,36 +694,45 @@ bool WorkspaceDBQuery::user_has_permission(const WSWorkspace &w, WSPermission mi
     return rank_user >= rank_needed;
 }
 
-std::vector<ObjectMeta> WorkspaceDBQuery::list_objects(const WSPath &path, bool excludeDirectories, bool excludeObjects, bool recursive)
+/*
+ * List the contents of path. With a nonzero limit at most limit objects
+ * are returned, in listing order, starting after the key after if that
+ * is given. A compact listing fetches and decodes only the fields
+ * needed for ObjectMeta::serialize_compact.
+ */
+std::vector<ObjectMeta> WorkspaceDBQuery::list_objects(const WSPath &path, bool excludeDirectories, bool excludeObjects, bool recursive,
+						       size_t limit, const ObjectKey *after, bool compact)
 {
     auto coll = object_collection();
 
-    auto qry = builder::basic::document{};
-
-    qry.append(kvp("workspace_uuid", path.workspace.uuid));
+    auto filter = builder::basic::document{};
     if (excludeDirectories)
-	qry.append(kvp("folder", 0));
+	filter.append(kvp("folder", 0));
     else if (excludeObjects)
-	qry.append(kvp("folder", 1));
+	filter.append(kvp("folder", 1));
 
-    if (recursive)
-    {
-	std::string regex_str = "^" + path.full_path() + "($|/)";
-        auto regex = bsoncxx::types::b_regex(regex_str);
-	qry.append(kvp("path", regex));
-    }
-    else
+    bsoncxx::document::value qry = recursive
+	? schema::subtree_query(path.workspace.uuid, path.full_path(), filter.view(), after)
+	: schema::folder_query(path.workspace.uuid, path.full_path(), filter.view(), after);
+
+    mongocxx::options::find opts;
+    if (limit > 0)
     {
-	qry.append(kvp("path", path.full_path()));
+	opts.sort(schema::listing_order());
+	opts.limit(static_cast<std::int64_t>(limit));
     }
-    auto cursor = coll.find(qry.view());
+    if (compact)
+	opts.projection(compact_projection());
+
+    tracing::Span span(trace_, "mongo_find", "objects");
+    auto cursor = coll.find(qry.view(), opts);
 
     std::vector<ObjectMeta> meta_list;
     for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
     {
 	auto &obj = *ent;
 	
-	meta_list.emplace_back(metadata_from_db(path.workspace, obj));
+	meta_list.emplace_back(metadata_from_db(path.workspace, obj, compact));
     }
     return meta_list;
 }
@@ -543,12 +758,12 @@ std::vector<ObjectMeta> WorkspaceDBQuery::list_workspaces(const std::string &own
     }
 
     terms << builder::stream::open_document
-	  <<   (std::string("permissions.") + mongo_user_encode(token().user()))
+	  <<   (std::string("permissions.") + mongo_user_encode(token().user().to_string()))
 	  <<   builder::stream::open_document << "$exists" << bsoncxx::types::b_bool{true} << builder::stream::close_document
 	  << builder::stream::close_document
 	  << builder::stream::open_document
 	  <<   "owner"
-	  <<   token().user()
+	  <<   token().user().to_string()
 	  << builder::stream::close_document 
 	  << builder::stream::open_document
 	  <<   "global_permission"
@@ -560,7 +775,8 @@ std::vector<ObjectMeta> WorkspaceDBQuery::list_workspaces(const std::string &own
     qry << "$or" << terms
 	<< builder::concatenate(is_owner.view());
     
-    //BOOST_LOG_SEV(lg_, wslog::debug) << "qry: " << bsoncxx::to_json(qry.view()) << "\n";
+    //WSLOG(lg_, wslog::debug) << "qry: " << bsoncxx::to_json(qry.view()) << "\n";
+    tracing::Span span(trace_, "mongo_find", "workspaces");
     auto cursor = coll.find(qry.view());
 
     for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
@@ -617,15 +833,18 @@ std::string WorkspaceDBQuery::insert_download_for_object(const boost::json::stri
 	if (token().valid())
 	{
 	    shock_urls.emplace_back(meta.shockurl);
-	    qry << "token" << token().token();
+	    qry << "token" << token().token().to_string();
 	}
 	else
 	{
-	    qry << "token" << ws_token.token();
+	    qry << "token" << ws_token.token().to_string();
 	}
     }
-    coll.insert_one(qry.view());
-    // BOOST_LOG_SEV(lg_, wslog::debug) << "QRY: " << bsoncxx::to_json(qry.view());
+    {
+	tracing::Span span(trace_, "mongo_insert_one", "downloads");
+	coll.insert_one(qry.view());
+    }
+    // WSLOG(lg_, wslog::debug) << "QRY: " << bsoncxx::to_json(qry.view());
 
     return key;
 }
@@ -637,7 +856,9 @@ bool WorkspaceDBQuery::lookup_download(const std::string &key, std::string &name
     auto coll = download_collection();
     builder::stream::document qry;
     qry << "download_key" << key;
+    tracing::Span span(trace_, "mongo_find_one", "downloads");
     auto res = coll.find_one(qry.view());
+    span.end();
     if (res)
     {
 	auto obj = res->view();
@@ -665,7 +886,7 @@ std::string WorkspaceDBQuery::create_workspace(const ObjectToCreate &tc)
     fs::create_directory(path, ec);
     if (ec)
     {
-	BOOST_LOG_SEV(lg_, wslog::error) << "create_direcotry " << path << " failed: " << ec.message();
+	WSLOG(lg_, wslog::error) << "create_direcotry " << path << " failed: " << ec.message();
 	return "";
     }
 
@@ -686,28 +907,34 @@ std::string WorkspaceDBQuery::create_workspace(const ObjectToCreate &tc)
 
     bsoncxx::document::value qry_doc = qry << builder::stream::finalize;
 
+    tracing::Span span(trace_, "mongo_insert_one", "workspaces");
     auto res = coll.insert_one(qry_doc.view());
+    span.end();
     if (res)
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "Inserted  ws " << res->result().inserted_count() << " "
+	WSLOG(lg_, wslog::debug) << "Inserted  ws " << res->result().inserted_count() << " "
 		  << res->inserted_id().get_oid().value.to_string() << "\n";
+	db_.workspace_cache().invalidate(ws.owner, ws.name);
     }
     else
     {
-	BOOST_LOG_SEV(lg_, wslog::error) << "failed to insert workspace doc: " << bsoncxx::to_json(qry_doc.view());
+	WSLOG(lg_, wslog::error) << "failed to insert workspace doc: " << bsoncxx::to_json(qry_doc.view());
 	uuid = "";
     }
 
     return uuid;
 }
 
-ObjectMeta WorkspaceDBQuery::create_workspace_object(const ObjectToCreate &tc, const std::string &owner)
+/*
+ * Build the database document for a new object, creating its directory
+ * or writing its data in the filesystem as needed. Returns nothing if
+ * the filesystem work failed.
+ */
+std::experimental::optional<bsoncxx::document::value> WorkspaceDBQuery::object_document(const ObjectToCreate &tc,
+											 const std::string &owner)
 {
-    ObjectMeta meta;
-
     auto &cfg = db_.config();
 
-    auto coll = object_collection();
     builder::stream::document qry;
 
     qry << "uuid" << tc.uuid;
@@ -734,8 +961,8 @@ ObjectMeta WorkspaceDBQuery::create_workspace_object(const ObjectToCreate &tc, c
 	fs::create_directory(path, ec);
 	if (ec)
 	{
-	    BOOST_LOG_SEV(lg_, wslog::error) << "create_direcotry " << path << " failed: " << ec.message();
-	    return meta;
+	    WSLOG(lg_, wslog::error) << "create_direcotry " << path << " failed: " << ec.message();
+	    return {};
 	}
     }
     else
@@ -752,7 +979,7 @@ ObjectMeta WorkspaceDBQuery::create_workspace_object(const ObjectToCreate &tc, c
 	    auto dir = path.parent_path();
 	    if (!fs::is_directory(dir))
 	    {
-		BOOST_LOG_SEV(lg_, wslog::error) << "Err: leading path was not created for " << path << "\n";
+		WSLOG(lg_, wslog::error) << "Err: leading path was not created for " << path << "\n";
 	    }
 	    else
 	    {
@@ -765,8 +992,8 @@ ObjectMeta WorkspaceDBQuery::create_workspace_object(const ObjectToCreate &tc, c
 		    long sz = fs::file_size(path);
 		    qry << "size" << sz;
 		} catch (std::ios_base::failure &e) {
-		    BOOST_LOG_SEV(lg_, wslog::error) << "error writing data to " << path << ": " << e.what() << " " << std::strerror(errno);
-		    return meta;
+		    WSLOG(lg_, wslog::error) << "error writing data to " << path << ": " << e.what() << " " << std::strerror(errno);
+		    return {};
 		}
 	    }
 	}
@@ -780,141 +1007,419 @@ ObjectMeta WorkspaceDBQuery::create_workspace_object(const ObjectToCreate &tc, c
     }
     qry << "autometadata" << auto_metadata;
     
-    bsoncxx::document::value qry_doc = qry << builder::stream::finalize;
+    return qry << builder::stream::finalize;
+}
 
-    std::cerr << bsoncxx::to_json(qry_doc.view()) << "\n";
+ObjectMeta WorkspaceDBQuery::create_workspace_object(const ObjectToCreate &tc, const std::string &owner)
+{
+    ObjectMeta meta;
+
+    auto doc = object_document(tc, owner);
+    if (!doc)
+	return meta;
+
+    bsoncxx::document::value &qry_doc = *doc;
+
+    WSLOG(lg_, wslog::debug) << bsoncxx::to_json(qry_doc.view()) << "\n";
     
+    auto coll = object_collection();
+    tracing::Span span(trace_, "mongo_insert_one", "objects");
     auto res = coll.insert_one(qry_doc.view());
+    span.end();
     if (res)
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "Inserted obj " << res->result().inserted_count() << " "
+	WSLOG(lg_, wslog::debug) << "Inserted obj " << res->result().inserted_count() << " "
 		  << res->inserted_id().get_oid().value.to_string() << "\n";
-	meta = lookup_object_meta(tc.parsed_path);
+	meta = metadata_from_db(tc.parsed_path.workspace, qry_doc.view());
     }
     else
     {
-	BOOST_LOG_SEV(lg_, wslog::error) << "failed to insert workspace doc: " << bsoncxx::to_json(qry_doc.view());
+	WSLOG(lg_, wslog::error) << "failed to insert workspace doc: " << bsoncxx::to_json(qry_doc.view());
     }
 
     return meta;
 }
 
-/**
- * Perform the copy operation for a single workspace object.
+/*
+ * Insert docs in one ordered insert_many. uuids gives the uuid of each
+ * document, by which we find out which were inserted if the insert
+ * fails partway; not by path, as a copy may for a moment share its path
+ * with the object it replaces. Entry d of the result says whether
+ * docs[d] was inserted.
  */
-ObjectMeta WorkspaceDBQuery::copy_workspace_object(const ObjectMeta &from, const WSPath &to)
+std::vector<bool> WorkspaceDBQuery::insert_object_documents(const std::vector<bsoncxx::document::value> &docs,
+							    const std::vector<std::string> &uuids)
 {
-    ObjectMeta meta;
+    std::vector<bool> inserted(docs.size());
+    if (docs.empty())
+	return inserted;
+
+    auto coll = object_collection();
+    mongocxx::options::insert opts;
+    opts.ordered(true);
+    try {
+	tracing::Span span(trace_, "mongo_insert_many", "objects");
+	auto res = coll.insert_many(docs, opts);
+	span.end();
+	if (res)
+	{
+	    WSLOG(lg_, wslog::debug) << "Inserted " << res->inserted_count() << " objects\n";
+	    inserted.assign(docs.size(), true);
+	    return inserted;
+	}
+    } catch (mongocxx::exception &e) {
+	WSLOG(lg_, wslog::error) << "insert_many of " << docs.size() << " objects failed: " << e.what() << "\n";
+    }
+
+    std::set<std::string> found;
+    try {
+	builder::basic::array in;
+	for (auto &u: uuids)
+	    in.append(u);
+	mongocxx::options::find opts;
+	opts.projection(builder::basic::make_document(kvp("uuid", 1)));
+	tracing::Span span(trace_, "mongo_find", "objects");
+	auto cursor = coll.find(builder::basic::make_document(
+				    kvp("uuid", builder::basic::make_document(kvp("$in", in.extract())))), opts);
+	for (auto &doc: cursor)
+	    found.insert(get_string(doc, "uuid"));
+    } catch (mongocxx::exception &e) {
+	WSLOG(lg_, wslog::error) << "cannot check which of " << docs.size() << " objects were inserted: " << e.what() << "\n";
+    }
+    for (size_t d = 0; d < docs.size(); d++)
+	inserted[d] = found.count(uuids[d]) > 0;
+    return inserted;
+}
 
+/*
+ * Create many objects with one ordered insert. objs must be ordered so
+ * that folders come before their contents, as their directories are
+ * created in turn.
+ */
+std::vector<ObjectMeta> WorkspaceDBQuery::create_workspace_objects(const std::vector<ObjectToCreate> &objs,
+								   const std::string &owner)
+{
+    std::vector<ObjectMeta> metas(objs.size());
+    std::vector<bsoncxx::document::value> docs;
+    std::vector<size_t> doc_index;
+    std::vector<std::string> uuids;
+    docs.reserve(objs.size());
+    doc_index.reserve(objs.size());
+
+    for (size_t i = 0; i < objs.size(); i++)
+    {
+	auto doc = object_document(objs[i], owner);
+	if (doc)
+	{
+	    docs.emplace_back(std::move(*doc));
+	    doc_index.push_back(i);
+	    uuids.push_back(objs[i].uuid);
+	}
+    }
+
+    auto inserted = insert_object_documents(docs, uuids);
+    for (size_t d = 0; d < docs.size(); d++)
+    {
+	if (inserted[d])
+	    metas[doc_index[d]] = metadata_from_db(objs[doc_index[d]].parsed_path.workspace, docs[d].view());
+    }
+    return metas;
+}
+
+/*
+ * Move the file or directory at p out of the workspace tree into the
+ * trash directory, returning its new path, so that it can be removed
+ * later without touching anything created at p in the meantime. If it
+ * cannot be moved (the trash is on another filesystem, say) we leave
+ * it in place to be removed there. Returns an empty path if there is
+ * nothing at p.
+ */
+fs::path WorkspaceDBQuery::move_to_trash(const fs::path &p)
+{
+    boost::system::error_code ec;
+    if (!fs::exists(fs::symlink_status(p, ec)))
+	return fs::path();
+
+    fs::path trash = db_.config().filesystem_base() / "P3WSDB" / ".trash";
+    fs::create_directories(trash, ec);
+    fs::path dest = trash / boost::lexical_cast<std::string>((*(db_.uuidgen()))());
+    fs::rename(p, dest, ec);
+    if (ec)
+    {
+	WSLOG(lg_, wslog::error) << "cannot move " << p << " to trash: " << ec.message() << "\n";
+	return p;
+    }
+    return dest;
+}
+
+/*
+ * Record the storage of a removed object in remreq.
+ */
+void WorkspaceDBQuery::add_removal(const ObjectMeta &meta, RemovalRequest &remreq)
+{
     auto &cfg = db_.config();
+    const WSPath &path = meta.ws_path;
 
-    auto coll = object_collection();
+    if (meta.is_folder())
+    {
+	fs::path p = move_to_trash(cfg.filesystem_path_for_object(path));
+	if (!p.empty())
+	    remreq.add_directory(p);
+    }
+    else if (meta.is_object())
+    {
+	if (meta.shockurl.empty())
+	{
+	    fs::path p = move_to_trash(cfg.filesystem_path_for_object(path));
+	    if (!p.empty())
+		remreq.add_file(p);
+	}
+	else
+	{
+	    remreq.add_shock_object(meta.shockurl, meta.id);
+	}
+    }
+}
+
+/*
+ * The document for a copy of from at to, whose file data (if any) has
+ * already been copied and is size bytes. A copy of a Shock-backed
+ * object shares its node; the node is removed only when the last
+ * object referring to it is (see referenced_shock_nodes).
+ */
+bsoncxx::document::value WorkspaceDBQuery::copy_document(const ObjectMeta &from, const WSPath &to,
+							 const std::string &uuid, size_t size)
+{
     builder::stream::document qry;
 
-    qry << "uuid" << generate_uuid();
+    qry << "uuid" << uuid;
     qry << "creation_date" << from.creation_time_str();
 
     builder::stream::document user_metadata;
     builder::stream::document auto_metadata;
-    for (auto x: meta.user_metadata)
+    for (auto &x: from.user_metadata)
 	user_metadata << x.first << x.second;
+    for (auto &x: from.auto_metadata)
+	auto_metadata << x.first << x.second;
     qry << "metadata" << user_metadata;
     qry << "name" << to.name;
     qry << "path" << to.path;
     qry << "type" << from.type;
-    qry << "owner" << token().user();
+    qry << "owner" << token().user().to_string();
     qry << "workspace_uuid" << to.workspace.uuid;
-    if (is_folder(from.type))
+    if (from.is_folder())
     {
-	auto path = cfg.filesystem_path_for_object(to);
-
 	qry << "size" << 0;
 	qry << "shock" << 0;
 	qry << "folder" << 1;
-	boost::system::error_code ec;
-	fs::create_directory(path, ec);
-	if (ec)
-	{
-	    BOOST_LOG_SEV(lg_, wslog::error) << "create_direcotry " << path << " failed: " << ec.message();
-	    return meta;
-	}
+    }
+    else if (from.shockurl.empty())
+    {
+	qry << "size" << static_cast<long>(size);
+	qry << "shock" << 0;
+	qry << "folder" << 0;
     }
     else
     {
+	qry << "size" << static_cast<long>(from.size);
+	qry << "shock" << 1;
+	qry << "shocknode" << from.shockurl;
 	qry << "folder" << 0;
+    }
+    qry << "autometadata" << auto_metadata;
 
-	// If we don't have a shock node, we need to copy the filesystem data.
+    return qry << builder::stream::finalize;
+}
 
-	if (from.shockurl.empty())
-	{
-	    qry << "shock" << 0;
+/*
+ * How copy_objects identifies a folder in failed_folders.
+ */
+static std::string folder_key(const WSWorkspace &ws, const std::string &full_path)
+{
+    return ws.uuid + ":" + full_path;
+}
 
-	    auto from_path = cfg.filesystem_path_for_object(from.ws_path);
-	    auto to_path = cfg.filesystem_path_for_object(to);
-	    auto dir = to_path.parent_path();
-	    if (!fs::is_directory(dir))
+/*
+ * Copy each items[i].first to items[i].second. Items are in order of
+ * depth so that a folder is copied before its contents.
+ *
+ * We work copy-batch-size items at a time. The batch's folders are
+ * created first, in order; then the data of its filesystem objects is
+ * copied in parallel on io_pool; then the documents of everything that
+ * was copied are inserted with one insert_many. Objects whose data or
+ * document could not be copied are reported in report, as is anything
+ * inside a folder in failed_folders (keyed by workspace uuid and full
+ * path), to which we add the folders we fail to copy. Files left behind
+ * by a failed insert are moved to the trash and added to remreq. Entry
+ * i of the result says whether items[i] was copied.
+ */
+std::vector<bool> WorkspaceDBQuery::copy_objects(const std::vector<std::pair<ObjectMeta, WSPath>> &items,
+						 std::set<std::string> &failed_folders,
+						 boost::asio::thread_pool &io_pool,
+						 CopyReport &report, RemovalRequest &remreq)
+{
+    static metrics::Counter &copied_objects = metrics::Registry::instance()
+	.counter("ws_copy_objects_total", "Objects created by copies");
+    static metrics::Counter &copied_bytes = metrics::Registry::instance()
+	.counter("ws_copy_bytes_total", "Bytes of file data copied");
+    static metrics::Counter &reflinks = metrics::Registry::instance()
+	.counter("ws_copy_reflinks_total", "Files copied as reflinks");
+
+    auto &cfg = db_.config();
+    size_t batch_size = std::max(1, cfg.copy_batch_size());
+    std::vector<bool> copied(items.size());
+
+    for (size_t start = 0; start < items.size(); start += batch_size)
+    {
+	size_t n = std::min(batch_size, items.size() - start);
+	std::vector<filecopy::Result> results(n);
+	std::vector<char> ok(n, 1);
+
+	for (size_t i = 0; i < n; i++)
+	{
+	    const ObjectMeta &from = items[start + i].first;
+	    const WSPath &to = items[start + i].second;
+	    if (failed_folders.count(folder_key(to.workspace, to.path)))
 	    {
-		BOOST_LOG_SEV(lg_, wslog::error) << "Err: leading path was not created for " << to_path << "\n";
+		ok[i] = 0;
+		report.add_failure(to.user_path(), "Containing folder was not copied");
 	    }
-	    else
+	    else if (from.is_folder())
 	    {
-		try {
-		    fs::copy(from_path, to_path);
-		    long sz = fs::file_size(to_path);
-		    qry << "size" << sz;
-		} catch (std::ios_base::failure &e) {
-		    BOOST_LOG_SEV(lg_, wslog::error) << "error copying " << from_path << "  to " << to_path << ": " << e.what() << " " << std::strerror(errno);
-		    return meta;
+		auto path = cfg.filesystem_path_for_object(to);
+		boost::system::error_code ec;
+		fs::create_directory(path, ec);
+		if (ec)
+		{
+		    WSLOG(lg_, wslog::error) << "create_directory " << path << " failed: " << ec.message() << "\n";
+		    ok[i] = 0;
+		    report.add_failure(to.user_path(), "Cannot create folder: " + ec.message());
 		}
 	    }
+	    if (!ok[i] && from.is_folder())
+		failed_folders.insert(folder_key(to.workspace, to.full_path()));
 	}
-	else
+
+	/*
+	 * Copy the file data. Each task writes only its own entries of
+	 * results and ok, so we need only wait for the count to drop.
+	 */
+	std::mutex mtx;
+	std::condition_variable done;
+	size_t pending = 0;
+	for (size_t i = 0; i < n; i++)
 	{
-	    qry << "size" << 0;
-	    qry << "shock" << 1;
-	    qry << "shocknode" << from.shockurl;
+	    if (ok[i] && !items[start + i].first.is_folder() && items[start + i].first.shockurl.empty())
+		pending++;
+	}
+	{
+	    tracing::Span span(trace_, "copy_file_data", "objects");
+	    for (size_t i = 0; i < n; i++)
+	    {
+		const ObjectMeta &from = items[start + i].first;
+		if (!ok[i] || from.is_folder() || !from.shockurl.empty())
+		    continue;
+		fs::path from_path = cfg.filesystem_path_for_object(from.ws_path);
+		fs::path to_path = cfg.filesystem_path_for_object(items[start + i].second);
+		boost::asio::post(io_pool, [from_path, to_path, &res = results[i], &copied = ok[i], &mtx, &done, &pending]() {
+		    res = filecopy::copy_file(from_path, to_path);
+		    copied = res.ok;
+		    std::lock_guard<std::mutex> lock(mtx);
+		    if (--pending == 0)
+			done.notify_one();
+		});
+	    }
+	    std::unique_lock<std::mutex> lock(mtx);
+	    done.wait(lock, [&pending] { return pending == 0; });
+	}
 
-	    // TODO need to bump refcount in shock data
+	std::vector<bsoncxx::document::value> docs;
+	std::vector<size_t> doc_index;
+	std::vector<std::string> uuids;
+	for (size_t i = 0; i < n; i++)
+	{
+	    const ObjectMeta &from = items[start + i].first;
+	    const WSPath &to = items[start + i].second;
+	    if (!ok[i])
+	    {
+		if (!results[i].error.empty())
+		{
+		    WSLOG(lg_, wslog::error) << "error copying " << from.ws_path << " to " << to << ": " << results[i].error << "\n";
+		    report.add_failure(to.user_path(), results[i].error);
+		}
+		continue;
+	    }
+	    std::string uuid = generate_uuid();
+	    docs.emplace_back(copy_document(from, to, uuid, results[i].size));
+	    doc_index.push_back(i);
+	    uuids.push_back(uuid);
 	}
-	
-    }
-    qry << "autometadata" << auto_metadata;
-    
-    bsoncxx::document::value qry_doc = qry << builder::stream::finalize;
 
-    std::cerr << bsoncxx::to_json(qry_doc.view()) << "\n";
-    
-    auto res = coll.insert_one(qry_doc.view());
-    if (res)
-    {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "Inserted obj " << res->result().inserted_count() << " "
-		  << res->inserted_id().get_oid().value.to_string() << "\n";
-	meta = lookup_object_meta(to);
-    }
-    else
-    {
-	BOOST_LOG_SEV(lg_, wslog::error) << "failed to insert workspace doc: " << bsoncxx::to_json(qry_doc.view());
-    }
+	auto inserted = insert_object_documents(docs, uuids);
+	for (size_t d = 0; d < docs.size(); d++)
+	{
+	    size_t i = doc_index[d];
+	    const ObjectMeta &from = items[start + i].first;
+	    const WSPath &to = items[start + i].second;
+	    if (!inserted[d])
+	    {
+		report.add_failure(to.user_path(), "Database insert failed");
+		if (from.is_folder())
+		    failed_folders.insert(folder_key(to.workspace, to.full_path()));
+		else if (from.shockurl.empty())
+		{
+		    fs::path p = move_to_trash(cfg.filesystem_path_for_object(to));
+		    if (!p.empty())
+			remreq.add_file(p);
+		}
+		continue;
+	    }
+	    copied[start + i] = true;
+	    report.objects++;
+	    if (from.is_folder())
+		report.folders++;
+	    else if (from.shockurl.empty())
+	    {
+		report.bytes += results[i].size;
+		copied_bytes.inc(results[i].size);
+		if (results[i].method == filecopy::Method::reflink)
+		{
+		    report.reflinked++;
+		    reflinks.inc();
+		}
+	    }
+	}
+	copied_objects.inc(std::count(inserted.begin(), inserted.end(), true));
 
-    return meta;
+	WSLOG(lg_, wslog::info) << "copy: " << start + n << " of " << items.size() << " objects done, "
+				<< report.objects << " created, " << report.bytes << " bytes, "
+				<< report.failed.size() << " failed\n";
+    }
+    return copied;
 }
 
 void WorkspaceDBQuery::set_object_size(const std::string &object_id, size_t size)
 {
-    std::cerr << "set " << object_id << " to size " << size << "\n";
+    WSLOG(lg_, wslog::debug) << "set " << object_id << " to size " << size << "\n";
     auto coll = object_collection();
     builder::stream::document filter, set;
 
     filter << "uuid" << object_id;
     set << "$set"
 	<< builder::stream::open_document << "size" << static_cast<long>(size) << builder::stream::close_document;
-    std::cerr << bsoncxx::to_json(filter.view())
+    WSLOG(lg_, wslog::debug) << bsoncxx::to_json(filter.view())
 	      << bsoncxx::to_json(set.view());
 
+    tracing::Span span(trace_, "mongo_update_one", "objects");
     bsoncxx::stdx::optional<mongocxx::result::update> result = coll.update_one(filter.view(), set.view());
 }
 
-bool WorkspaceDBQuery::remove_workspace_object(const ObjectMeta &meta, RemovalRequest &remreq)
+/*
+ * Delete the document of the object meta describes, provided it is
+ * still where meta says. Returns the number deleted, or -1 on failure.
+ * Its storage is left alone.
+ */
+int WorkspaceDBQuery::delete_object_document(const ObjectMeta &meta)
 {
     auto coll = object_collection();
     builder::stream::document filter;
@@ -926,52 +1431,49 @@ bool WorkspaceDBQuery::remove_workspace_object(const ObjectMeta &meta, RemovalRe
 	   << "name" << path.name
 	   << "path" << path.path
 	   << "workspace_uuid" << path.workspace.uuid;
-    std::cerr << bsoncxx::to_json(filter.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << bsoncxx::to_json(filter.view()) << "\n";
 
-    bsoncxx::stdx::optional<mongocxx::result::delete_result> result = coll.delete_one(filter.view());
+    bsoncxx::stdx::optional<mongocxx::result::delete_result> result;
+    try {
+	tracing::Span span(trace_, "mongo_delete_one", "objects");
+	result = coll.delete_one(filter.view());
+    } catch (mongocxx::exception &e) {
+	WSLOG(lg_, wslog::error) << "delete_one failed: " << e.what() << "\n";
+    }
 
-    if (result)
+    if (!result)
     {
-	auto &cfg = db_.config();
-	
-	std::cerr << "delete success " << result->deleted_count() << "\n";
-
-	// Determine the files that need to be removed.
-
-	if (meta.is_folder())
-	{
-	    remreq.add_directory(cfg.filesystem_path_for_object(path));
-	}
-	else if (meta.is_object())
-	{
-	    if (meta.shockurl.empty())
-	    {
-		remreq.add_file(cfg.filesystem_path_for_object(path));
-	    }
-	    else
-	    {
-		remreq.add_shock_object(meta.shockurl, meta.id);
-	    }
-	}
-
-	return true;
+        WSLOG(lg_, wslog::error) << "failed to remove WS item " << bsoncxx::to_json(filter.view()) << "\n";
+	return -1;
     }
-    else
-    {
-        BOOST_LOG_SEV(lg_, wslog::error) << "failed to remove WS item " << bsoncxx::to_json(filter.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << "delete success " << result->deleted_count() << "\n";
+    return result->deleted_count();
+}
+
+bool WorkspaceDBQuery::remove_workspace_object(const ObjectMeta &meta, RemovalRequest &remreq)
+{
+    int n = delete_object_document(meta);
+    if (n < 0)
 	return false;
-    }
+
+    // Determine the files that need to be removed, unless someone
+    // else removed the object first.
+    if (n > 0)
+	add_removal(meta, remreq);
+    return true;
 }
 
 /**
  * Remove a folder.
  *
- *   - Verify there are no objects in this folder.
+ *   - Verify there are no objects in this folder; if there are, set
+ *     error and fail.
  *   - Remove the folder object and
  *   - update removal request
  * 
  */
-bool WorkspaceDBQuery::remove_workspace_folder_only(const ObjectMeta &meta, RemovalRequest &remreq)
+bool WorkspaceDBQuery::remove_workspace_folder_only(const ObjectMeta &meta, RemovalRequest &remreq,
+						    std::string &error)
 {
     auto coll = object_collection();
     builder::stream::document filter;
@@ -979,43 +1481,53 @@ bool WorkspaceDBQuery::remove_workspace_folder_only(const ObjectMeta &meta, Remo
     const WSPath &path = meta.ws_path;
     const std::string &obj_id = meta.id;
 
+    /*
+     * Removing the folder sends its whole directory to the trash, so
+     * we must not remove one that still has contents.
+     */
+    try {
+	mongocxx::options::find opts;
+	opts.projection(builder::basic::make_document(kvp("_id", 1)));
+	opts.limit(1);
+	tracing::Span span(trace_, "mongo_find", "objects");
+	auto cursor = coll.find(schema::subtree_query(path.workspace.uuid, path.full_path()), opts);
+	if (cursor.begin() != cursor.end())
+	{
+	    WSLOG(lg_, wslog::debug) << "not removing non-empty folder " << path << "\n";
+	    error = "Folder is not empty";
+	    return false;
+	}
+    } catch (mongocxx::exception &e) {
+	WSLOG(lg_, wslog::error) << "checking contents of " << path << " failed: " << e.what() << "\n";
+	error = "Cannot check folder contents";
+	return false;
+    }
+
     filter << "uuid" << obj_id
 	   << "name" << path.name
 	   << "path" << path.path
 	   << "workspace_uuid" << path.workspace.uuid;
-    std::cerr << bsoncxx::to_json(filter.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << bsoncxx::to_json(filter.view()) << "\n";
 
+    tracing::Span span(trace_, "mongo_delete_one", "objects");
     bsoncxx::stdx::optional<mongocxx::result::delete_result> result = coll.delete_one(filter.view());
+    span.end();
 
     if (result)
     {
-	auto &cfg = db_.config();
-	
-	std::cerr << "delete success " << result->deleted_count() << "\n";
+	WSLOG(lg_, wslog::debug) << "delete success " << result->deleted_count() << "\n";
 
-	// Determine the files that need to be removed.
-
-	if (meta.is_folder())
-	{
-	    remreq.add_directory(cfg.filesystem_path_for_object(path));
-	}
-	else if (meta.is_object())
-	{
-	    if (meta.shockurl.empty())
-	    {
-		remreq.add_file(cfg.filesystem_path_for_object(path));
-	    }
-	    else
-	    {
-		remreq.add_shock_object(meta.shockurl, meta.id);
-	    }
-	}
+	// Determine the files that need to be removed, unless someone
+	// else removed the object first.
+	if (result->deleted_count() > 0)
+	    add_removal(meta, remreq);
 
 	return true;
     }
     else
     {
-        BOOST_LOG_SEV(lg_, wslog::error) << "failed to remove WS item " << bsoncxx::to_json(filter.view()) << "\n";
+        WSLOG(lg_, wslog::error) << "failed to remove WS item " << bsoncxx::to_json(filter.view()) << "\n";
+	error = "Failed to remove folder";
 	return false;
     }
 }
@@ -1023,57 +1535,99 @@ bool WorkspaceDBQuery::remove_workspace_folder_only(const ObjectMeta &meta, Remo
 /**
  * Remove a folder and its contents
  *
- *   - Enumerate all files.
- *   - Sort by number of slashes, largest first. This gives us an effective
- *     depth-first search.
- *   - Update removal request with file data at each level.
- *   - Do a single mongo query to remove all of the objects.
- * 
+ *   - Collect the Shock nodes of the objects in the folder.
+ *   - Delete the folder's contents delete_chunk_size documents at a
+ *     time, so that no single operation runs for long on a huge folder.
+ *   - Delete the folder itself, last, so that if we fail part way the
+ *     folder is still there for the delete to be retried.
+ *   - Hand the folder's directory, which holds the data of every plain
+ *     object beneath it, and the Shock nodes to the removal request.
  */
 bool WorkspaceDBQuery::remove_workspace_folder_and_contents(const ObjectMeta &meta, RemovalRequest &remreq)
 {
     auto coll = object_collection();
 
     const WSPath &path = meta.ws_path;
-    const std::string &obj_id = meta.id;
+    const std::string &ws_uuid = path.workspace.uuid;
+    const std::string folder = path.full_path();
 
-    // Query for contents of folder.
-    
-    builder::stream::document qry;
+    size_t chunk = std::max(1, db_.config().delete_chunk_size());
+    long deleted = 0;
+    try {
+	{
+	    tracing::Span find_span(trace_, "mongo_find", "objects");
+	    mongocxx::options::find opts;
+	    opts.projection(builder::basic::make_document(kvp("uuid", 1), kvp("shocknode", 1)));
+	    auto qry = schema::subtree_query(ws_uuid, folder, builder::basic::make_document(kvp("shock", 1)));
+	    auto cursor = coll.find(qry.view(), opts);
+	    for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
+	    {
+		auto &obj = *ent;
+		std::string url = get_string(obj, "shocknode");
+		if (!url.empty())
+		    remreq.add_shock_object(url, get_string(obj, "uuid"));
+	    }
+	}
 
-    qry << "path" 
-	<< builder::stream::open_document << "$regex" << (path.full_path() + "($|/)") << builder::stream::close_document
-	<< "workspace_uuid" << path.workspace.uuid;
-    std::cerr << bsoncxx::to_json(qry.view()) << "\n";
+	auto qry = schema::subtree_query(ws_uuid, folder);
+	mongocxx::options::find opts;
+	opts.projection(builder::basic::make_document(kvp("_id", 1)));
+	opts.limit(static_cast<std::int64_t>(chunk));
+	while (1)
+	{
+	    builder::basic::array ids;
+	    size_t n = 0;
+	    auto cursor = coll.find(qry.view(), opts);
+	    for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
+	    {
+		ids.append((*ent)["_id"].get_value());
+		n++;
+	    }
+	    if (n == 0)
+		break;
+
+	    tracing::Span span(trace_, "mongo_delete_many", "objects");
+	    auto res = coll.delete_many(builder::basic::make_document(
+					    kvp("_id", builder::basic::make_document(kvp("$in", ids.extract())))));
+	    if (res)
+		deleted += res->deleted_count();
+	    if (n < chunk)
+		break;
+	}
+    } catch (mongocxx::exception &e) {
+	WSLOG(lg_, wslog::error) << "removing contents of " << path << " failed after "
+				 << deleted << " objects: " << e.what() << "\n";
+	return false;
+    }
+    WSLOG(lg_, wslog::debug) << "removed " << deleted << " objects from " << path << "\n";
 
-    std::vector<ObjectMeta> objs;
-    
-    auto cursor = coll.find(qry.view());
-    for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
-    {
-	auto &obj = *ent;
+    return remove_workspace_object(meta, remreq);
+}
 
-	// object must be in the same workspace based on the query above
-	ObjectMeta meta = metadata_from_db(path.workspace, obj);
-	objs.emplace_back(meta);
-    }
-    for (auto &m: objs)
-    {
-	std::cerr << std::setw(20) << m.name << " " << m.path << "\n";
-    }
+/*
+ * The nodes among urls that are still the data of some object.
+ */
+std::set<std::string> WorkspaceDBQuery::referenced_shock_nodes(const std::vector<std::string> &urls)
+{
+    std::set<std::string> referenced;
+    if (urls.empty())
+	return referenced;
 
-    std::sort(objs.begin(), objs.end(), [](const ObjectMeta &a, const ObjectMeta &b) {
-	return std::count(b.path.begin(), b.path.end(), '/') <
-	    std::count(a.path.begin(), a.path.end(), '/');
-	    });
-    std::cerr << "after sort\n";
-    for (auto &m: objs)
-    {
-	std::cerr << std::setw(40) << m.name << " " << m.path << "\n";
-    }
-    
+    builder::basic::array in;
+    for (auto &u: urls)
+	in.append(u);
+
+    mongocxx::options::find opts;
+    opts.projection(builder::basic::make_document(kvp("_id", 0), kvp("shocknode", 1)));
 
-    return false;
+    auto coll = object_collection();
+    tracing::Span span(trace_, "mongo_find", "objects");
+    auto cursor = coll.find(builder::basic::make_document(
+				kvp("shocknode", builder::basic::make_document(kvp("$in", in.extract())))),
+			    opts);
+    for (auto ent = cursor.begin(); ent != cursor.end(); ent++)
+	referenced.insert(get_string(*ent, "shocknode"));
+    return referenced;
 }
 
 /*
@@ -1088,14 +1642,14 @@ ObjectMeta WorkspaceDBQuery::update_object(const ObjectToModify &obj, bool appen
 {
     ObjectMeta meta = lookup_object_meta(obj.parsed_path);
 
-    std::cerr << "update: meta=" << meta << "\n";
-    std::cerr << "  md=" << meta.user_metadata << "\n";
-    std::cerr << "  type=" << meta.type << "\n";
-    std::cerr << "  cre=" << meta.creation_time << "\n";
+    WSLOG(lg_, wslog::debug) << "update: meta=" << meta << "\n";
+    WSLOG(lg_, wslog::debug) << "  md=" << meta.user_metadata << "\n";
+    WSLOG(lg_, wslog::debug) << "  type=" << meta.type << "\n";
+    WSLOG(lg_, wslog::debug) << "  cre=" << meta.creation_time << "\n";
 
     if (obj.type && (is_folder(obj.type.value()) != is_folder(meta.type)))
     {
-        BOOST_LOG_SEV(lg_, wslog::error) << "cannot change non-folder type to folder or vice versa";
+        WSLOG(lg_, wslog::error) << "cannot change non-folder type to folder or vice versa";
 	return {};
     }
 
@@ -1103,7 +1657,7 @@ ObjectMeta WorkspaceDBQuery::update_object(const ObjectToModify &obj, bool appen
     builder::stream::document filter;
 
     filter << "uuid" << meta.id;
-    std::cerr << "Update filter " << bsoncxx::to_json(filter.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << "Update filter " << bsoncxx::to_json(filter.view()) << "\n";
 
     builder::stream::document update;
 
@@ -1129,7 +1683,7 @@ ObjectMeta WorkspaceDBQuery::update_object(const ObjectToModify &obj, bool appen
     {
 	if (obj.type.value() == meta.type)
 	{
-	    std::cerr << "skipping update of type - value already set\n";
+	    WSLOG(lg_, wslog::debug) << "skipping update of type - value already set\n";
 	}
 	else
 	{
@@ -1146,19 +1700,23 @@ ObjectMeta WorkspaceDBQuery::update_object(const ObjectToModify &obj, bool appen
 
     if (empty)
     {
-	std::cerr << "Nothing to update\n";
+	WSLOG(lg_, wslog::debug) << "Nothing to update\n";
 	return meta;
     }
-    std::cerr << "Update data " << bsoncxx::to_json(update.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << "Update data " << bsoncxx::to_json(update.view()) << "\n";
+    tracing::Span span(trace_, "mongo_update_one", "objects");
     bsoncxx::stdx::optional<mongocxx::result::update> result = coll.update_one(filter.view(), update.view());
+    span.end();
     if (result)
     {
-	std::cerr << "updated\n";
+	WSLOG(lg_, wslog::debug) << "updated\n";
+	if (obj.parsed_path.is_workspace_path())
+	    db_.workspace_cache().invalidate_uuid(meta.id);
 	meta = lookup_object_meta(obj.parsed_path);
     }
     else
     {
-	std::cerr << "update failed!\n";
+	WSLOG(lg_, wslog::error) << "update failed!\n";
     }
     return meta;
 }
@@ -1228,14 +1786,14 @@ std::experimental::optional<std::string> WorkspaceDBQuery::update_permissions(co
 
     if (set_vals.view().empty() && unset_vals.view().empty())
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "No values to set, returning\n";
+	WSLOG(lg_, wslog::debug) << "No values to set, returning\n";
 	return {};
     }
 
     auto coll = workspace_collection();
     builder::stream::document filter;
     filter << "uuid" << ws.uuid;
-    BOOST_LOG_SEV(lg_, wslog::debug) << "Update filter " << bsoncxx::to_json(filter.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << "Update filter " << bsoncxx::to_json(filter.view()) << "\n";
 
     builder::stream::document update;
     
@@ -1248,17 +1806,20 @@ std::experimental::optional<std::string> WorkspaceDBQuery::update_permissions(co
 	update << "$unset" << unset_vals;
     }
 
-    BOOST_LOG_SEV(lg_, wslog::debug) << "Update set " << bsoncxx::to_json(update.view()) << "\n";
+    WSLOG(lg_, wslog::debug) << "Update set " << bsoncxx::to_json(update.view()) << "\n";
 
+    tracing::Span span(trace_, "mongo_update_one", "workspaces");
     bsoncxx::stdx::optional<mongocxx::result::update> result = coll.update_one(filter.view(), update.view());
+    span.end();
     if (result)
     {
-	BOOST_LOG_SEV(lg_, wslog::debug)  << "updated\n";
+	WSLOG(lg_, wslog::debug)  << "updated\n";
     }
     else
     {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "update failed!\n";
+	WSLOG(lg_, wslog::debug) << "update failed!\n";
     }
+    db_.workspace_cache().invalidate(ws.owner, ws.name);
 
     return {};
 }
@@ -1279,14 +1840,18 @@ std::experimental::optional<std::string> WorkspaceDBQuery::update_permissions(co
  *     - Otherwise,
  *        - If to is a directory, then copy_file(from, to/from.filename, options)
  *        - Otherwise, copy_file(from, to, options)
+ *
+ * An object replaced under overwrite is removed only once its copy is
+ * in place; if the copy fails the object is left as it was.
  */
 
-ObjectMeta WorkspaceDBQuery::perform_copy(const std::string &from, const std::string &to, bool recursive, bool overwrite)
+ObjectMeta WorkspaceDBQuery::perform_copy(const std::string &from, const std::string &to, bool recursive, bool overwrite,
+					 boost::asio::thread_pool &io_pool, CopyReport &report, RemovalRequest &remreq)
 {
     ObjectMeta m;
 
     WSPath from_path = parse_path(from);
-    std::cerr << "parsed from " << from_path << "\n";
+    WSLOG(lg_, wslog::debug) << "parsed from " << from_path << "\n";
     if (from_path.workspace.uuid.empty())
     {
 	m.error = "Error parsing from path";
@@ -1301,7 +1866,7 @@ ObjectMeta WorkspaceDBQuery::perform_copy(const std::string &from, const std::st
 	return m;
     }
 
-    const std::string &user = token().user();
+    const std::string user = token().user().to_string();
     // Check permissions on source.
     if (!user_has_permission(from_path.workspace, WSPermission::read))
     {
@@ -1338,6 +1903,12 @@ ObjectMeta WorkspaceDBQuery::perform_copy(const std::string &from, const std::st
 	    m.error = "Cannot copy a folder onto an object";
 	    return m;
 	}
+
+	if (!from_meta.is_folder() && !to_meta.is_folder() && !overwrite)
+	{
+	    m.error = "Destination exists";
+	    return m;
+	}
     }
     else
     {
@@ -1356,12 +1927,59 @@ ObjectMeta WorkspaceDBQuery::perform_copy(const std::string &from, const std::st
 
     // Finished with initial error checking, start processing
 
+    auto &cfg = db_.config();
+    std::vector<std::pair<ObjectMeta, WSPath>> items;
+    std::set<std::string> failed_folders;
+
+    /*
+     * Objects we are replacing. Their data is moved aside rather than
+     * removed, so that it can be put back if the copy that replaces
+     * them fails; they are removed only once the copy is in place.
+     */
+    struct Replaced
+    {
+	ObjectMeta old;
+	fs::path parked;
+	size_t item;
+    };
+    std::vector<Replaced> replaced;
+
+    // Set old aside, to be replaced by the next item; false if we cannot.
+    auto park = [&](const ObjectMeta &old) {
+	fs::path parked;
+	if (old.shockurl.empty())
+	{
+	    fs::path old_fs = cfg.filesystem_path_for_object(old.ws_path);
+	    parked = move_to_trash(old_fs);
+	    if (parked == old_fs)
+		return false;
+	}
+	replaced.push_back(Replaced{old, parked, items.size()});
+	return true;
+    };
+
     if (from_meta.is_folder())
     {
+	if (recursive && to_path.workspace.uuid == from_path.workspace.uuid)
+	{
+	    std::string inner = from_path.full_path();
+	    std::string dest = to_path.full_path();
+	    if (inner.empty() || dest.compare(0, inner.size() + 1, inner + "/") == 0)
+	    {
+		m.error = "Cannot copy a folder into itself";
+		return m;
+	    }
+	}
+
 	if (!to_meta.valid)
 	{
 	    to_meta = create_folder(to_path);
-	    std::cerr << "Created new path for dest " << to_meta << "\n";
+	    WSLOG(lg_, wslog::debug) << "Created new path for dest " << to_meta << "\n";
+	    if (!to_meta.valid)
+	    {
+		m.error = "Cannot create destination folder";
+		return m;
+	    }
 	}
 	if (recursive)
 	{
@@ -1377,31 +1995,345 @@ ObjectMeta WorkspaceDBQuery::perform_copy(const std::string &from, const std::st
 		return std::count(a.path.begin(), a.path.end(), '/') <
 		    std::count(b.path.begin(), b.path.end(), '/');
 	    });
-	    
-	    for (auto obj: objs)
+
+	    // What is already in the destination, which we merge into.
+	    std::map<std::string, ObjectMeta> existing;
+	    for (auto &obj: list_objects(to_path, false, false, true))
+		existing.emplace(obj.ws_path.full_path(), obj);
+
+	    WSPathRewriter rewriter(from_path, to_path);
+	    items.reserve(objs.size());
+	    for (auto &obj: objs)
 	    {
-		std::cerr << "would copy " << obj << "\n";
-		auto dest_obj_path = obj.ws_path.replace_path_prefix(from_path, to_path);
-		if (dest_obj_path)
+		auto dest = rewriter.rewrite(obj.ws_path);
+		if (!dest)
 		{
-		    std::cerr << "new is " << *dest_obj_path << "\n\n";
-		    copy_workspace_object(obj, *dest_obj_path);
+		    report.add_failure(obj.ws_path.user_path(), "Not inside the source folder");
+		    continue;
 		}
+
+		auto ex = existing.find(dest->full_path());
+		if (ex != existing.end())
+		{
+		    const ObjectMeta &old = ex->second;
+		    if (obj.is_folder() && old.is_folder())
+			continue;
+		    if (!overwrite || obj.is_folder() || old.is_folder())
+		    {
+			report.add_failure(dest->user_path(), "Destination exists");
+			if (obj.is_folder())
+			    failed_folders.insert(folder_key(dest->workspace, dest->full_path()));
+			continue;
+		    }
+		    if (!park(old))
+		    {
+			report.add_failure(dest->user_path(), "Cannot move replaced object aside");
+			continue;
+		    }
+		}
+		items.emplace_back(obj, *dest);
 	    }
 	}
+	m = to_meta;
     }
     else
     {
+	// Copying onto a folder puts the copy inside it.
+	WSPath dest = to_path;
+	if (to_meta.valid && to_meta.is_folder())
+	{
+	    dest.path = to_path.full_path();
+	    dest.name = from_path.name;
+	    to_meta = lookup_object_meta(dest);
+	    if (to_meta.valid && (to_meta.is_folder() || !overwrite))
+	    {
+		m.error = "Destination exists";
+		return m;
+	    }
+	}
+	if (to_meta.valid && !park(to_meta))
+	{
+	    m.error = "Cannot move replaced object aside";
+	    return m;
+	}
+	items.emplace_back(from_meta, dest);
+	m.ws_path = dest;
     }
-    
-    
+
+    auto copied = copy_objects(items, failed_folders, io_pool, report, remreq);
+
+    for (auto &r: replaced)
+    {
+	if (!copied[r.item])
+	{
+	    if (r.parked.empty())
+		continue;
+	    // The copy failed and left nothing at the path; put the old data back.
+	    fs::path old_fs = cfg.filesystem_path_for_object(r.old.ws_path);
+	    boost::system::error_code ec;
+	    if (!fs::exists(fs::symlink_status(old_fs, ec)))
+		fs::rename(r.parked, old_fs, ec);
+	    else
+		ec = boost::system::errc::make_error_code(boost::system::errc::file_exists);
+	    if (ec)
+		WSLOG(lg_, wslog::error) << "cannot restore data of " << r.old << " from " << r.parked << ": " << ec.message() << "\n";
+	    continue;
+	}
+	int n = delete_object_document(r.old);
+	if (n > 0)
+	{
+	    if (!r.parked.empty())
+		remreq.add_file(r.parked);
+	    else
+		remreq.add_shock_object(r.old.shockurl, r.old.id);
+	}
+	else if (n < 0)
+	    WSLOG(lg_, wslog::error) << "copied over " << r.old << " but could not remove it\n";
+    }
+
+    if (!from_meta.is_folder())
+    {
+	if (report.objects > 0)
+	    m = lookup_object_meta(m.ws_path);
+	else
+	    m.error = report.failed.empty() ? "Copy failed" : report.failed.front().second;
+    }
+    else if (!report.failed.empty())
+	m.error = std::to_string(report.failed.size()) + " objects could not be copied";
+
     return m;
 }
 
-ObjectMeta WorkspaceDBQuery::perform_move(const std::string &from, const std::string &to, bool overwrite)
+/*
+ * Move (or rename) from to to. If to is an existing folder, from is
+ * moved into it. Otherwise to must not exist, or with overwrite may be
+ * an object, which is replaced; from cannot replace a folder.
+ *
+ * No data is copied. The file or directory is renamed, and the database
+ * documents are updated in place: for a folder, one update for the
+ * folder itself, one for the objects directly in it, and one that
+ * rewrites the paths of everything below it (see WorkspaceSchema.h).
+ * A move between workspaces also changes workspace_uuid. Shock nodes
+ * are untouched.
+ *
+ * If any step fails, the earlier ones are undone, and a replaced
+ * object is removed only after the moved one is in its place.
+ */
+ObjectMeta WorkspaceDBQuery::perform_move(const std::string &from, const std::string &to, bool overwrite,
+					 RemovalRequest &remreq)
 {
     ObjectMeta m;
-    return m;
+    auto &cfg = db_.config();
+
+    WSPath from_path = parse_path(from);
+    if (from_path.workspace.uuid.empty())
+    {
+	m.error = "Error parsing from path";
+	return m;
+    }
+    if (from_path.is_workspace_path())
+    {
+	m.error = "Cannot move a workspace";
+	return m;
+    }
+
+    // Moving removes the object from its workspace.
+    if (!user_has_permission(from_path.workspace, WSPermission::write))
+    {
+	m.error = "Permission denied on from path";
+	return m;
+    }
+
+    ObjectMeta from_meta = lookup_object_meta(from_path);
+    if (!from_meta.valid)
+    {
+	m.error = "From object does not exist";
+	return m;
+    }
+
+    WSPath to_path = parse_path(to);
+    if (to_path.workspace.uuid.empty())
+    {
+	m.error = "Error parsing to path";
+	return m;
+    }
+    if (!user_has_permission(to_path.workspace, WSPermission::write))
+    {
+	m.error = "Permission denied on to path";
+	return m;
+    }
+
+    WSPath dest = to_path;
+    ObjectMeta to_meta = lookup_object_meta(to_path);
+    if (to_meta.valid && to_meta.is_folder())
+    {
+	dest.path = to_path.full_path();
+	dest.name = from_path.name;
+	to_meta = lookup_object_meta(dest);
+    }
+    else if (!to_meta.valid)
+    {
+	ObjectMeta parent_meta = lookup_object_meta(to_path.parent_path());
+	if (!parent_meta.valid || !parent_meta.is_folder())
+	{
+	    m.error = "Destination folder does not exist";
+	    return m;
+	}
+    }
+
+    std::string from_full = from_path.full_path();
+    std::string dest_full = dest.full_path();
+    if (to_meta.valid)
+    {
+	if (to_meta.id == from_meta.id)
+	{
+	    m.error = "From and to are the same object";
+	    return m;
+	}
+	if (!overwrite || to_meta.is_folder() || from_meta.is_folder())
+	{
+	    m.error = "Destination exists";
+	    return m;
+	}
+    }
+    if (from_meta.is_folder() && dest.workspace.uuid == from_path.workspace.uuid &&
+	dest_full.compare(0, from_full.size() + 1, from_full + "/") == 0)
+    {
+	m.error = "Cannot move a folder into itself";
+	return m;
+    }
+
+    fs::path from_fs = cfg.filesystem_path_for_object(from_path);
+    fs::path dest_fs = cfg.filesystem_path_for_object(dest);
+
+    /*
+     * The data of an object we are replacing is moved aside rather
+     * than removed, so that it can be put back if the move fails. The
+     * object itself is removed only once the move has succeeded.
+     */
+    fs::path parked;
+    if (to_meta.valid && to_meta.shockurl.empty())
+	parked = move_to_trash(dest_fs);
+    if (parked == dest_fs)
+    {
+	m.error = "Cannot move replaced object aside";
+	return m;
+    }
+
+    /*
+     * Rename on disk first. A folder or file that was never created on
+     * disk has nothing to rename.
+     */
+    bool renamed = false;
+    if (from_meta.is_folder() || from_meta.shockurl.empty())
+    {
+	boost::system::error_code ec, ec2;
+	fs::rename(from_fs, dest_fs, ec);
+	if (!ec)
+	    renamed = true;
+	else if (fs::exists(fs::symlink_status(from_fs, ec2)))
+	{
+	    WSLOG(lg_, wslog::error) << "rename " << from_fs << " to " << dest_fs << " failed: " << ec.message() << "\n";
+	    if (!parked.empty())
+		fs::rename(parked, dest_fs, ec2);
+	    m.error = "Cannot move data: " + ec.message();
+	    return m;
+	}
+    }
+
+    // Put everything back as it was before the move.
+    auto restore = [&](bool contents_moved) {
+	boost::system::error_code ec;
+	if (contents_moved)
+	{
+	    try {
+		move_folder_contents(dest.workspace.uuid, dest_full, from_path.workspace.uuid, from_full);
+	    } catch (mongocxx::exception &e) {
+		WSLOG(lg_, wslog::error) << "restoring contents of " << from_path << " failed: " << e.what() << "\n";
+	    }
+	}
+	if (renamed)
+	    fs::rename(dest_fs, from_fs, ec);
+	if (!parked.empty())
+	    fs::rename(parked, dest_fs, ec);
+    };
+
+    /*
+     * Move a folder's contents before the folder itself, so that if
+     * either fails we can move the contents back.
+     */
+    if (from_meta.is_folder())
+    {
+	try {
+	    move_folder_contents(from_path.workspace.uuid, from_full, dest.workspace.uuid, dest_full);
+	} catch (mongocxx::exception &e) {
+	    WSLOG(lg_, wslog::error) << "moving contents of " << from_path << " failed: " << e.what() << "\n";
+	    restore(true);
+	    m.error = "Database update failed";
+	    return m;
+	}
+    }
+
+    auto coll = object_collection();
+    using builder::basic::make_document;
+    try {
+	tracing::Span span(trace_, "mongo_update_one", "objects");
+	auto res = coll.update_one(make_document(kvp("uuid", from_meta.id)),
+				   make_document(kvp("$set", make_document(kvp("workspace_uuid", dest.workspace.uuid),
+									    kvp("path", dest.path),
+									    kvp("name", dest.name)))));
+	span.end();
+	if (!res || res->matched_count() == 0)
+	{
+	    restore(from_meta.is_folder());
+	    m.error = "Object was removed during the move";
+	    return m;
+	}
+    } catch (mongocxx::exception &e) {
+	WSLOG(lg_, wslog::error) << "moving " << from_path << " failed: " << e.what() << "\n";
+	restore(from_meta.is_folder());
+	m.error = "Database update failed";
+	return m;
+    }
+
+    if (to_meta.valid)
+    {
+	int n = delete_object_document(to_meta);
+	if (n > 0)
+	{
+	    if (!parked.empty())
+		remreq.add_file(parked);
+	    else if (!to_meta.shockurl.empty())
+		remreq.add_shock_object(to_meta.shockurl, to_meta.id);
+	}
+	else if (n < 0)
+	    WSLOG(lg_, wslog::error) << "moved " << from_path << " but could not remove replaced " << to_meta << "\n";
+    }
+
+    return lookup_object_meta(dest);
+}
+
+/*
+ * Move the objects inside folder from_folder of workspace from_ws to
+ * the same place inside to_folder of to_ws: one update for the objects
+ * directly in it, one for those below. Throws mongocxx::exception.
+ */
+void WorkspaceDBQuery::move_folder_contents(const std::string &from_ws, const std::string &from_folder,
+					    const std::string &to_ws, const std::string &to_folder)
+{
+    using builder::basic::make_document;
+    auto coll = object_collection();
+
+    tracing::Span span(trace_, "mongo_update_many", "objects");
+    auto top = coll.update_many(schema::folder_query(from_ws, from_folder),
+				make_document(kvp("$set", make_document(kvp("workspace_uuid", to_ws),
+									 kvp("path", to_folder)))));
+    auto below = coll.update_many(schema::below_query(from_ws, from_folder),
+				  schema::rebase_paths(from_folder, to_folder, to_ws));
+    span.end();
+    WSLOG(lg_, wslog::debug) << "moved contents of " << from_folder << " to " << to_folder << ": "
+			     << (top ? top->modified_count() : 0) + (below ? below->modified_count() : 0)
+			     << " objects\n";
 }
 
 std::string WorkspaceDBQuery::generate_uuid()
@@ -1413,6 +2345,6 @@ std::string WorkspaceDBQuery::generate_uuid()
 ObjectMeta WorkspaceDBQuery::create_folder(const WSPath &path)
 {
     ObjectToCreate cre(path, "folder");
-    ObjectMeta created = create_workspace_object(cre, token().user());
+    ObjectMeta created = create_workspace_object(cre, token().user().to_string());
     return created;
 }
@@ -1,13 +1,18 @@
 #ifndef _Workspace_DB
 #define _Workspace_DB
 
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <thread>
 #include <experimental/optional>
 
 #include <mongocxx/instance.hpp>
 #include <mongocxx/uri.hpp>
 #include <mongocxx/pool.hpp>
+#include <bsoncxx/document/value.hpp>
 
 #include <boost/asio/coroutine.hpp>
 #include <boost/asio/spawn.hpp>
@@ -21,6 +26,8 @@
 #include "WorkspaceTypes.h"
 #include "DispatchContext.h"
 #include "Logging.h"
+#include "Metrics.h"
+#include "WorkspaceCache.h"
 
 class WorkspaceDB;
 class WorkspaceConfig;
@@ -33,24 +40,59 @@ private:
     bool admin_mode_;
     mongocxx::pool::entry  client_;
     WorkspaceDB &db_;
+    tracing::Trace trace_;
 
     mongocxx::collection object_collection();
     mongocxx::collection workspace_collection();
     mongocxx::collection download_collection();
 
+    WSPath parse_path_syntax(const std::string &pstr);
+    void resolve_workspaces(std::vector<WSPath> &parsed);
+    std::experimental::optional<bsoncxx::document::value> object_document(const ObjectToCreate &tc, const std::string &owner);
+    boost::filesystem::path move_to_trash(const boost::filesystem::path &p);
+    void add_removal(const ObjectMeta &meta, RemovalRequest &remreq);
+    int delete_object_document(const ObjectMeta &meta);
+    void move_folder_contents(const std::string &from_ws, const std::string &from_folder,
+			      const std::string &to_ws, const std::string &to_folder);
+    std::vector<bool> insert_object_documents(const std::vector<bsoncxx::document::value> &docs,
+					      const std::vector<std::string> &uuids);
+    bsoncxx::document::value copy_document(const ObjectMeta &from, const WSPath &to,
+					   const std::string &uuid, size_t size);
+    std::vector<bool> copy_objects(const std::vector<std::pair<ObjectMeta, WSPath>> &items,
+				   std::set<std::string> &failed_folders,
+				   boost::asio::thread_pool &io_pool,
+				   CopyReport &report, RemovalRequest &remreq);
+
 public:
-    WorkspaceDBQuery(const AuthToken &token, bool admin_mode, mongocxx::pool::entry p, WorkspaceDB &db)
+    WorkspaceDBQuery(const AuthToken &token, bool admin_mode, mongocxx::pool::entry p, WorkspaceDB &db,
+		     const tracing::Trace &trace = tracing::Trace())
 	: token_(token)
 	, admin_mode_(admin_mode)
 	, client_(std::move(p))
 	, db_(db)
+	, trace_(trace)
 	, wslog::LoggerBase("wsdbq") {
     }
-    ~WorkspaceDBQuery() { BOOST_LOG_SEV(lg_, wslog::debug) << "destroy WorkspaceDBQuery\n"; }
+    ~WorkspaceDBQuery() { WSLOG(lg_, wslog::debug) << "destroy WorkspaceDBQuery\n"; }
     WSPath parse_path(const boost::json::value &p);
     WSPath parse_path(const boost::json::string &p);
     WSPath parse_path(const std::string &p);
     ObjectMeta lookup_object_meta(const WSPath &path);
+
+    /*
+     * Parse a list of paths, looking up each distinct workspace once.
+     * Elements that are not strings yield empty paths.
+     */
+    std::vector<WSPath> parse_paths(const boost::json::array &paths);
+    std::vector<WSPath> parse_paths(const std::vector<std::string> &paths);
+
+    /*
+     * Look up the metadata for many paths with a single objects query.
+     * Entry i of the result is for paths[i]. Paths in a workspace
+     * on which the user lacks min_permission get invalid metadata.
+     */
+    std::vector<ObjectMeta> lookup_object_metas(const std::vector<WSPath> &paths,
+						WSPermission min_permission = WSPermission::none);
     const AuthToken &token() { return token_; }
     bool admin_mode() const { return admin_mode_; }
 
@@ -64,13 +106,14 @@ public:
     WSPermission effective_permission(const WSWorkspace &w);
     bool user_has_permission(const WSWorkspace &w, WSPermission min_permission);
 
-    std::vector<ObjectMeta> list_objects(const WSPath &path, bool excludeDirectories, bool excludeObjects, bool recursive);
+    std::vector<ObjectMeta> list_objects(const WSPath &path, bool excludeDirectories, bool excludeObjects, bool recursive,
+					 size_t limit = 0, const ObjectKey *after = nullptr, bool compact = false);
     std::vector<ObjectMeta> list_workspaces(const std::string &owner);
 
     void populate_workspace_from_db(WSWorkspace &ws);
     void populate_workspace_from_db_obj(WSWorkspace &ws, const bsoncxx::document::view &obj);
 
-    ObjectMeta metadata_from_db(const WSWorkspace &ws,  const bsoncxx::document::view &obj);
+    ObjectMeta metadata_from_db(const WSWorkspace &ws,  const bsoncxx::document::view &obj, bool compact = false);
 
     /*
      * Download support.
@@ -97,12 +140,23 @@ public:
      */
     ObjectMeta create_workspace_object(const ObjectToCreate &tc, const std::string &owner);
 
-    ObjectMeta copy_workspace_object(const ObjectMeta &from, const WSPath &to);
+    /**
+     * Create many workspace objects with a single insert, under the same
+     * assumptions. Entry i of the result is for objs[i], and is invalid
+     * if that object was not created.
+     */
+    std::vector<ObjectMeta> create_workspace_objects(const std::vector<ObjectToCreate> &objs, const std::string &owner);
 
     bool remove_workspace_object(const ObjectMeta &meta, RemovalRequest &remreq);
-    bool remove_workspace_folder_only(const ObjectMeta &meta, RemovalRequest &remreq);
+    bool remove_workspace_folder_only(const ObjectMeta &meta, RemovalRequest &remreq, std::string &error);
     bool remove_workspace_folder_and_contents(const ObjectMeta &meta, RemovalRequest &remreq);
 
+    /**
+     * Of the Shock node urls given, those still referenced by an object.
+     * A node is removed only when its last object is.
+     */
+    std::set<std::string> referenced_shock_nodes(const std::vector<std::string> &urls);
+
     /**
      * Update workspace or object metadata.
      */
@@ -118,13 +172,22 @@ public:
 
     /**
      * Perform a copy operation.
+     *
+     * File data is copied on io_pool. The result is the metadata of
+     * the destination; report says what was copied and what could not
+     * be, and the storage of objects replaced by an overwrite is added
+     * to remreq.
      */
-    ObjectMeta perform_copy(const std::string &from, const std::string &to, bool recursive, bool overwrite);
+    ObjectMeta perform_copy(const std::string &from, const std::string &to, bool recursive, bool overwrite,
+			    boost::asio::thread_pool &io_pool, CopyReport &report, RemovalRequest &remreq);
 
     /**
-     * Perform a move operation.
+     * Perform a move operation. This renames the data and updates the
+     * documents in place; nothing is copied. The storage of an object
+     * replaced by an overwrite is added to remreq.
      */
-    ObjectMeta perform_move(const std::string &from, const std::string &to, bool overwrite);
+    ObjectMeta perform_move(const std::string &from, const std::string &to, bool overwrite,
+			    RemovalRequest &remreq);
 
     /**
      * Generate a new UUID.
@@ -146,25 +209,85 @@ class WorkspaceDB
     mongocxx::uri uri_;
     std::unique_ptr<mongocxx::pool> pool_;
     /**
-     * The sync IOC is used to host a single thread
-     * to which requests for database operations that must be
-     * globally serialized are made
-     */
-    boost::asio::io_context sync_ioc_;
-    /**
-     * This is the thread running for the sync_ioc_;
+     * Database operations that modify a workspace are serialized per
+     * workspace. Each workspace is assigned, by a hash of its owner
+     * and name, to one of the sync shards; each shard has an IOC with
+     * a single thread to which requests for that workspace's operations
+     * are made, so that operations on different workspaces run in
+     * parallel. Every operation that writes objects or workspaces
+     * (create, delete, copy, move, metadata and permission updates)
+     * must be run this way; \ref run_in_thread is for reads.
+     *
+     * An operation that spans several shards (a copy between two
+     * workspaces, say) runs on the thread of the lowest of them and
+     * also holds the mutex of each of them, taken in ascending order.
+     * Every operation holds the mutex of its own shard, so the others
+     * wait for it, and since mutexes are only ever taken in ascending
+     * order no two operations can wait for each other.
      */
-    std::thread sync_thread_;
+    struct SyncShard
+    {
+	boost::asio::io_context ioc;
+	std::thread thread;
+	std::mutex mtx;
+    };
+    std::vector<std::unique_ptr<SyncShard>> sync_shards_;
+
+    std::vector<size_t> sync_shards_for(const std::vector<std::string> &paths);
 
     mongocxx::instance instance_;
 
     WorkspaceConfig &config_;
     int n_threads_;
 
+    std::unique_ptr<WorkspaceCache> workspace_cache_;
+
+    /*
+     * The pool's queue is not bounded. What bounds it in practice is
+     * admission: a request holds its class budget until it completes
+     * and has at most one call queued at a time, so the queue holds no
+     * more than the sum of the class limits plus internal work. A
+     * class configured with no limit leaves it unbounded.
+     */
     std::unique_ptr<boost::asio::thread_pool> thread_pool_;
 
     boost::thread_specific_ptr<boost::uuids::random_generator> uuidgen_;
+
+    /**
+     * Admission budgets, indexed by WorkClass. active counts the
+     * requests of that class currently admitted; a limit of zero means
+     * the class is unlimited.
+     */
+    struct AdmissionBudget
+    {
+	std::atomic<int> active{0};
+	int limit{0};
+    };
+    std::array<AdmissionBudget, n_work_classes> budgets_;
+
 public:
+    /**
+     * A request's claim on its class budget, held for the duration
+     * of the request and released on destruction. A default-constructed
+     * (false) Admission means the request was refused.
+     */
+    class Admission
+    {
+	WorkspaceDB *db_;
+	WorkClass work_class_;
+    public:
+	Admission() : db_(nullptr), work_class_(WorkClass::internal) {}
+	Admission(WorkspaceDB *db, WorkClass c) : db_(db), work_class_(c) {}
+	Admission(Admission &&a) : db_(a.db_), work_class_(a.work_class_) { a.db_ = nullptr; }
+	Admission(const Admission &) = delete;
+	Admission &operator=(const Admission &) = delete;
+	~Admission() {
+	    if (db_)
+		db_->budgets_[static_cast<int>(work_class_)].active--;
+	}
+	explicit operator bool() const { return db_ != nullptr; }
+    };
+
     WorkspaceDB(WorkspaceConfig &config)
 	: wslog::LoggerBase("wsdb")
 	, config_(config)
@@ -173,20 +296,40 @@ public:
     }
 
     ~WorkspaceDB() {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "destroy WorkspaceDB";
-	sync_ioc_.stop();
+	WSLOG(lg_, wslog::debug) << "destroy WorkspaceDB";
+	for (auto &shard: sync_shards_)
+	    shard->ioc.stop();
 	
-	BOOST_LOG_SEV(lg_, wslog::debug) << "join sync thread";
-	sync_thread_.join();
-	BOOST_LOG_SEV(lg_, wslog::debug) << "WorkspaceDB done";
+	WSLOG(lg_, wslog::debug) << "join sync threads";
+	for (auto &shard: sync_shards_)
+	    shard->thread.join();
+	WSLOG(lg_, wslog::debug) << "WorkspaceDB done";
     }
 
     bool init_database(const std::string &uri, int threads, const std::string &db_name);
 
-    std::unique_ptr<WorkspaceDBQuery> make_query(const AuthToken &token, bool admin_mode = false);
+    std::unique_ptr<WorkspaceDBQuery> make_query(const AuthToken &token, bool admin_mode = false,
+						 const tracing::Trace &trace = tracing::Trace());
+
+    /**
+     * Admit a request of the given class, or refuse it if its
+     * class is already at its limit. Refusal is immediate; we never
+     * queue a request waiting for admission.
+     */
+    Admission admit(WorkClass c) {
+	auto &b = budgets_[static_cast<int>(c)];
+	int n = ++b.active;
+	if (b.limit > 0 && n > b.limit)
+	{
+	    b.active--;
+	    return Admission();
+	}
+	return Admission(this, c);
+    }
 
     const std::string &db_name() { return db_name_; }
     WorkspaceConfig &config() { return config_; }
+    WorkspaceCache &workspace_cache() { return *workspace_cache_; }
 
     /**
      * Execute the given function in a thread in the thread pool.
@@ -201,37 +344,69 @@ public:
     template<typename Func>
     void run_in_thread(DispatchContext &dc, Func qfunc) {
 	dc.timer.expires_at(boost::posix_time::pos_infin);
+	static metrics::Histogram &queue_time = metrics::Registry::instance()
+	    .histogram("ws_db_queue_seconds", "Time a query waits for a database thread", "pool=\"thread\"");
+	static metrics::Histogram &exec_time = metrics::Registry::instance()
+	    .histogram("ws_db_exec_seconds", "Time a query runs on a database thread", "pool=\"thread\"");
+	auto queued = std::chrono::steady_clock::now();
 	boost::asio::post(*(thread_pool_.get()),
-			  [&dc, qfunc, this]() {
-			      auto q = make_query(dc.token, dc.admin_mode);
-			      qfunc(std::move(q));
+			  [&dc, qfunc, queued, this]() {
+			      auto started = std::chrono::steady_clock::now();
+			      queue_time.observe(started - queued);
+			      dc.trace.record("db_queue", queued, started, "thread");
+			      metrics::ScopedTimer timer(exec_time);
+			      {
+				  tracing::Span span(dc.trace, "db_exec", "thread");
+				  auto q = make_query(dc.token(), dc.admin_mode, dc.trace);
+				  qfunc(std::move(q));
+			      }
 			      dc.timer.cancel_one();
 			  });
 	
 	boost::system::error_code ec({});
 	dc.timer.async_wait(dc.yield[ec]);
 	if (ec != boost::asio::error::operation_aborted)
-	    BOOST_LOG_SEV(lg_, wslog::error) << "async_wait: " << ec.message() << "\n";
+	    WSLOG(lg_, wslog::error) << "async_wait: " << ec.message() << "\n";
 
     }
     /**
-     * Same as  \ref run_in_thread, except we run in the single sync
-     * thread. Used for serializing metadata operations.
+     * Same as  \ref run_in_thread, except we run serialized with the
+     * other operations on the workspaces of paths (see SyncShard). Used
+     * for serializing metadata operations. paths are paths as given by
+     * the client; only their owner and workspace name are used.
      */
     template<typename Func>
-    void run_in_sync_thread(DispatchContext &dc, Func qfunc) {
+    void run_in_sync_thread(DispatchContext &dc, const std::vector<std::string> &paths, Func qfunc) {
 	dc.timer.expires_at(boost::posix_time::pos_infin);
-	boost::asio::post(sync_ioc_,
-			  [&dc, qfunc, this]() {
-			      auto q = make_query(dc.token, dc.admin_mode);
-			      qfunc(std::move(q));
+	static metrics::Histogram &queue_time = metrics::Registry::instance()
+	    .histogram("ws_db_queue_seconds", "Time a query waits for a database thread", "pool=\"sync\"");
+	static metrics::Histogram &exec_time = metrics::Registry::instance()
+	    .histogram("ws_db_exec_seconds", "Time a query runs on a database thread", "pool=\"sync\"");
+	auto queued = std::chrono::steady_clock::now();
+	std::vector<size_t> shards = sync_shards_for(paths);
+	boost::asio::post(sync_shards_[shards.front()]->ioc,
+			  [&dc, qfunc, queued, shards, this]() {
+			      std::vector<std::unique_lock<std::mutex>> locks;
+			      locks.reserve(shards.size());
+			      for (size_t s: shards)
+				  locks.emplace_back(sync_shards_[s]->mtx);
+			      auto started = std::chrono::steady_clock::now();
+			      queue_time.observe(started - queued);
+			      dc.trace.record("db_queue", queued, started, "sync");
+			      metrics::ScopedTimer timer(exec_time);
+			      {
+				  tracing::Span span(dc.trace, "db_exec", "sync");
+				  auto q = make_query(dc.token(), dc.admin_mode, dc.trace);
+				  qfunc(std::move(q));
+			      }
+			      locks.clear();
 			      dc.timer.cancel_one();
 			  });
 	
 	boost::system::error_code ec({});
 	dc.timer.async_wait(dc.yield[ec]);
 	if (ec != boost::asio::error::operation_aborted)
-	    BOOST_LOG_SEV(lg_, wslog::error) << "async_wait: " << ec.message() << "\n";
+	    WSLOG(lg_, wslog::error) << "async_wait: " << ec.message() << "\n";
 
     }
 
@@ -240,7 +415,7 @@ public:
 	if (gen == 0)
 	{
 	    gen = new boost::uuids::random_generator();
-	    std::cerr << "creating new uuidgen " << gen << " in thread " << std::this_thread::get_id() << "\n";
+	    WSLOG(lg_, wslog::debug) << "creating new uuidgen " << gen << " in thread " << std::this_thread::get_id() << "\n";
 	    uuidgen_.reset(gen);
 	}
 	return gen;
@@ -0,0 +1,160 @@
+#include "WorkspaceSchema.h"
+#include "WorkspaceTypes.h"
+
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
+#include <mongocxx/collection.hpp>
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+namespace builder = bsoncxx::builder;
+
+namespace {
+    template <typename Path>
+    bsoncxx::document::value branch(const std::string &ws_uuid, Path &&path, bsoncxx::document::view extra)
+    {
+	return make_document(kvp("workspace_uuid", ws_uuid),
+			     kvp("path", std::forward<Path>(path)),
+			     builder::concatenate(extra));
+    }
+
+    /*
+     * The objects in the same folder as after that follow it.
+     */
+    bsoncxx::document::value rest_of_folder(const std::string &ws_uuid, const ObjectKey &after,
+					    bsoncxx::document::view extra)
+    {
+	return make_document(kvp("workspace_uuid", ws_uuid),
+			     kvp("path", after.path),
+			     kvp("name", make_document(kvp("$gt", after.name))),
+			     builder::concatenate(extra));
+    }
+}
+
+bsoncxx::document::value schema::subtree_query(const std::string &ws_uuid, const std::string &folder,
+					       bsoncxx::document::view extra, const ObjectKey *after)
+{
+    // Callers reject such keys; we at least never list outside folder.
+    if (after && !key_in_subtree(folder, *after))
+	after = nullptr;
+
+    if (folder.empty() && !after)
+	return make_document(kvp("workspace_uuid", ws_uuid),
+			     builder::concatenate(extra));
+
+    /*
+     * Each branch of the $or carries the workspace so that each is
+     * planned as its own index scan. The first covers the folder that
+     * the listing is in, the second the paths below it.
+     */
+    builder::basic::array branches;
+    builder::basic::document range;
+    if (after && after->path != folder)
+    {
+	branches.append(rest_of_folder(ws_uuid, *after, extra));
+	range.append(kvp("$gt", after->path));
+    }
+    else
+    {
+	if (after)
+	    branches.append(rest_of_folder(ws_uuid, *after, extra));
+	else
+	    branches.append(branch(ws_uuid, folder, extra));
+	// Paths below the workspace root have no leading slash.
+	if (folder.empty())
+	    range.append(kvp("$gt", ""));
+	else
+	    range.append(kvp("$gte", folder + "/"));
+    }
+    if (!folder.empty())
+	range.append(kvp("$lt", folder + "0"));
+    branches.append(branch(ws_uuid, range.extract(), extra));
+
+    return make_document(kvp("$or", branches.extract()));
+}
+
+bool schema::key_in_subtree(const std::string &folder, const ObjectKey &key)
+{
+    return folder.empty() || key.path == folder ||
+	(key.path.size() > folder.size() && key.path.compare(0, folder.size(), folder) == 0 &&
+	 key.path[folder.size()] == '/');
+}
+
+bsoncxx::document::value schema::folder_query(const std::string &ws_uuid, const std::string &folder,
+					      bsoncxx::document::view extra, const ObjectKey *after)
+{
+    if (after && after->path == folder)
+	return rest_of_folder(ws_uuid, *after, extra);
+    return branch(ws_uuid, folder, extra);
+}
+
+bsoncxx::document::value schema::below_query(const std::string &ws_uuid, const std::string &folder)
+{
+    return branch(ws_uuid, make_document(kvp("$gte", folder + "/"), kvp("$lt", folder + "0")),
+		  bsoncxx::document::view());
+}
+
+mongocxx::pipeline schema::rebase_paths(const std::string &folder, const std::string &new_folder,
+					const std::string &new_ws_uuid)
+{
+    using builder::basic::make_array;
+
+    std::string prefix = new_folder.empty() ? "" : new_folder + "/";
+    int32_t skip = static_cast<int32_t>(folder.size() + 1);
+
+    // A negative length takes the rest of the string.
+    auto rest = make_document(kvp("$substrBytes", make_array("$path", skip, -1)));
+
+    mongocxx::pipeline p;
+    p.add_fields(make_document(kvp("workspace_uuid", new_ws_uuid),
+			       kvp("path", make_document(kvp("$concat", make_array(
+							     make_document(kvp("$literal", prefix)), std::move(rest)))))));
+    return p;
+}
+
+bsoncxx::document::value schema::listing_order()
+{
+    return make_document(kvp("path", 1), kvp("name", 1));
+}
+
+std::string schema::canonical_path(const std::string &path)
+{
+    std::string res;
+    res.reserve(path.size());
+    for (char c: path)
+    {
+	if (c == '/' && (res.empty() || res.back() == '/'))
+	    continue;
+	res += c;
+    }
+    if (!res.empty() && res.back() == '/')
+	res.pop_back();
+    return res;
+}
+
+namespace {
+    void create_index(mongocxx::collection coll, const char *name, bsoncxx::document::view keys)
+    {
+	coll.create_index(keys, make_document(kvp("name", name)));
+    }
+}
+
+void schema::create_indexes(mongocxx::database db)
+{
+    auto workspaces = db["workspaces"];
+    create_index(workspaces, "owner_name", make_document(kvp("owner", 1), kvp("name", 1)));
+    create_index(workspaces, "uuid", make_document(kvp("uuid", 1)));
+
+    // Subtree queries, folder listings and path lookups.
+    auto objects = db["objects"];
+    create_index(objects, "workspace_path_name",
+		 make_document(kvp("workspace_uuid", 1), kvp("path", 1), kvp("name", 1)));
+    create_index(objects, "uuid", make_document(kvp("uuid", 1)));
+    // Last-user-out checks before a Shock node is deleted.
+    create_index(objects, "shocknode", make_document(kvp("shocknode", 1)));
+
+    auto downloads = db["downloads"];
+    create_index(downloads, "download_key", make_document(kvp("download_key", 1)));
+}
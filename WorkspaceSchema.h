@@ -0,0 +1,96 @@
+#ifndef _WorkspaceSchema_h
+#define _WorkspaceSchema_h
+
+/*
+ * Layout of the workspace collections: the indexes our queries rely on,
+ * and how object paths are stored.
+ *
+ * An object's path is the full path of its parent folder relative to
+ * the workspace, with no leading, trailing or doubled slashes; an
+ * object at the top of the workspace has an empty path. With paths in
+ * that form the contents of folder F (at any depth) are the objects
+ * whose path is F or begins with "F/". Since '0' is the character after
+ * '/', the latter is the range ["F/", "F0"), so a subtree query is two
+ * range scans of the (workspace_uuid, path, name) index, with nothing
+ * in F needing to be escaped.
+ *
+ * For the same reason moving folder F is a fixed number of updates
+ * however much it holds: its own document, the objects whose path is
+ * F, and the range below F, whose paths are rewritten on the server.
+ *
+ * Listings are ordered by (path, name), which is unique within a
+ * workspace, so a listing can be resumed from the last key returned
+ * with a keyset query rather than by skipping.
+ *
+ * ws-migrate rewrites existing documents into this form and builds the
+ * indexes.
+ */
+
+#include <string>
+
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <mongocxx/database.hpp>
+#include <mongocxx/pipeline.hpp>
+
+struct ObjectKey;
+
+namespace schema {
+
+    /*
+     * Query for the objects in workspace ws_uuid that are inside folder
+     * (the folder's full path; empty for the whole workspace) and match
+     * the further conditions in extra. If after is given only objects
+     * that follow it in listing order are matched.
+     */
+    bsoncxx::document::value subtree_query(const std::string &ws_uuid, const std::string &folder,
+					   bsoncxx::document::view extra = bsoncxx::document::view(),
+					   const ObjectKey *after = nullptr);
+
+    /*
+     * Whether key can be that of an object inside folder, as a
+     * continuation of a listing of it must be.
+     */
+    bool key_in_subtree(const std::string &folder, const ObjectKey &key);
+
+    /*
+     * As subtree_query, for the objects directly in folder.
+     */
+    bsoncxx::document::value folder_query(const std::string &ws_uuid, const std::string &folder,
+					  bsoncxx::document::view extra = bsoncxx::document::view(),
+					  const ObjectKey *after = nullptr);
+
+    /*
+     * Query for the objects in workspace ws_uuid below the top level of
+     * folder, which must not be empty: those whose path begins with
+     * "folder/".
+     */
+    bsoncxx::document::value below_query(const std::string &ws_uuid, const std::string &folder);
+
+    /*
+     * Update for the objects matched by below_query(folder) that moves
+     * them to the same place below new_folder in workspace new_ws_uuid,
+     * rewriting "folder/rest" to "new_folder/rest" on the server.
+     */
+    mongocxx::pipeline rebase_paths(const std::string &folder, const std::string &new_folder,
+				    const std::string &new_ws_uuid);
+
+    /*
+     * Sort specification for listing order. Sorted queries built by
+     * the functions above are answered in index order.
+     */
+    bsoncxx::document::value listing_order();
+
+    /*
+     * path in stored form.
+     */
+    std::string canonical_path(const std::string &path);
+
+    /*
+     * Create the indexes on the workspaces, objects and downloads
+     * collections. Indexes that already exist are left alone.
+     */
+    void create_indexes(mongocxx::database db);
+}
+
+#endif
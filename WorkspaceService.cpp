@@ -1,7 +1,9 @@
 #include "WorkspaceService.h"
 #include "WorkspaceDB.h"
+#include "WorkspaceSchema.h"
 #include "WorkspaceConfig.h"
 #include "WorkspaceState.h"
+#include "Base64.h"
 
 #include <experimental/map>
 
@@ -50,6 +52,54 @@ bool object_at_as_bool(const json::object &obj, const json::string &key,
     }
 }
 
+int64_t object_at_as_int(const json::object &obj, const json::string &key,
+			 int64_t default_value = 0)
+{
+    auto iter = obj.find(key);
+    if (iter == obj.end())
+	return default_value;
+
+    auto &val = iter->value();
+    switch (val.kind())
+    {
+    case json::kind::int64:
+	return val.as_int64();
+
+    case json::kind::uint64:
+	return static_cast<int64_t>(val.as_uint64());
+
+    default:
+	throw std::invalid_argument("not convertible to integer");
+    }
+}
+
+/*
+ * ls continuation tokens carry the key of the last object returned. They
+ * are opaque to clients; the version lets us change the encoding.
+ */
+static const char ls_token_version[] = "1";
+
+std::string encode_ls_token(const ObjectKey &key)
+{
+    std::string raw(ls_token_version);
+    raw += '\0';
+    raw += key.path;
+    raw += '\0';
+    raw += key.name;
+    return base64EncodeText(raw);
+}
+
+ObjectKey decode_ls_token(const std::string &token)
+{
+    std::string raw = base64DecodeText(token);
+    size_t p1 = raw.find('\0');
+    size_t p2 = p1 == std::string::npos ? p1 : raw.find('\0', p1 + 1);
+    if (p2 == std::string::npos || raw.compare(0, p1, ls_token_version) != 0 ||
+	raw.find('\0', p2 + 1) != std::string::npos)
+	throw std::invalid_argument("invalid continuation token");
+    return ObjectKey{raw.substr(p1 + 1, p2 - p1 - 1), raw.substr(p2 + 1)};
+}
+
 std::string object_at_as_string(const json::object &obj, const json::string &key,
 				const std::string &default_value = "")
 {
@@ -83,7 +133,7 @@ std::string object_at_as_string(const json::object &obj, const json::string &key
  */
 static void push_error_meta(json::array &output, const std::string &err)
 {
-    output.emplace_back(ObjectMeta(ObjectMeta::errorMeta, err).serialize());
+    output.emplace_back(ObjectMeta(ObjectMeta::errorMeta, err).serialize(output.storage()));
 }
 
 WorkspaceService::WorkspaceService(boost::asio::io_context &ioc, boost::asio::ssl::context &ssl_ctx,
@@ -95,7 +145,9 @@ WorkspaceService::WorkspaceService(boost::asio::io_context &ioc, boost::asio::ss
     , ssl_ctx_(ssl_ctx)
     , shock_ioc_{}
     , timer_(shock_ioc_)
-    , shock_(shock_ioc_, ssl_ctx, state.config().shock_server()) {
+    , shock_(shock_ioc_, ssl_ctx, state.config().shock_server())
+    , file_pool_(std::max(1, state.config().file_io_threads()))
+    , reclaimer_(db, state, state.config().reclaim_threads(), state.config().shock_delete_concurrency()) {
     
     init_dispatch();
 
@@ -107,12 +159,12 @@ WorkspaceService::WorkspaceService(boost::asio::io_context &ioc, boost::asio::ss
      */
 
     shock_thread_ = std::thread([this]() {
-	std::cerr << "starting WS shock thread " << std::this_thread::get_id() << "\n";
+	WSLOG(lg_, wslog::debug) << "starting WS shock thread " << std::this_thread::get_id() << "\n";
 	net::executor_work_guard<net::io_context::executor_type> guard
 	    = net::make_work_guard(shock_ioc_);
 	shock_ioc_.run(); 
 
-	std::cerr << "exiting shock thread " << std::this_thread::get_id() << "\n";
+	WSLOG(lg_, wslog::debug) << "exiting shock thread " << std::this_thread::get_id() << "\n";
     });
 
     /*
@@ -131,7 +183,7 @@ void WorkspaceService::run_timer(boost::asio::yield_context yield)
 
     if (ec)
     {
-	std::cerr << "expires_from_now failed: " << ec.message() << "\n";
+	WSLOG(lg_, wslog::error) << "expires_from_now failed: " << ec.message() << "\n";
 	return;
     }
     while (1)
@@ -139,7 +191,7 @@ void WorkspaceService::run_timer(boost::asio::yield_context yield)
 	timer_.async_wait(yield[ec]);
 	if (ec)
 	{
-	    std::cerr << "wait failed: " << ec.message() << "\n";
+	    WSLOG(lg_, wslog::error) << "wait failed: " << ec.message() << "\n";
 	    return;
 	}
 	int n_updated = 0;
@@ -152,37 +204,39 @@ void WorkspaceService::run_timer(boost::asio::yield_context yield)
 
 	/*
 	 * If we have any updated, hand them to the database to
-	 * update the size.
+	 * update the size. Each update sets one field of one object, so
+	 * it needs no ordering with other writes to its workspace.
 	 * We create a DispatchContext here using the local shock io_context.
 	 */
 	if (n_updated > 0)
 	{
-	    DispatchContext dc{yield, shock_ioc_, AuthToken(), lg_};
-	    db_.run_in_sync_thread(dc,
-				   [this, &dc]
-				   (std::unique_ptr<WorkspaceDBQuery> qobj_ptr) 
-				       {
-					   WorkspaceDBQuery &qobj = *qobj_ptr;
+	    DispatchContext dc{yield, shock_ioc_, nullptr, lg_};
+	    db_.run_in_thread(dc,
+			      [this, &dc]
+			      (std::unique_ptr<WorkspaceDBQuery> qobj_ptr) 
+				  {
+				      WorkspaceDBQuery &qobj = *qobj_ptr;
 
-					   for (auto iter = pending_uploads_.begin(); iter != pending_uploads_.end(); ++iter)
-					   {
-					       auto &up = iter->second;
-					       if (up.updated())
-					       {
-						   qobj.set_object_size(up.object_id(), up.size());
-					       }
-					   }
-				       });
+				      for (auto iter = pending_uploads_.begin(); iter != pending_uploads_.end(); ++iter)
+				      {
+					  auto &up = iter->second;
+					  if (up.updated())
+					  {
+					      qobj.set_object_size(up.object_id(), up.size());
+					  }
+				      }
+				  });
 
 	    // And erase the updated entries.
 	    std::experimental::erase_if(pending_uploads_, [](const auto& item) {
 		return item.second.updated();
 	    });
 	}
+	metrics::pending_uploads().set(pending_uploads_.size());
 	
 	timer_.expires_from_now(boost::posix_time::seconds(5), ec);
 	if (ec) {
-	    std::cerr << "expires_from_now failed: " << ec.message() << "\n";
+	    WSLOG(lg_, wslog::error) << "expires_from_now failed: " << ec.message() << "\n";
 	    return;
 	}
     }
@@ -190,9 +244,9 @@ void WorkspaceService::run_timer(boost::asio::yield_context yield)
 
 void WorkspaceService::check_pending_upload(PendingUpload &p, net::yield_context yield)
 {
-    std::cerr << "Checking pending " << p << "\n";
+    WSLOG(lg_, wslog::debug) << "Checking pending " << p << "\n";
     json::object node = shock_.get_node(p.auth_token(), p.shock_url(), yield);
-    std::cerr << "shock got " << node << "\n";
+    WSLOG(lg_, wslog::debug) << "shock got " << node << "\n";
 
     try {
 	auto file = node["file"].as_object();
@@ -204,18 +258,18 @@ void WorkspaceService::check_pending_upload(PendingUpload &p, net::yield_context
 	    // If there is a checksum, the file was uploaded.
 	    // Need to check here in case the file is a zero-length file.
 	    p.set_size(size);
-	    std::cerr << "found checksum " << iter->value().as_string() << "\n";
+	    WSLOG(lg_, wslog::debug) << "found checksum " << iter->value().as_string() << "\n";
 	}
     } catch (std::invalid_argument e) {
-	std::cerr << "error extracting node id: " << e.what() << "\n";
+	WSLOG(lg_, wslog::error) << "error extracting node id: " << e.what() << "\n";
     }
-    std::cerr << "Done checking pending " << p << "\n";
+    WSLOG(lg_, wslog::debug) << "Done checking pending " << p << "\n";
 }
 
 void WorkspaceService::dispatch(const JsonRpcRequest &req, JsonRpcResponse &resp,
 				DispatchContext &dc, int &http_code)
 {
-    BOOST_LOG_SEV(lg_, wslog::debug) << "ws dispatching " << req << "\n";
+    WSLOG(lg_, wslog::debug) << "ws dispatching " << req << "\n";
     auto x = method_map_.find(req.method());
     if (x == method_map_.end())
     {
@@ -224,6 +278,21 @@ void WorkspaceService::dispatch(const JsonRpcRequest &req, JsonRpcResponse &resp
 	return;
     }
     Method &method = x->second;
+
+    /*
+     * Admission control. If this method's class is at its limit
+     * refuse the request now, before doing any work for it; the
+     * HTTP layer turns the 503 into a Retry-After response.
+     */
+    auto admission = db_.admit(method.work_class);
+    if (!admission)
+    {
+	WSLOG(lg_, wslog::notification) << "Overloaded, refusing " << req.method();
+	resp.set_error(-32000, "Service overloaded; retry later");
+	http_code = 503;
+	return;
+    }
+    metrics::ScopedTimer timer(*method.duration);
     
     /*
      * Manage auth.
@@ -232,7 +301,7 @@ void WorkspaceService::dispatch(const JsonRpcRequest &req, JsonRpcResponse &resp
      */
     if (method.auth == Authentication::none)
     {
-	dc.token.clear();
+	dc.clear_token();
     }
     else
     {
@@ -240,13 +309,15 @@ void WorkspaceService::dispatch(const JsonRpcRequest &req, JsonRpcResponse &resp
 	// If it does not validate, clear it.
 	bool valid;
 	try {
-	    valid = shared_state_.validate_certificate(dc.token);
+	    tracing::Span span(dc.trace, "validate_token");
+	    dc.parse_token();
+	    valid = shared_state_.validate_certificate(dc.token());
 	} catch (std::exception e) {
-	    BOOST_LOG_SEV(lg_, wslog::error) << "exception validating token: " << e.what() << "\n";
+	    WSLOG(lg_, wslog::error) << "exception validating token: " << e.what() << "\n";
 	    valid = false;
 	}
 	if (!valid)
-	    dc.token.clear();
+	    dc.clear_token();
 	
 	if (method.auth == Authentication::required && !valid)
 	{
@@ -257,27 +328,28 @@ void WorkspaceService::dispatch(const JsonRpcRequest &req, JsonRpcResponse &resp
 	}
     }
     
-    BOOST_LOG_SEV(lg_, wslog::notification) << "Dispatch: " << req;
+    WSLOG(lg_, wslog::notification) << "Dispatch: " << req;
+    tracing::Span span(dc.trace, "method", x->first.c_str());
     (this->*(method.method))(req, resp, dc, http_code);
 }
 
 void WorkspaceService::method_create(const JsonRpcRequest &req, JsonRpcResponse &resp,
 				     DispatchContext &dc, int &http_code)
 {
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
     std::string permission, owner;
     auto &cfg = shared_state_.config();
     bool createUploadNodes, downloadFromLinks, overwrite;
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
 	createUploadNodes = object_at_as_bool(input, "createUploadNodes");
 	downloadFromLinks = object_at_as_bool(input, "downloadFromLinks");
 	overwrite = object_at_as_bool(input, "overwrite");
 	permission = object_at_as_string(input, "permission", "n");
 	
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = cfg.user_is_admin(dc.token.user());
+	    dc.admin_mode = cfg.user_is_admin(dc.token().user().to_string());
 
 	/*
 	 * Determine owner of new objects. If we have setowner passed in,
@@ -293,7 +365,7 @@ void WorkspaceService::method_create(const JsonRpcRequest &req, JsonRpcResponse
 	{
 	    if (!dc.admin_mode)
 	    {
-		BOOST_LOG_SEV(dc.lg_, wslog::debug) << "setowner without admin mode";
+		WSLOG(dc.lg_, wslog::debug) << "setowner without admin mode";
 		resp.set_error(-32602, "Setowner requested without valid admin");
 		http_code = 500;
 		return;
@@ -302,31 +374,32 @@ void WorkspaceService::method_create(const JsonRpcRequest &req, JsonRpcResponse
 	}
 	else
 	{
-	    owner = dc.token.user();
+	    owner = dc.token().user().to_string();
 	}
 		
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
     std::vector<ObjectToCreate> to_create;
     // Validate format of paths before doing any work
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
 	try {
 	    ObjectToCreate tc{obj};
 	    std::string canon;
 	    if (!cfg.is_valid_type(tc.type, canon))
 	    {
-		BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Invalid type requested " << tc.type;
+		WSLOG(dc.lg_, wslog::debug) << "Invalid type requested " << tc.type;
 		resp.set_error(-32602, "Invalid object type requested");
 		http_code = 500;
 		return;
@@ -348,7 +421,7 @@ void WorkspaceService::method_create(const JsonRpcRequest &req, JsonRpcResponse
 
 	    to_create.emplace_back(tc);
 	} catch (std::exception e) {
-	    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	    WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	    resp.set_error(-32602, "Invalid request parameters");
 	    http_code = 500;
 	    return;
@@ -362,27 +435,25 @@ void WorkspaceService::method_create(const JsonRpcRequest &req, JsonRpcResponse
 
     
     RemovalRequest remreq;
+    std::vector<std::string> paths;
+    for (auto &tc: to_create)
+	paths.push_back(tc.path);
 
-    json::array output;
-    db_.run_in_sync_thread(dc,
+    json::array output(resp.storage());
+    db_.run_in_sync_thread(dc, paths,
 			   [this, &dc, &permission,
 			    createUploadNodes, downloadFromLinks, &owner, overwrite,
 			    &remreq, &to_create, &output]
 			   (std::unique_ptr<WorkspaceDBQuery> qobj_ptr) 
 			       {
-				   WorkspaceDBQuery &qobj = *qobj_ptr;
-				   for (auto tc: to_create)
-				   {
-				       json::value val;
-				       process_create(qobj, dc, tc, val,
-						      permission, createUploadNodes, downloadFromLinks, overwrite, owner, remreq);
-				       output.emplace_back(val);
-				   }
+				   process_create_batch(*qobj_ptr, dc, to_create, output,
+							permission, createUploadNodes, downloadFromLinks, overwrite, owner, remreq);
 			       });
 
-    std::cerr << "To remove after create: " << remreq;
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "To remove after create: " << remreq;
+    reclaimer_.submit(std::move(remreq));
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 }
 
 /** 
@@ -398,13 +469,13 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 				      const std::string &permission, bool createUploadNodes, bool downloadFromLinks,
 				      bool overwrite, const std::string &owner, RemovalRequest &remreq)
 {
-    std::cerr << "Create: " << to_create << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "Create: " << to_create << "\n";
     to_create.parsed_path = qobj.parse_path(to_create.path);
-    std::cerr << "Parsed: " << to_create.parsed_path << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "Parsed: " << to_create.parsed_path << "\n";
 
     // Check the parsed path to see if the workspace is valid.
 
-    std::cerr << "process create running in thread " << std::this_thread::get_id() << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "process create running in thread " << std::this_thread::get_id() << "\n";
 
     WSWorkspace &ws = to_create.parsed_path.workspace;
 
@@ -412,39 +483,39 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
     if (ws.name.empty() || ws.owner.empty())
     {
 	// WS has to be named.
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "no workspace name";
+	WSLOG(dc.lg_, wslog::debug) << "no workspace name";
 	auto &a = ret_value.emplace_array();
 	a = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "no workspace name" };
-	std::cerr << "created err " << ret_value << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "created err " << ret_value << "\n";
 	return;
     }
     if (ws.uuid.empty())
     {
 	// Workspace does not exist; check permissions for creation
 
-	if (ws.owner != dc.token.user() && !dc.admin_mode)
+	if (ws.owner != dc.token().user() && !dc.admin_mode)
 	{
 	    // Can't create WS owned by other user
-	    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "WS owned by other user";
+	    WSLOG(dc.lg_, wslog::debug) << "WS owned by other user";
 	    ret_value.emplace_array();
 	    return;
 	}
 	else if (!is_folder(to_create.type))
 	{
-	    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "WS creation has to be of folder type";
+	    WSLOG(dc.lg_, wslog::debug) << "WS creation has to be of folder type";
 	    ret_value.emplace_array();
 	    return;
 	}
 	else if (!ws.has_valid_name())
 	{
-	    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "WS has invalid name";
+	    WSLOG(dc.lg_, wslog::debug) << "WS has invalid name";
 	    ret_value.emplace_array();
 	    return;
 	}
 	std::string ws_uuid = qobj.create_workspace(to_create);
 	if (ws_uuid.empty())
 	{
-	    BOOST_LOG_SEV(dc.lg_, wslog::error) << "Error creating workspace";
+	    WSLOG(dc.lg_, wslog::error) << "Error creating workspace";
 	    ret_value.emplace_array();
 	    return;
 	}
@@ -455,7 +526,7 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
     // If we are just requesting the creation of a workspace, we are done.
     if (to_create.parsed_path.is_workspace_path())
     {
-	ret_value = qobj.lookup_object_meta(to_create.parsed_path).serialize();
+	ret_value = qobj.lookup_object_meta(to_create.parsed_path).serialize(ret_value.storage());
 	return;
     }
 
@@ -463,21 +534,21 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 	
     if (!qobj.user_has_permission(ws, WSPermission::write))
     {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "permission denied on create";
+	WSLOG(dc.lg_, wslog::debug) << "permission denied on create";
 	ret_value.emplace_array();
 	return;
     }
     if (!to_create.parsed_path.has_valid_name())
     {
 	// Check, but this shouldn't be possible due to the parsing rules.
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Name has invalid characters";
+	WSLOG(dc.lg_, wslog::debug) << "Name has invalid characters";
 	ret_value.emplace_array();
 	return;
     }
 
     // Look up object to check for overwrite.
     ObjectMeta meta = qobj.lookup_object_meta(to_create.parsed_path);
-    std::cerr << "existing obj: " << meta << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "existing obj: " << meta << "\n";
 
     bool overwriteObject = false;
 
@@ -495,12 +566,12 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 	    if (to_create.type == "folder" || to_create.type == "model_folder")
 	    {
 		// Just return data.
-		ret_value = meta.serialize();
+		ret_value = meta.serialize(ret_value.storage());
 		return;
 	    }
 	    else
 	    {
-		BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Cannot overwrite folder with object";
+		WSLOG(dc.lg_, wslog::debug) << "Cannot overwrite folder with object";
 		ret_value.emplace_array();
 		return;
 	    }
@@ -509,7 +580,7 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 	{
 	    if (to_create.type == "folder" || to_create.type == "model_folder")
 	    {
-		BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Cannot overwrite object with folder";
+		WSLOG(dc.lg_, wslog::debug) << "Cannot overwrite object with folder";
 		ret_value.emplace_array();
 		return;
 	    }
@@ -517,7 +588,7 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 
 	if (!overwrite)
 	{
-	    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Object exists but overwrite was not specified";
+	    WSLOG(dc.lg_, wslog::debug) << "Object exists but overwrite was not specified";
 	    ret_value.emplace_array();
 	    return;
 	}
@@ -532,7 +603,7 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 	 * already exist.
 	 */
 
-	std::cerr << "check for intermediates: " << to_create << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "check for intermediates: " << to_create << "\n";
 	
 	std::vector<std::string> path_comps = to_create.path_components();
 	WSPath qpath(to_create.parsed_path);
@@ -551,7 +622,7 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 		 */
 		if (!pmeta.is_folder())
 		{
-		    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Intermediate path object is not a folder";
+		    WSLOG(dc.lg_, wslog::debug) << "Intermediate path object is not a folder";
 		    ret_value.emplace_array();
 		    return;
 		}
@@ -580,43 +651,9 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
 
     if (createUploadNodes)
     {
-	/*
-	 * We spawn a coroutine to perform the Shock operations
-	 */
-
-	boost::system::error_code ec;
-	net::io_context &ioc = shared_state_.ioc();
-	
-	/*
-	 * We use a mutex to block the calling thread until the asyncronous operations all complete.
-	 */
-	std::mutex lock;
-	lock.lock();
-	std::string node_id;
-	boost::asio::spawn(ioc, [&node_id, &dc, &lock, &to_create, this] (net::yield_context yield)
-	    {
-		// Get the auth token for the owner of the Shock nodes if needed.
-		AuthToken &token = shared_state_.ws_auth(yield);
-		
-		node_id = shared_state_.shock().create_node(token, to_create.uuid, yield);
-		std::cerr << "created node " << node_id << "\n";
-		if (node_id.empty())
-		{
-		    lock.unlock();
-		    return;
-		}
-		to_create.shock_node = shared_state_.config().shock_server() + "/node/" + node_id;
-		shared_state_.shock().acl_add_user(to_create.shock_node, token, dc.token.user(), yield);
-		boost::asio::post(shock_ioc_, [&lock, this, to_create, dtoken = dc.token ] () {
-		    pending_uploads_.emplace(std::make_pair(to_create.uuid, PendingUpload{to_create.uuid, to_create.shock_node, dtoken}));
-		    lock.unlock();
-		});
-	    });
-	lock.lock();
-	lock.unlock();
-	if (node_id.empty())
+	if (!create_upload_node(dc, to_create))
 	{
-	    BOOST_LOG_SEV(dc.lg_, wslog::error) << "Error creating shock node";
+	    WSLOG(dc.lg_, wslog::error) << "Error creating shock node";
 	    ret_value.emplace_array();
 	    return;
 	}
@@ -636,46 +673,346 @@ void WorkspaceService::process_create(WorkspaceDBQuery & qobj, DispatchContext &
     for (auto int_obj: intermediates)
     {
 	ObjectMeta int_meta = qobj.create_workspace_object(int_obj, owner);
-	std::cerr << "Created intermediate " << int_meta << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "Created intermediate " << int_meta << "\n";
     }
 	    
     ObjectMeta created = qobj.create_workspace_object(to_create, owner);
-    ret_value = created.serialize();
+    ret_value = created.serialize(ret_value.storage());
     return;
 }
 
+/**
+ * Handle the creation of a batch of objects.
+ *
+ * The checks are those of process_create, but made for the whole batch
+ * at once: one query for the workspaces, one for the objects being
+ * created, and one for every folder along their paths. Missing
+ * intermediate folders are created once however many objects need them,
+ * and everything is inserted with a single ordered insert whose
+ * documents give us the metadata to return.
+ *
+ * A batch that creates a workspace or names the same path twice depends
+ * on the results of its earlier entries, so we create those one object
+ * at a time with process_create.
+ */
+void WorkspaceService::process_create_batch(WorkspaceDBQuery &qobj, DispatchContext &dc,
+					    std::vector<ObjectToCreate> &to_create, json::array &output,
+					    const std::string &permission, bool createUploadNodes, bool downloadFromLinks,
+					    bool overwrite, const std::string &owner, RemovalRequest &remreq)
+{
+    // Objects are identified by workspace uuid and full path.
+    typedef std::pair<std::string, std::string> Key;
+    auto key_of = [](const WSPath &p) { return Key(p.workspace.uuid, p.full_path()); };
+
+    std::vector<std::string> path_strs;
+    path_strs.reserve(to_create.size());
+    for (auto &tc: to_create)
+	path_strs.push_back(tc.path);
+    std::vector<WSPath> parsed = qobj.parse_paths(path_strs);
+
+    std::map<Key, size_t> batch_index;
+    bool sequential = to_create.size() < 2;
+    for (size_t i = 0; i < parsed.size() && !sequential; i++)
+    {
+	const WSPath &p = parsed[i];
+	if (p.workspace.uuid.empty() || p.is_workspace_path() || !batch_index.emplace(key_of(p), i).second)
+	    sequential = true;
+    }
+    if (sequential)
+    {
+	for (auto tc: to_create)
+	{
+	    json::value val(output.storage());
+	    process_create(qobj, dc, tc, val,
+			   permission, createUploadNodes, downloadFromLinks, overwrite, owner, remreq);
+	    output.emplace_back(std::move(val));
+	}
+	return;
+    }
+
+    size_t n = to_create.size();
+    for (size_t i = 0; i < n; i++)
+	to_create[i].parsed_path = parsed[i];
+
+    // Existing objects at the paths we are creating.
+    std::vector<ObjectMeta> existing = qobj.lookup_object_metas(parsed);
+
+    // Every folder along the paths, each looked up once.
+    std::map<Key, size_t> ancestor_index;
+    std::vector<WSPath> ancestors;
+    for (auto &tc: to_create)
+    {
+	WSPath qpath(tc.parsed_path);
+	qpath.path = "";
+	for (auto &comp: tc.path_components())
+	{
+	    if (comp.empty())
+		continue;
+	    qpath.name = comp;
+	    if (ancestor_index.emplace(key_of(qpath), ancestors.size()).second)
+		ancestors.push_back(qpath);
+	    if (!qpath.path.empty())
+		qpath.path += "/";
+	    qpath.path += qpath.name;
+	}
+    }
+    std::vector<ObjectMeta> ancestor_metas = qobj.lookup_object_metas(ancestors);
+
+    for (size_t i = 0; i < n; i++)
+	output.emplace_back(nullptr);
+
+    /*
+     * Validate each object, collecting the objects to insert and the
+     * intermediate folders they need.
+     */
+    std::vector<bool> create(n, false);
+    std::map<Key, ObjectToCreate> intermediates;
+    for (size_t i = 0; i < n; i++)
+    {
+	ObjectToCreate &tc = to_create[i];
+	json::value &ret_value = output[i];
+	WSLOG(dc.lg_, wslog::debug) << "Create: " << tc << "\n";
+
+	if (!qobj.user_has_permission(tc.parsed_path.workspace, WSPermission::write))
+	{
+	    WSLOG(dc.lg_, wslog::debug) << "permission denied on create";
+	    ret_value.emplace_array();
+	    continue;
+	}
+	if (!tc.parsed_path.has_valid_name())
+	{
+	    WSLOG(dc.lg_, wslog::debug) << "Name has invalid characters";
+	    ret_value.emplace_array();
+	    continue;
+	}
+
+	ObjectMeta &meta = existing[i];
+	std::vector<ObjectToCreate> needed;
+	if (meta.valid)
+	{
+	    if (meta.is_folder() && is_folder(tc.type))
+	    {
+		ret_value = meta.serialize(ret_value.storage());
+		continue;
+	    }
+	    if (meta.is_folder() || is_folder(tc.type))
+	    {
+		WSLOG(dc.lg_, wslog::debug) << "Cannot overwrite folder with object or object with folder";
+		ret_value.emplace_array();
+		continue;
+	    }
+	    if (!overwrite)
+	    {
+		WSLOG(dc.lg_, wslog::debug) << "Object exists but overwrite was not specified";
+		ret_value.emplace_array();
+		continue;
+	    }
+	}
+	else
+	{
+	    /*
+	     * Each folder along the path must exist, be a folder in this
+	     * batch, or be created as an intermediate.
+	     */
+	    bool ok = true;
+	    WSPath qpath(tc.parsed_path);
+	    qpath.path = "";
+	    for (auto &comp: tc.path_components())
+	    {
+		if (comp.empty())
+		    continue;
+		qpath.name = comp;
+		Key key = key_of(qpath);
+		const ObjectMeta &pmeta = ancestor_metas[ancestor_index[key]];
+		auto in_batch = batch_index.find(key);
+		if (pmeta.valid ? !pmeta.is_folder()
+		    : (in_batch != batch_index.end() && !is_folder(to_create[in_batch->second].type)))
+		{
+		    WSLOG(dc.lg_, wslog::debug) << "Intermediate path object is not a folder";
+		    ok = false;
+		    break;
+		}
+		if (!pmeta.valid && in_batch == batch_index.end() && !intermediates.count(key))
+		{
+		    ObjectToCreate ptc(qpath, "folder");
+		    boost::uuids::uuid uuidobj = (*(db_.uuidgen()))();
+		    ptc.uuid = boost::lexical_cast<std::string>(uuidobj);
+		    needed.push_back(ptc);
+		}
+		if (!qpath.path.empty())
+		    qpath.path += "/";
+		qpath.path += qpath.name;
+	    }
+	    if (!ok)
+	    {
+		ret_value.emplace_array();
+		continue;
+	    }
+	}
+
+	if (createUploadNodes && !create_upload_node(dc, tc))
+	{
+	    WSLOG(dc.lg_, wslog::error) << "Error creating shock node";
+	    ret_value.emplace_array();
+	    continue;
+	}
+
+	for (auto &ptc: needed)
+	    intermediates.emplace(key_of(ptc.parsed_path), ptc);
+	if (meta.valid)
+	    qobj.remove_workspace_object(meta, remreq);
+	create[i] = true;
+    }
+
+    /*
+     * Insert folders before their contents: the insert creates the
+     * directories in order.
+     */
+    std::vector<ObjectToCreate> inserts;
+    std::vector<long> origin;
+    for (auto &ent: intermediates)
+    {
+	inserts.push_back(ent.second);
+	origin.push_back(-1);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+	if (create[i])
+	{
+	    inserts.push_back(to_create[i]);
+	    origin.push_back(static_cast<long>(i));
+	}
+    }
+    std::vector<size_t> order(inserts.size());
+    std::vector<size_t> depth(inserts.size());
+    for (size_t k = 0; k < inserts.size(); k++)
+    {
+	order[k] = k;
+	const std::string &path = inserts[k].parsed_path.path;
+	depth[k] = path.empty() ? 0 : 1 + std::count(path.begin(), path.end(), '/');
+    }
+    std::stable_sort(order.begin(), order.end(), [&depth](size_t a, size_t b) { return depth[a] < depth[b]; });
+
+    std::vector<ObjectToCreate> sorted;
+    sorted.reserve(inserts.size());
+    for (size_t k: order)
+	sorted.push_back(std::move(inserts[k]));
+
+    std::vector<ObjectMeta> created = qobj.create_workspace_objects(sorted, owner);
+    for (size_t k = 0; k < order.size(); k++)
+    {
+	long i = origin[order[k]];
+	if (i < 0)
+	{
+	    WSLOG(dc.lg_, wslog::debug) << "Created intermediate " << created[k] << "\n";
+	}
+	else
+	    output[i] = created[k].serialize(output.storage());
+    }
+}
+
+/*
+ * Create the Shock node that the client will upload the data for
+ * to_create into, and register the pending upload. Runs in a database
+ * thread; blocks until the Shock operations complete.
+ */
+bool WorkspaceService::create_upload_node(DispatchContext &dc, ObjectToCreate &to_create)
+{
+    /*
+     * We spawn a coroutine to perform the Shock operations
+     */
+
+    boost::system::error_code ec;
+    net::io_context &ioc = shared_state_.ioc();
+
+    /*
+     * We use a mutex to block the calling thread until the asyncronous operations all complete.
+     */
+    std::mutex lock;
+    lock.lock();
+    std::string node_id;
+    boost::asio::spawn(ioc, [&node_id, &dc, &lock, &to_create, this] (net::yield_context yield)
+	{
+	    // Get the auth token for the owner of the Shock nodes if needed.
+	    auto token = shared_state_.ws_auth(yield);
+	    if (!token->valid())
+	    {
+		WSLOG(dc.lg_, wslog::error) << "no service token, cannot create Shock node\n";
+		lock.unlock();
+		return;
+	    }
+
+	    node_id = shared_state_.shock().create_node(*token, to_create.uuid, yield, dc.trace);
+	    WSLOG(dc.lg_, wslog::debug) << "created node " << node_id << "\n";
+	    if (node_id.empty())
+	    {
+		lock.unlock();
+		return;
+	    }
+	    to_create.shock_node = shared_state_.config().shock_server() + "/node/" + node_id;
+	    shared_state_.shock().acl_add_user(to_create.shock_node, *token, dc.token().user().to_string(), yield, dc.trace);
+	    boost::asio::post(shock_ioc_, [&lock, this, &to_create, token = dc.shared_token()] () {
+		pending_uploads_.emplace(std::make_pair(to_create.uuid, PendingUpload{to_create.uuid, to_create.shock_node, token}));
+		metrics::pending_uploads().set(pending_uploads_.size());
+		lock.unlock();
+	    });
+	});
+    lock.lock();
+    lock.unlock();
+    return !node_id.empty();
+}
+
 void WorkspaceService::method_ls(const JsonRpcRequest &req, JsonRpcResponse &resp,
 				 DispatchContext &dc, int &http_code)
 {
-    json::array paths;
-    bool excludeDirectories, excludeObjects, recursive, fullHierachicalOutput;
+    const json::array *paths_ptr = nullptr;
+    bool excludeDirectories, excludeObjects, recursive, fullHierachicalOutput, compact;
+    size_t limit;
+    std::map<std::string, ObjectKey> continuation;
 
     try {
-	auto input = req.params().at(0).as_object();
-	paths = input.at("paths").as_array();
+	const auto &input = req.params().at(0).as_object();
+	paths_ptr = &input.at("paths").as_array();
 	excludeDirectories = object_at_as_bool(input, "excludeDirectories");
 	excludeObjects = object_at_as_bool(input, "excludeObjects");
 	recursive = object_at_as_bool(input, "recursive");
 	fullHierachicalOutput = object_at_as_bool(input, "fullHierachicalOutput");
+	compact = object_at_as_bool(input, "compact");
+
+	int64_t lim = object_at_as_int(input, "limit");
+	if (lim < 0)
+	    throw std::invalid_argument("negative limit");
+	// A page is never longer than ls-max-limit.
+	int64_t max_limit = std::max(1, shared_state_.config().ls_max_limit());
+	limit = static_cast<size_t>(std::min(lim, max_limit));
+
+	auto citer = input.find("continuation");
+	if (citer != input.end())
+	{
+	    for (auto &ent: citer->value().as_object())
+		continuation.emplace(std::string(ent.key().data(), ent.key().size()),
+				     decode_ls_token(boost::lexical_cast<std::string>(ent.value().as_string())));
+	}
 
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &paths = *paths_ptr;
 
     // Validate format of paths before doing any work
-    for (auto path: paths)
+    for (auto &path: paths)
     {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "check " <<path << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "check " <<path << "\n";
 	if (path.kind() != json::kind::string)
 	{
 	    resp.set_error(-32602, "Invalid request parameters");
@@ -687,33 +1024,60 @@ void WorkspaceService::method_ls(const JsonRpcRequest &req, JsonRpcResponse &res
     // We will run essentially this entire command in the
     // database thread as the work is all database-based
 
-    json::object output;
+    json::object output(resp.storage());
+    json::object next(resp.storage());
+    bool ok = true;
     db_.run_in_thread(dc,
-		      [this, &paths, &output, &dc,
+		      [this, &paths, &output, &next, &dc, &continuation, &ok, limit, compact,
 		       excludeDirectories, excludeObjects, recursive, fullHierachicalOutput]
 		      (std::unique_ptr<WorkspaceDBQuery> qobj)
 			  {
 			      // wslog::logger l(wslog::channel = "mongo_thread");
-			      process_ls(std::move(qobj), dc, paths, output,
-					 excludeDirectories, excludeObjects, recursive, fullHierachicalOutput);
+			      ok = process_ls(std::move(qobj), dc, paths, output,
+					      excludeDirectories, excludeObjects, recursive, fullHierachicalOutput,
+					      compact, limit, continuation, next);
 			  });
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    if (!ok)
+    {
+	resp.set_error(-32602, "Invalid continuation token");
+	http_code = 500;
+	return;
+    }
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
+
+    /*
+     * A paged listing returns as a second result the continuation
+     * tokens for the paths that have more to list.
+     */
+    if (limit > 0)
+	resp.result().emplace_back(std::move(next));
 }
 
 
 
 // This executes in a WorkspaceDB thread
-
-void WorkspaceService::process_ls(std::unique_ptr<WorkspaceDBQuery> qobj,
-				  DispatchContext &dc, json::array &paths, json::object &output,
-				  bool excludeDirectories, bool excludeObjects, bool recursive, bool fullHierachicalOutput)
+//
+// With a nonzero limit, object listings are paged: each path lists at most
+// limit objects, resuming after its entry in continuation if it has one,
+// and a token for the next page is left in next if there may be more.
+// Workspace listings are not paged. We return false, listing nothing
+// more, if a continuation token is not for a key inside its path.
+//
+// A compact listing returns for each object only the leading fields of
+// the usual tuple (see ObjectMeta::serialize_compact), and reads only those
+// from the database.
+
+bool WorkspaceService::process_ls(std::unique_ptr<WorkspaceDBQuery> qobj,
+				  DispatchContext &dc, const json::array &paths, json::object &output,
+				  bool excludeDirectories, bool excludeObjects, bool recursive, bool fullHierachicalOutput,
+				  bool compact, size_t limit, const std::map<std::string, ObjectKey> &continuation, json::object &next)
 {
-    for (auto path_jobj: paths)
+    for (auto &path_jobj: paths)
     {
-	auto path_str = path_jobj.as_string();
+	const auto &path_str = path_jobj.as_string();
 	WSPath path = qobj->parse_path(path_str);
-	std::cerr << path << "\n";
+	WSLOG(dc.lg_, wslog::debug) << path << "\n";
 
 	std::vector<ObjectMeta> list;
 
@@ -726,7 +1090,7 @@ void WorkspaceService::process_ls(std::unique_ptr<WorkspaceDBQuery> qobj,
 	    }
 	    else
 	    {
-		BOOST_LOG_SEV(dc.lg_, wslog::notification) << "Path did not parse: " << path_str << "\n";
+		WSLOG(dc.lg_, wslog::notification) << "Path did not parse: " << path_str << "\n";
 		continue;
 	    }
 	}
@@ -736,48 +1100,71 @@ void WorkspaceService::process_ls(std::unique_ptr<WorkspaceDBQuery> qobj,
 	}
 	else if (qobj->user_has_permission(path.workspace, WSPermission::read))
 	{
-	    list = qobj->list_objects(path, excludeDirectories, excludeObjects, recursive);
+	    if (limit > 0)
+	    {
+		auto citer = continuation.find(std::string(path_str.data(), path_str.size()));
+		const ObjectKey *after = citer == continuation.end() ? nullptr : &citer->second;
+		if (after && (recursive ? !schema::key_in_subtree(path.full_path(), *after)
+			      : after->path != path.full_path()))
+		{
+		    WSLOG(dc.lg_, wslog::notification) << "Continuation for " << path_str << " is outside it\n";
+		    return false;
+		}
+
+		// Ask for one more than the page to learn whether there is more.
+		list = qobj->list_objects(path, excludeDirectories, excludeObjects, recursive, limit + 1, after, compact);
+		if (list.size() > limit)
+		{
+		    list.pop_back();
+		    const ObjectMeta &last = list.back();
+		    next.emplace(path_str, encode_ls_token(ObjectKey{last.ws_path.path, last.name}));
+		}
+	    }
+	    else
+		list = qobj->list_objects(path, excludeDirectories, excludeObjects, recursive, 0, nullptr, compact);
 	}
-	json::array jlist;
-	for (auto elt: list)
-	    jlist.emplace_back(elt.serialize());
+	json::array jlist(output.storage());
+	for (auto &elt: list)
+	    jlist.emplace_back(compact ? elt.serialize_compact(jlist.storage()) : elt.serialize(jlist.storage()));
 	    
-	output.emplace(path_str, jlist);
+	output.emplace(path_str, std::move(jlist));
     }
+    return true;
 }
 
 void WorkspaceService::method_get(const JsonRpcRequest &req, JsonRpcResponse &resp,
 				  DispatchContext &dc, int &http_code)
 {
     bool metadata_only = false;
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
 
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
 
 	metadata_only = object_at_as_bool(input, "metadata_only");
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
 
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "metadata_only=" << metadata_only << " adminmode=" << dc.admin_mode << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "metadata_only=" << metadata_only << " adminmode=" << dc.admin_mode << "\n";
 
     // Validate format of paths before doing any work
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "check " << obj << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "check " << obj << "\n";
 	if (obj.kind() != json::kind::string)
 	{
 	    resp.set_error(-32602, "Invalid request parameters");
@@ -786,102 +1173,179 @@ void WorkspaceService::method_get(const JsonRpcRequest &req, JsonRpcResponse &re
 	}
     }
 
-    json::array output;
-
-    for (auto obj: objects)
-    {
-	WSPath path;
-	ObjectMeta meta;
+    /*
+     * Resolve all the paths and their metadata in one trip to the
+     * database threads.
+     */
+    std::vector<WSPath> paths;
+    std::vector<ObjectMeta> metas;
+    db_.run_in_thread(dc,
+		      [&objects, &paths, &metas]
+		      (std::unique_ptr<WorkspaceDBQuery> qobj) 
+			  {
+			      paths = qobj->parse_paths(objects);
+			      metas = qobj->lookup_object_metas(paths, WSPermission::read);
+			  });
 
-	std::string file_data;
-	db_.run_in_thread(dc,
-			  [&path, path_str = obj.as_string(),
-			   metadata_only, &meta]
-			  (std::unique_ptr<WorkspaceDBQuery> qobj) 
-			      {
-				  // wslog::logger l(wslog::channel = "mongo_thread");
-				  
-				  path = qobj->parse_path(path_str);
-				  if (path.workspace.name.empty() ||
-				      qobj->user_has_permission(path.workspace, WSPermission::read))
-				  {
-				      meta = qobj->lookup_object_meta(path);
-				  }
-			      });
-	// We do Shock manipulations back in the main thread of control
-	// so we can take advantage of the asynch support.
+    std::vector<std::string> file_data(paths.size());
+    if (!metadata_only)
+	fetch_object_data(paths, metas, file_data, dc);
 
-	std::cerr << "OM: " << meta << "\n";
+    json::array output(resp.storage());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+	WSLOG(dc.lg_, wslog::debug) << "OM: " << metas[i] << "\n";
+	json::array obj_output({ metas[i].serialize(output.storage()), file_data[i] }, output.storage());
+	output.emplace_back(std::move(obj_output));
+    }
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
+}
 
-	if (meta.valid)
+/*
+ * Read the data for the objects in metas, or for Shock objects grant
+ * the user access to the node. An object whose data we cannot read or
+ * whose node we cannot share has its meta replaced by an error.
+ *
+ * We run a fixed number of workers in the request's strand, each
+ * taking the next object when it finishes one; file reads are handed
+ * to the file pool, which wakes the worker by posting a cancel of its
+ * timer back to the strand. The last worker to finish wakes us the
+ * same way.
+ */
+void WorkspaceService::fetch_object_data(const std::vector<WSPath> &paths, std::vector<ObjectMeta> &metas,
+					 std::vector<std::string> &file_data, DispatchContext &dc)
+{
+    std::vector<size_t> todo;
+    bool need_shock = false;
+    for (size_t i = 0; i < metas.size(); i++)
+    {
+	if (metas[i].valid)
 	{
-	    if (!metadata_only)
-	    {
-		if (meta.shockurl.empty())
-		{
-		    // We may want to move file I/O into a file I/O thread pool
-		    const boost::filesystem::path &fs_path = shared_state_.config().filesystem_path_for_object(path);
-		    std::cerr << "retrieve data from " << fs_path << "\n";
-		    boost::filesystem::ifstream f(fs_path);
-		    if (f)
-		    {
-			std::ostringstream ss;
-			ss << f.rdbuf();
-			file_data = std::move(ss.str());
-		    }
-		    else
-		    {
-			BOOST_LOG_SEV(dc.lg_, wslog::error) << "cannot read WS file path " << fs_path << " from object " << path << "\n";
-		    }
-		}
-		else
-		{
-		    std::cerr  << "invoke shock " << dc.token << "\n";
-
-		    // This token needs to be the shock data owner token
-		    AuthToken &token = shared_state_.ws_auth(dc.yield);
-		    std::cerr << "got ws auth " << token << "\n";
-		    if (dc.token.valid())
-			shared_state_.shock().acl_add_user(meta.shockurl, token, dc.token.user(), dc.yield);
-		    std::cerr  << "invoke shock..done\n";
-		}
-	    }
-	    
+	    todo.push_back(i);
+	    if (!metas[i].shockurl.empty())
+		need_shock = true;
 	}
-	json::array obj_output( { meta.serialize(), file_data });
-	output.emplace_back(obj_output);
     }
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    if (todo.empty())
+	return;
+
+    // This token needs to be the shock data owner token
+    std::shared_ptr<const AuthToken> ws_token;
+    if (need_shock && dc.token().valid())
+    {
+	ws_token = shared_state_.ws_auth(dc.yield);
+	WSLOG(dc.lg_, wslog::debug) << "got ws auth " << *ws_token << "\n";
+    }
+
+    size_t next = 0;
+    size_t n_workers = todo.size();
+    int concurrency = shared_state_.config().fetch_concurrency();
+    if (concurrency > 0)
+	n_workers = std::min<size_t>(n_workers, concurrency);
+    size_t running = n_workers;
+    boost::asio::deadline_timer done_timer(dc.timer.get_executor());
+    done_timer.expires_at(boost::posix_time::pos_infin);
+
+    for (size_t w = 0; w < n_workers; w++)
+    {
+	boost::asio::spawn(dc.yield,
+			   [this, &paths, &metas, &file_data, &todo, &next, &running, &done_timer, &dc, &ws_token]
+			   (boost::asio::yield_context worker_yield) {
+			       boost::asio::deadline_timer io_timer(dc.timer.get_executor());
+			       while (next < todo.size())
+			       {
+				   size_t i = todo[next++];
+				   /*
+				    * Any failure is reported in this object's entry;
+				    * it must not end the worker, or running never
+				    * reaches zero and we never wake.
+				    */
+				   try {
+				       const ObjectMeta &meta = metas[i];
+				       if (meta.shockurl.empty())
+				       {
+					   const boost::filesystem::path &fs_path = shared_state_.config().filesystem_path_for_object(paths[i]);
+					   WSLOG(dc.lg_, wslog::debug) << "retrieve data from " << fs_path << "\n";
+					   bool ok = false;
+					   io_timer.expires_at(boost::posix_time::pos_infin);
+					   boost::asio::post(file_pool_, [&fs_path, &ok, &data = file_data[i], &io_timer]() {
+					       boost::filesystem::ifstream f(fs_path);
+					       if (f)
+					       {
+						   std::ostringstream ss;
+						   ss << f.rdbuf();
+						   data = ss.str();
+						   ok = true;
+					       }
+					       boost::asio::post(io_timer.get_executor(), [&io_timer]() { io_timer.cancel_one(); });
+					   });
+					   boost::system::error_code ec;
+					   io_timer.async_wait(worker_yield[ec]);
+					   if (!ok)
+					   {
+					       WSLOG(dc.lg_, wslog::error) << "cannot read WS file path " << fs_path << " from object " << paths[i] << "\n";
+					       metas[i] = ObjectMeta(ObjectMeta::errorMeta, "Cannot read object data");
+					   }
+				       }
+				       else if (ws_token && !ws_token->valid())
+				       {
+					   metas[i] = ObjectMeta(ObjectMeta::errorMeta, "Cannot grant access to Shock node");
+				       }
+				       else if (ws_token)
+				       {
+					   WSLOG(dc.lg_, wslog::debug) << "invoke shock " << dc.token() << "\n";
+					   try {
+					       shared_state_.shock().acl_add_user(meta.shockurl, *ws_token, dc.token().user().to_string(),
+										  worker_yield, dc.trace);
+					   } catch (std::exception &e) {
+					       WSLOG(dc.lg_, wslog::error) << "acl_add_user failed for " << meta.shockurl << ": " << e.what() << "\n";
+					       metas[i] = ObjectMeta(ObjectMeta::errorMeta, "Cannot grant access to Shock node");
+					   }
+					   WSLOG(dc.lg_, wslog::debug) << "invoke shock..done\n";
+				       }
+				   } catch (std::exception &e) {
+				       WSLOG(dc.lg_, wslog::error) << "fetch of " << paths[i] << " failed: " << e.what() << "\n";
+				       metas[i] = ObjectMeta(ObjectMeta::errorMeta, "Cannot retrieve object data");
+				   }
+			       }
+			       if (--running == 0)
+				   boost::asio::post(done_timer.get_executor(), [&done_timer]() { done_timer.cancel_one(); });
+			   });
+    }
+
+    boost::system::error_code ec;
+    done_timer.async_wait(dc.yield[ec]);
 }
 
 void WorkspaceService::method_list_permissions(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code)
 {
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
 
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
 
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
 
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
     // Validate format of paths before doing any work
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "check " << obj << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "check " << obj << "\n";
 	if (obj.kind() != json::kind::string)
 	{
 	    resp.set_error(-32602, "Invalid request parameters");
@@ -890,56 +1354,55 @@ void WorkspaceService::method_list_permissions(const JsonRpcRequest &req, JsonRp
 	}
     }
 
-    json::object output;
+    json::object output(resp.storage());
 
     db_.run_in_thread(dc,
-		      [objects, &output]
+		      [&objects, &output]
 		      (std::unique_ptr<WorkspaceDBQuery> qobj) 
        	{
-	    for (auto obj: objects)
+	    std::vector<WSPath> paths = qobj->parse_paths(objects);
+	    for (size_t i = 0; i < paths.size(); i++)
 	    {
-		
-		auto path_str = obj.as_string();
-		WSPath path = qobj->parse_path(path_str);
-		json::object obj_output{};
-		json::array perms{};
+		WSPath &path = paths[i];
+		json::array perms(output.storage());
 		if (path.workspace.name.empty() ||
 		    qobj->user_has_permission(path.workspace, WSPermission::read))
 		{
 		    path.workspace.serialize_permissions(perms);
 		}
-		output.emplace(path_str, perms);
+		output.emplace(objects[i].as_string(), std::move(perms));
 	    }
 	});
 
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 }
 
 void WorkspaceService::method_get_download_url(const JsonRpcRequest &req, JsonRpcResponse &resp,
 				  DispatchContext &dc, int &http_code)
 {
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
 
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
     // Validate format of paths before doing any work
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "check " << obj << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "check " << obj << "\n";
 	if (obj.kind() != json::kind::string)
 	{
 	    resp.set_error(-32602, "Invalid request parameters");
@@ -948,7 +1411,7 @@ void WorkspaceService::method_get_download_url(const JsonRpcRequest &req, JsonRp
 	}
     }
 
-    json::array output;
+    json::array output(resp.storage());
 
     /*
      * For each object, validate the path and ensure it points to a file
@@ -961,12 +1424,20 @@ void WorkspaceService::method_get_download_url(const JsonRpcRequest &req, JsonRp
      * current user had a valid token; only then do we add the Shock url to the list.
      */
 
-    AuthToken &ws_auth = shared_state_.ws_auth(dc.yield);
+    auto ws_auth_ref = shared_state_.ws_auth(dc.yield);
+    const AuthToken &ws_auth = *ws_auth_ref;
+    if (!ws_auth.valid())
+    {
+	WSLOG(dc.lg_, wslog::error) << "no service token for download\n";
+	resp.set_error(-32000, "Service token unavailable; retry later");
+	http_code = 503;
+	return;
+    }
     std::vector<std::string> shock_urls;
     
     auto work = [&dc, &objects, &output, &ws_auth, &shock_urls, this] (std::unique_ptr<WorkspaceDBQuery> qobj)
 	{
-	    for (auto obj: objects)
+	    for (auto &obj: objects)
 	    {
 		auto path_str = obj.as_string();
 		ObjectMeta meta;
@@ -987,47 +1458,48 @@ void WorkspaceService::method_get_download_url(const JsonRpcRequest &req, JsonRp
 
     db_.run_in_thread(dc, work);
 
-    std::string username = dc.token.valid() ? dc.token.user() : ws_auth.user();
+    std::string username = (dc.token().valid() ? dc.token().user() : ws_auth.user()).to_string();
 
     for (auto url: shock_urls)
     {
-	shared_state_.shock().acl_add_user(url, ws_auth.token(), username, dc.yield);
+	shared_state_.shock().acl_add_user(url, ws_auth, username, dc.yield, dc.trace);
     }
 
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 }
 
 void WorkspaceService::method_update_auto_meta(const JsonRpcRequest &req, JsonRpcResponse &resp,
 					       DispatchContext &dc, int &http_code)
 {
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
 
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
 
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
 
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "method_update_auto_meta  adminmode=" << dc.admin_mode << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "method_update_auto_meta  adminmode=" << dc.admin_mode << "\n";
 
     // Validate format of paths before doing any work
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "check " << obj << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "check " << obj << "\n";
 	if (obj.kind() != json::kind::string)
 	{
 	    resp.set_error(-32602, "Invalid request parameters");
@@ -1036,14 +1508,14 @@ void WorkspaceService::method_update_auto_meta(const JsonRpcRequest &req, JsonRp
 	}
     }
 
-    json::array output;
+    json::array output(resp.storage());
 
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
 	WSPath path;
 	ObjectMeta meta;
 
-	db_.run_in_sync_thread(dc,
+	db_.run_in_sync_thread(dc, { obj.as_string().c_str() },
 			  [&path, path_str = obj.as_string(), &output, &meta, this]
 			  (std::unique_ptr<WorkspaceDBQuery> qobj) 
 			      {
@@ -1071,7 +1543,7 @@ void WorkspaceService::method_update_auto_meta(const JsonRpcRequest &req, JsonRp
 					      auto iter = pending_uploads_.find(meta.id);
 					      if (iter == pending_uploads_.end())
 					      {
-						  std::cerr << "did not find pending for object\n";
+						  WSLOG(lg_, wslog::warning) << "did not find pending for object\n";
 						  lock.unlock();
 						  return;
 					      }
@@ -1082,60 +1554,62 @@ void WorkspaceService::method_update_auto_meta(const JsonRpcRequest &req, JsonRp
 						  updated = true;
 						  size = pu.size();
 						  pending_uploads_.erase(iter);
+						  metrics::pending_uploads().set(pending_uploads_.size());
 					      }
 					      lock.unlock();
 					  });
 					  
 				      lock.lock();
 				      lock.unlock();
-				      std::cerr << "updated=" << updated << " size=" << size << "\n";
+				      WSLOG(lg_, wslog::debug) << "updated=" << updated << " size=" << size << "\n";
 				      if (updated)
 				      {
 					  qobj->set_object_size(meta.id, size);
 					  meta = qobj->lookup_object_meta(path);
 				      }
 				  }
-				  output.emplace_back(meta.serialize());
+				  output.emplace_back(meta.serialize(output.storage()));
 			      });
     }
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 }
 
 void WorkspaceService::method_update_metadata(const JsonRpcRequest &req, JsonRpcResponse &resp,
 					      DispatchContext &dc, int &http_code)
 {
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
     bool append;
 
     auto &cfg = shared_state_.config();
 
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
 
 	append = object_at_as_bool(input, "append");
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
 
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "method_update_metadata  adminmode=" << dc.admin_mode << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "method_update_metadata  adminmode=" << dc.admin_mode << "\n";
 
     std::vector<ObjectToModify> to_modify;
     
     // Validate format of paths before doing any work
-    for (auto obj: objects)
+    for (auto &obj: objects)
     {
 	try {
 	    ObjectToModify tc{obj};
@@ -1144,26 +1618,29 @@ void WorkspaceService::method_update_metadata(const JsonRpcRequest &req, JsonRpc
 		std::string canon;
 		if (!cfg.is_valid_type(tc.type.value(), canon))
 		{
-		    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "Invalid type requested " << tc.type.value();
+		    WSLOG(dc.lg_, wslog::debug) << "Invalid type requested " << tc.type.value();
 		    resp.set_error(-32602, "Invalid object type requested");
 		    http_code = 500;
 		    return;
 		}
 		tc.type = canon;
 	    }
-	    std::cerr << "TO modify: " << tc << "\n";
+	    WSLOG(dc.lg_, wslog::debug) << "TO modify: " << tc << "\n";
 	    to_modify.emplace_back(tc);
 	} catch (std::exception e) {
-	    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	    WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	    resp.set_error(-32602, "Invalid request parameters");
 	    http_code = 500;
 	    return;
 	}
     }
 
-    json::array output;
+    json::array output(resp.storage());
+    std::vector<std::string> paths;
+    for (auto &tc: to_modify)
+	paths.push_back(tc.path);
 
-    db_.run_in_sync_thread(dc, [&to_modify, &output, append, this]
+    db_.run_in_sync_thread(dc, paths, [&to_modify, &output, append, this]
 	(std::unique_ptr<WorkspaceDBQuery> qobj) 
 	{
 	    for (auto obj: to_modify)
@@ -1179,23 +1656,23 @@ void WorkspaceService::method_update_metadata(const JsonRpcRequest &req, JsonRpc
 		    {
 			if (obj.type)
 			{
-			    std::cerr << " cannot set type on workspace\n";
+			    WSLOG(lg_, wslog::debug) << " cannot set type on workspace\n";
 			    output.emplace_back(json::array{});
 			    continue;
 			}
 		    }
 
-		    std::cerr << "Apply metadata change " << obj << "\n";
+		    WSLOG(lg_, wslog::debug) << "Apply metadata change " << obj << "\n";
 
 		    auto meta = qobj->update_object(obj, append);
 
-		    output.emplace_back(meta.serialize());
+		    output.emplace_back(meta.serialize(output.storage()));
 		}
 	    }
 	});
     
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 }
 
 void WorkspaceService::method_set_permissions(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code)
@@ -1205,12 +1682,12 @@ void WorkspaceService::method_set_permissions(const JsonRpcRequest &req, JsonRpc
     std::experimental::optional<WSPermission> new_global_permission;
     
     try {
-	auto input = req.params().at(0).as_object();
+	const auto &input = req.params().at(0).as_object();
 	path = input.at("path").as_string().c_str();
 	auto perm_it = input.find("permissions");
 	if (perm_it != input.end() && perm_it->value().kind() == json::kind::array)
 	{
-	    for (auto p: perm_it->value().as_array())
+	    for (auto &p: perm_it->value().as_array())
 	    {
 		user_permissions.emplace_back(p);
 	    }
@@ -1223,21 +1700,21 @@ void WorkspaceService::method_set_permissions(const JsonRpcRequest &req, JsonRpc
 	}
 
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
 
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
 
-    json::array output;
+    json::array output(resp.storage());
 
     /*
      * Perform the requested operations.
@@ -1257,7 +1734,7 @@ void WorkspaceService::method_set_permissions(const JsonRpcRequest &req, JsonRpc
      */
 
     std::experimental::optional<std::string> err;
-    db_.run_in_sync_thread(dc, [&path, &user_permissions, &new_global_permission, &output, &err, this]
+    db_.run_in_sync_thread(dc, { path }, [&path, &user_permissions, &new_global_permission, &output, &err, this]
 	(std::unique_ptr<WorkspaceDBQuery> qobj) 
 	{
 	    err = qobj->update_permissions(path, user_permissions, new_global_permission, output);
@@ -1266,11 +1743,11 @@ void WorkspaceService::method_set_permissions(const JsonRpcRequest &req, JsonRpc
 
     if (err)
     {
-	std::cerr << "error from update: " << *err << "\n";
+	WSLOG(dc.lg_, wslog::notification) << "error from update: " << *err << "\n";
     }
     
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 
 }
 
@@ -1280,46 +1757,57 @@ void WorkspaceService::method_copy(const JsonRpcRequest &req, JsonRpcResponse &r
     bool overwrite;
     bool recursive;
     bool move;
+    bool want_report;
     std::vector<std::pair<std::string, std::string>> objects;
 
     auto &cfg = shared_state_.config();
 
     try {
-	auto input = req.params().at(0).as_object();
-	auto objs = input.at("objects").as_array();
-	for (auto obj: objs)
+	const auto &input = req.params().at(0).as_object();
+	const auto &objs = input.at("objects").as_array();
+	for (auto &obj: objs)
 	{
-	    auto lobj = obj.as_array();
+	    const auto &lobj = obj.as_array();
 	    objects.emplace_back(lobj.at(0).as_string().c_str(), lobj.at(1).as_string().c_str());
 	}
 
 	overwrite = object_at_as_bool(input, "overwrite");
 	recursive = object_at_as_bool(input, "recursive");
 	move = object_at_as_bool(input, "move");
+	want_report = object_at_as_bool(input, "report");
 	
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token.user());
+	    dc.admin_mode = shared_state_.config().user_is_admin(dc.token().user().to_string());
 
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
 
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << "method_copy  adminmode=" << dc.admin_mode << "\n";
+    WSLOG(dc.lg_, wslog::debug) << "method_copy  adminmode=" << dc.admin_mode << "\n";
 
-    json::array output;
+    json::array output(resp.storage());
+    json::array reports(resp.storage());
 
+    // A copy or move is serialized with both its source and destination.
+    std::vector<std::string> paths;
+    for (auto &obj: objects)
+    {
+	paths.push_back(obj.first);
+	paths.push_back(obj.second);
+    }
 
     if (move)
     {
-	db_.run_in_sync_thread(dc, [&objects, &overwrite, &output, this]
+	RemovalRequest remreq;
+	db_.run_in_sync_thread(dc, paths, [&objects, &overwrite, &output, &remreq, this]
 			       (std::unique_ptr<WorkspaceDBQuery> qobj) 
 	    {
 		for (auto &obj: objects)
@@ -1327,15 +1815,17 @@ void WorkspaceService::method_copy(const JsonRpcRequest &req, JsonRpcResponse &r
 		    std::string &from = obj.first;
 		    std::string &to = obj.second;
 
-		    ObjectMeta meta = qobj->perform_move(from, to, overwrite);
-		    output.emplace_back(meta.serialize());
+		    ObjectMeta meta = qobj->perform_move(from, to, overwrite, remreq);
+		    output.emplace_back(meta.serialize(output.storage()));
 		    
 		}
 	    });
+	reclaimer_.submit(std::move(remreq));
     }
     else
     {
-	db_.run_in_sync_thread(dc, [&objects, &overwrite, &recursive, &output, this]
+	RemovalRequest remreq;
+	db_.run_in_sync_thread(dc, paths, [&objects, &overwrite, &recursive, &output, &reports, &remreq, this]
 			       (std::unique_ptr<WorkspaceDBQuery> qobj) 
 	    {
 		for (auto &obj: objects)
@@ -1343,125 +1833,146 @@ void WorkspaceService::method_copy(const JsonRpcRequest &req, JsonRpcResponse &r
 		    std::string &from = obj.first;
 		    std::string &to = obj.second;
 
-		    ObjectMeta meta = qobj->perform_copy(from, to, recursive, overwrite);
-		    std::cerr << from << " " << to << " got " << meta << "\n";
-		    output.emplace_back(meta.serialize());
-		    std::cerr << "output now " << output << "\n";
+		    CopyReport report;
+		    ObjectMeta meta = qobj->perform_copy(from, to, recursive, overwrite, file_pool_, report, remreq);
+		    WSLOG(lg_, wslog::debug) << from << " " << to << " got " << meta << "\n";
+		    output.emplace_back(meta.serialize(output.storage()));
+		    reports.emplace_back(report.serialize(reports.storage()));
+		    WSLOG(lg_, wslog::debug) << "output now " << output << "\n";
 		}
 	    });
+	reclaimer_.submit(std::move(remreq));
     }
 
 
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
+
+    /*
+     * With report set, a copy's second element gives for each pair the
+     * counts of what was copied and the paths that could not be.
+     */
+    if (want_report && !move)
+	resp.result().emplace_back(std::move(reports));
 }
 
 void WorkspaceService::method_delete(const JsonRpcRequest &req, JsonRpcResponse &resp,
 				     DispatchContext &dc, int &http_code)
 {
-    json::array objects;
+    const json::array *objects_ptr = nullptr;
     auto &cfg = shared_state_.config();
     bool delete_directories, force;
     try {
-	auto input = req.params().at(0).as_object();
-	objects = input.at("objects").as_array();
+	const auto &input = req.params().at(0).as_object();
+	objects_ptr = &input.at("objects").as_array();
 	delete_directories = object_at_as_bool(input, "deleteDirectories");
 	force = object_at_as_bool(input, "force");
 	
 	if (object_at_as_bool(input, "adminmode"))
-	    dc.admin_mode = cfg.user_is_admin(dc.token.user());
+	    dc.admin_mode = cfg.user_is_admin(dc.token().user().to_string());
     } catch (std::invalid_argument e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     } catch (std::exception e) {
-	BOOST_LOG_SEV(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
+	WSLOG(dc.lg_, wslog::debug) << "error parsing: " << e.what() << "\n";
 	resp.set_error(-32602, "Invalid request parameters");
 	http_code = 500;
 	return;
     }
+    const json::array &objects = *objects_ptr;
 
     std::vector<fs::path> paths_to_remove;
     std::vector<ObjectMeta> shock_nodes_to_remove;
     
-    json::array output;
+    json::array output(resp.storage());
 
     RemovalRequest remreq;
+    std::vector<std::string> paths;
+    for (auto &obj: objects)
+    {
+	if (obj.kind() == json::kind::string)
+	    paths.emplace_back(obj.as_string().c_str());
+    }
 
-    db_.run_in_thread(dc,
-		      [this, delete_directories, force, &objects, &paths_to_remove, &shock_nodes_to_remove, &output, &remreq]
-		      (std::unique_ptr<WorkspaceDBQuery> qobj_ptr) 
-			  {
-			      WorkspaceDBQuery &qobj = *qobj_ptr;
-			      for (auto obj: objects)
-			      {
-				  WSPath path = qobj.parse_path(obj);
+    db_.run_in_sync_thread(dc, paths,
+			   [this, delete_directories, force, &objects, &paths_to_remove, &shock_nodes_to_remove, &output, &remreq]
+			   (std::unique_ptr<WorkspaceDBQuery> qobj_ptr) 
+			       {
+				   WorkspaceDBQuery &qobj = *qobj_ptr;
+				   for (auto &obj: objects)
+				   {
+				       WSPath path = qobj.parse_path(obj);
 				  
-				  if (!qobj.user_has_permission(path.workspace, WSPermission::write))
-				  {
-				      BOOST_LOG_SEV(lg_, wslog::debug) << "no permission to remove " << path;
-				      push_error_meta(output, "Permission denied to remove object");
-				      continue;
-				  }
+				       if (!qobj.user_has_permission(path.workspace, WSPermission::write))
+				       {
+					   WSLOG(lg_, wslog::debug) << "no permission to remove " << path;
+					   push_error_meta(output, "Permission denied to remove object");
+					   continue;
+				       }
 				  
-				  ObjectMeta meta = qobj.lookup_object_meta(path);
+				       ObjectMeta meta = qobj.lookup_object_meta(path);
 				  
-				  if (!meta.valid)
-				  {
-				      push_error_meta(output, "Object does not exist");
-				      continue;
-				  }
-
-				  /*
-				   * Validate. If the object is a folder, the action taken
-				   * depends on the values of delete_directories and force.
-				   * delete_directories=true, force=true: recursive delete
-				   * delete_directories=true, force=false: remove folder only if it is empty
-				   * delete_directories=false: error
-				   *
-				   * If the object is not a folder, just remove.
-				   */
-
-				  bool removed;
-				  if (meta.is_folder())
-				  {
-				      if (!delete_directories)
-				      {
-					  push_error_meta(output, "Trying to delete folder but deleteDirectories not set");
-					  continue;
-				      }
-				      if (force)
-				      {
-					  removed = qobj.remove_workspace_folder_and_contents(meta, remreq);
-				      }
-				      else
-				      {
-					  removed = qobj.remove_workspace_folder_only(meta, remreq);
-				      }
-				  }
-				  else
-				  {
-				      std::cerr << "not removing " << meta << "\n";
-//				      removed = qobj.remove_workspace_object(meta, remreq);
-				  }
+				       if (!meta.valid)
+				       {
+					   push_error_meta(output, "Object does not exist");
+					   continue;
+				       }
+
+				       /*
+					* Validate. If the object is a folder, the action taken
+					* depends on the values of delete_directories and force.
+					* delete_directories=true, force=true: recursive delete
+					* delete_directories=true, force=false: remove folder only if it is empty
+					* delete_directories=false: error
+					*
+					* If the object is not a folder, just remove.
+					*/
+
+				       bool removed;
+				       if (meta.is_folder())
+				       {
+					   if (!delete_directories)
+					   {
+					       push_error_meta(output, "Trying to delete folder but deleteDirectories not set");
+					       continue;
+					   }
+					   if (force)
+					   {
+					       removed = qobj.remove_workspace_folder_and_contents(meta, remreq);
+					   }
+					   else
+					   {
+					       std::string err;
+					       removed = qobj.remove_workspace_folder_only(meta, remreq, err);
+					       if (!removed)
+					       {
+						   push_error_meta(output, err);
+						   continue;
+					       }
+					   }
+				       }
+				       else
+				       {
+					   removed = qobj.remove_workspace_object(meta, remreq);
+				       }
 
-				  if (removed)
-				  {
-				      std::cerr << "Deleted " << meta << "\n";
-				  }
-				  else
-				  {
-				      std::cerr << "Did not delete " << meta << "\n";
-				  }
-				  
-				  
-				  output.emplace_back(meta.serialize());
-			      }
-			  });
+				       if (!removed)
+				       {
+					   WSLOG(lg_, wslog::error) << "Did not delete " << meta << "\n";
+					   push_error_meta(output, meta.is_folder() ? "Folder was not completely removed"
+								   : "Failed to remove object");
+					   continue;
+				       }
+				       WSLOG(lg_, wslog::debug) << "Deleted " << meta << "\n";
+				       output.emplace_back(meta.serialize(output.storage()));
+				   }
+			       });
 
-    std::cerr << "To remove after delete: " << remreq;
+    WSLOG(dc.lg_, wslog::debug) << "To remove after delete: " << remreq;
+    reclaimer_.submit(std::move(remreq));
 
-    resp.result().emplace_back(output);
-    BOOST_LOG_SEV(dc.lg_, wslog::debug) << output << "\n";
+    WSLOG(dc.lg_, wslog::debug) << output << "\n";
+    resp.result().emplace_back(std::move(output));
 }
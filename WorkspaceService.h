@@ -10,6 +10,7 @@
 
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/asio/thread_pool.hpp>
 
 #include <boost/json/traits.hpp>
 #include "WorkspaceErrors.h"
@@ -18,6 +19,8 @@
 #include "Logging.h"
 #include "PendingUpload.h"
 #include "Shock.h"
+#include "Metrics.h"
+#include "Reclaimer.h"
 
 #include "JSONRPC.h"
 
@@ -51,6 +54,8 @@ private:
     {
 	ptr_to_method method;
 	Authentication auth;
+	WorkClass work_class;
+	metrics::Histogram *duration;
     };
 
     std::map<const boost::json::string, Method> method_map_;
@@ -87,17 +92,29 @@ private:
 
     Shock shock_;
 
+    /**
+     * Threads for reading object data from the filesystem, so that
+     * file I/O does not block the request threads.
+     */
+    boost::asio::thread_pool file_pool_;
+
+    /**
+     * Removes the files and Shock nodes of deleted objects after the
+     * request that deleted them has returned.
+     */
+    Reclaimer reclaimer_;
+
 public:
     WorkspaceService(boost::asio::io_context &ioc, boost::asio::ssl::context &ssl_ctx,
 		     WorkspaceDB &db, WorkspaceState &state);
     ~WorkspaceService() {
-	BOOST_LOG_SEV(lg_, wslog::debug) << "destroy WorkspaceService";
+	WSLOG(lg_, wslog::debug) << "destroy WorkspaceService";
 	timer_.cancel_one();
 	shock_ioc_.stop();
 	
-	BOOST_LOG_SEV(lg_, wslog::debug) << "join shock thread";
+	WSLOG(lg_, wslog::debug) << "join shock thread";
 	shock_thread_.join();
-	BOOST_LOG_SEV(lg_, wslog::debug) << "WorkspaceService done";
+	WSLOG(lg_, wslog::debug) << "WorkspaceService done";
     }
     
 
@@ -116,23 +133,29 @@ private:
     void check_pending_upload(PendingUpload &p, boost::asio::yield_context yield);
 
     void init_dispatch() {
-	method_map_.emplace(std::make_pair("create",  Method { &WorkspaceService::method_create, Authentication::required }));
-	method_map_.emplace(std::make_pair("delete",  Method { &WorkspaceService::method_delete, Authentication::required }));
-	method_map_.emplace(std::make_pair("copy",  Method { &WorkspaceService::method_copy, Authentication::required }));
-	method_map_.emplace(std::make_pair("ls",  Method { &WorkspaceService::method_ls, Authentication::optional }));
-	method_map_.emplace(std::make_pair("get", Method { &WorkspaceService::method_get, Authentication::optional }));
-	method_map_.emplace(std::make_pair("list_permissions", Method { &WorkspaceService::method_list_permissions, Authentication::optional }));
-	method_map_.emplace(std::make_pair("set_permissions", Method { &WorkspaceService::method_set_permissions, Authentication::required }));
-	method_map_.emplace(std::make_pair("get_download_url", Method { &WorkspaceService::method_get_download_url, Authentication::optional }));
-	method_map_.emplace(std::make_pair("update_auto_meta", Method { &WorkspaceService::method_update_auto_meta, Authentication::optional }));
-	method_map_.emplace(std::make_pair("update_metadata", Method { &WorkspaceService::method_update_metadata, Authentication::required }));
-	method_map_.emplace(std::make_pair("update_metadata", Method { &WorkspaceService::method_update_metadata, Authentication::required }));
+	method_map_.emplace(std::make_pair("create",  Method { &WorkspaceService::method_create, Authentication::required, WorkClass::standard }));
+	method_map_.emplace(std::make_pair("delete",  Method { &WorkspaceService::method_delete, Authentication::required, WorkClass::bulk }));
+	method_map_.emplace(std::make_pair("copy",  Method { &WorkspaceService::method_copy, Authentication::required, WorkClass::bulk }));
+	method_map_.emplace(std::make_pair("ls",  Method { &WorkspaceService::method_ls, Authentication::optional, WorkClass::interactive }));
+	method_map_.emplace(std::make_pair("get", Method { &WorkspaceService::method_get, Authentication::optional, WorkClass::interactive }));
+	method_map_.emplace(std::make_pair("list_permissions", Method { &WorkspaceService::method_list_permissions, Authentication::optional, WorkClass::interactive }));
+	method_map_.emplace(std::make_pair("set_permissions", Method { &WorkspaceService::method_set_permissions, Authentication::required, WorkClass::standard }));
+	method_map_.emplace(std::make_pair("get_download_url", Method { &WorkspaceService::method_get_download_url, Authentication::optional, WorkClass::interactive }));
+	method_map_.emplace(std::make_pair("update_auto_meta", Method { &WorkspaceService::method_update_auto_meta, Authentication::optional, WorkClass::standard }));
+	method_map_.emplace(std::make_pair("update_metadata", Method { &WorkspaceService::method_update_metadata, Authentication::required, WorkClass::standard }));
+
+	for (auto &m: method_map_)
+	    m.second.duration = &metrics::Registry::instance().histogram("ws_method_duration_seconds",
+									 "Time to execute a JSON-RPC method",
+									 "method=\"" + std::string(m.first.c_str()) + "\"");
     }
 
     void method_copy(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
     void method_create(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
     void method_delete(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
     void method_get(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
+    void fetch_object_data(const std::vector<WSPath> &paths, std::vector<ObjectMeta> &metas,
+			   std::vector<std::string> &file_data, DispatchContext &dc);
     void method_ls(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
     void method_list_permissions(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
     void method_set_permissions(const JsonRpcRequest &req, JsonRpcResponse &resp, DispatchContext &dc, int &http_code);
@@ -144,9 +167,15 @@ private:
 			ObjectToCreate &to_create, boost::json::value &ret_value,
 			const std::string &permission, bool createUploadNodes, bool downloadFromLinks, bool overwrite,
 			const std::string &setowner, RemovalRequest &remreq);
-    void process_ls(std::unique_ptr<WorkspaceDBQuery> qobj,
-		    DispatchContext &dc, boost::json::array &paths, boost::json::object &output,
-		    bool excludeDirectories, bool excludeObjects, bool recursive, bool fullHierachicalOutput);
+    void process_create_batch(WorkspaceDBQuery &qobj, DispatchContext &dc,
+			      std::vector<ObjectToCreate> &to_create, boost::json::array &output,
+			      const std::string &permission, bool createUploadNodes, bool downloadFromLinks, bool overwrite,
+			      const std::string &owner, RemovalRequest &remreq);
+    bool create_upload_node(DispatchContext &dc, ObjectToCreate &to_create);
+    bool process_ls(std::unique_ptr<WorkspaceDBQuery> qobj,
+		    DispatchContext &dc, const boost::json::array &paths, boost::json::object &output,
+		    bool excludeDirectories, bool excludeObjects, bool recursive, bool fullHierachicalOutput,
+		    bool compact, size_t limit, const std::map<std::string, ObjectKey> &continuation, boost::json::object &next);
 	
 };
 
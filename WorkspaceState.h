@@ -13,16 +13,19 @@
 #include "WorkspaceConfig.h"
 #include "Shock.h"
 #include "UserAgent.h"
-#include "Base64.h"
+#include "Logging.h"
+#include "TokenCache.h"
+#include "ServiceTokenManager.h"
 
 class WorkspaceState : public std::enable_shared_from_this<WorkspaceState>
 {
     boost::asio::io_context &ioc_;
     SigningCerts certs_;
+    TokenCache token_cache_;
     WorkspaceConfig &config_;
     Shock shock_;
     UserAgent user_agent_;
-    AuthToken ws_auth_;
+    ServiceTokenManager service_token_;
 
 public:
     WorkspaceState(boost::asio::io_context &ioc,
@@ -30,42 +33,42 @@ public:
 		   Shock &&shock,
 		   UserAgent &&user_agent)
 	: ioc_(ioc)
+	, token_cache_(config.token_cache_size())
 	, config_(config)
 	, shock_(std::move(shock))
-	, user_agent_(std::move(user_agent)) {
+	, user_agent_(std::move(user_agent))
+	, service_token_(ioc, config, user_agent_) {
+	service_token_.start();
     }
-    ~WorkspaceState() { std::cerr << "destroy  WorkspaceState\n"; }
+    ~WorkspaceState() { WSLOG(wslog::thread_logger("state"), wslog::debug) << "destroy  WorkspaceState\n"; }
 
     const SigningCerts &signing_certs () const { return certs_; }
-    bool validate_certificate(const AuthToken &tok) { return certs_.validate(tok); }
+
+    /*
+     * Verify the signature on tok. Tokens that have verified before
+     * are answered from the cache without the RSA operation.
+     */
+    bool validate_certificate(const AuthToken &tok) {
+	if (token_cache_.lookup(tok))
+	    return true;
+	bool ok = certs_.validate(tok);
+	if (ok)
+	    token_cache_.insert(tok);
+	return ok;
+    }
 
     WorkspaceConfig &config() { return config_; }
     const WorkspaceConfig &config() const { return config_; }
     Shock &shock() { return shock_; }
     boost::asio::io_context &ioc() { return ioc_; }
 
-    AuthToken &ws_auth(boost::asio::yield_context yield) {
-	if (!ws_auth_.valid())
-	{
-	    std::string auth = "Basic " + base64EncodeText(config().get_string("wsuser") + ":" +
-							   config().get_string("wspassword"));
-	    std::string token;
-	    URL u("https://rast.nmpdr.org/goauth/token?grant_type=client_credentials");
-	    user_agent_.request("GET", u, {{ "Authorization", auth }}, [&token ] (const UserAgent::Response &r)
-		{
-		    token = r.body();
-		}, yield);
-	    try {
-		auto doc = boost::json::parse(token);
-		auto obj = doc.as_object();
-		auto tok = obj["access_token"].as_string();
-		ws_auth_.parse(std::string(tok.data(), tok.size()));
-	    } catch (std::exception &e) {
-		std::cerr << "Cannot parse WS token: " << e.what() << "\n";
-	    }
-	}
-	return ws_auth_;
-    };
+    /*
+     * The service's own token, for Shock operations done on behalf
+     * of the workspace.
+     */
+    std::shared_ptr<const AuthToken> ws_auth(boost::asio::yield_context yield) {
+	return service_token_.get(yield);
+    }
 };
 
 #endif
@@ -8,10 +8,13 @@
 #include <vector>
 #include <boost/regex.hpp>
 #include <boost/json/array.hpp>
+#include <boost/json/object.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <experimental/optional>
 
+#include "Logging.h"
+
 
 inline std::string format_time(const std::tm &time)
 {
@@ -129,7 +132,7 @@ public:
     explicit UserPermission(const boost::json::value &p) {
 	if (p.kind() == boost::json::kind::array)
 	{
-	    auto ar = p.as_array();
+	    const auto &ar = p.as_array();
 	    user_ = ar.at(0).as_string().c_str();
 	    permission_ = to_permission(ar.at(1).as_string().c_str());
 	    if (permission_ == WSPermission::invalid)
@@ -150,7 +153,7 @@ public:
     UserPermission(UserPermission &&p)
 	: user_(std::move(p.user_))
 	, permission_(p.permission_) {
-	std::cerr << "UP move construct\n";
+	WSLOG(wslog::thread_logger("types"), wslog::debug) << "UP move construct\n";
     }
 
     const std::string & user() const { return user_;}
@@ -185,11 +188,10 @@ public:
 
     void serialize_permissions(boost::json::array &obj) {
 
-	boost::json::array perm{"global_permission", to_string(global_permission) };
-	obj.emplace_back(perm);
-	for (auto elt: user_permission)
+	obj.emplace_back(boost::json::array({ "global_permission", to_string(global_permission) }, obj.storage()));
+	for (auto &elt: user_permission)
 	{
-	    obj.emplace_back(boost::json::array { elt.first, to_string(elt.second) });
+	    obj.emplace_back(boost::json::array({ elt.first, to_string(elt.second) }, obj.storage()));
 	}
     }
     bool has_valid_name() const {
@@ -225,6 +227,14 @@ public:
 	res += name;
 	return res;
     }
+    // The path as the user writes it: /owner/workspace/path/name
+    std::string user_path() const {
+	std::string res = "/" + workspace.owner + "/" + workspace.name;
+	std::string rest = full_path();
+	if (!rest.empty())
+	    res += "/" + rest;
+	return res;
+    }
     bool has_valid_name() const {
 	return !name.empty() && name.find_first_of("/") == std::string::npos;
     }
@@ -275,7 +285,7 @@ public:
 	}
 	else
 	{
-	    std::cerr << "No match for " << match_re << " in " << path << "\n";
+	    WSLOG(wslog::thread_logger("types"), wslog::debug) << "No match for " << match_re << " in " << path << "\n";
 	    return {};
 	}
     }
@@ -319,6 +329,48 @@ public:
 	
 };
 
+/**
+ * Rewrites paths below one folder to the same place below another, as
+ * WSPath::replace_path_prefix does, but with the prefixes worked out once
+ * so that it is cheap to apply to every object in a large tree.
+ */
+class WSPathRewriter
+{
+    std::string from_;
+    std::string to_;
+    WSWorkspace to_workspace_;
+
+public:
+    WSPathRewriter(const WSPath &from, const WSPath &to)
+	: from_(from.full_path())
+	, to_(to.full_path())
+	, to_workspace_(to.workspace) {}
+
+    /**
+     * The new location of p, or an empty value if p is not inside from.
+     */
+    std::experimental::optional<WSPath> rewrite(const WSPath &p) const {
+	std::string rest;
+	if (from_.empty())
+	{
+	    if (!p.path.empty())
+		rest = "/" + p.path;
+	}
+	else
+	{
+	    if (p.path.compare(0, from_.size(), from_) != 0 ||
+		(p.path.size() > from_.size() && p.path[from_.size()] != '/'))
+		return {};
+	    rest = p.path.substr(from_.size());
+	}
+
+	WSPath ret = p;
+	ret.path = to_.empty() ? (rest.empty() ? rest : rest.substr(1)) : to_ + rest;
+	ret.workspace = to_workspace_;
+	return ret;
+    }
+};
+
 class ObjectMeta
 {
 public:
@@ -364,11 +416,16 @@ public:
     bool is_folder() const {
 	return type == "folder" || type == "modelfolder";
     }
-    boost::json::value serialize() {
+    /*
+     * Build the JSON form of the metadata, allocating from sp. Pass the
+     * storage of the container the result is going into so that it can
+     * be moved there rather than copied.
+     */
+    boost::json::value serialize(boost::json::storage_ptr sp = {}) {
 	if (valid)
 	{
-	    boost::json::object am;
-	    for (auto x: auto_metadata) {
+	    boost::json::object am(sp);
+	    for (auto &x: auto_metadata) {
 		am.emplace(x.first, x.second);
 	    }
 	    am.emplace("is_folder", (type == "folder" || type == "modelfolder") ? 1 : 0);
@@ -376,19 +433,41 @@ public:
 	    return boost::json::array({name, type, path,
 		    creation_time, id, 
 		    owner, size,
-		    user_metadata, am, user_permission, global_permission, shockurl, error });
+		    user_metadata, std::move(am), user_permission, global_permission, shockurl, error }, sp);
 	}
 	else
 	{
-	    return boost::json::array({nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, error });
+	    return boost::json::array({nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, error }, sp);
 
 	}
     }
+    /*
+     * The compact form used by lightweight listings: the first seven
+     * fields of the full form, which are all that a compact lookup
+     * fills in.
+     */
+    boost::json::value serialize_compact(boost::json::storage_ptr sp = {}) {
+	if (valid)
+	    return boost::json::array({name, type, path, creation_time, id, owner, size}, sp);
+	else
+	    return boost::json::array({nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr}, sp);
+    }
     std::string creation_time_str() const {
 	return format_time(creation_time);
     }
 };
 
+/*
+ * Position of an object within its workspace in listing order, which is
+ * by path and then name. A paged listing resumes after the last key it
+ * returned.
+ */
+struct ObjectKey
+{
+    std::string path;
+    std::string name;
+};
+
 /**
  * A struct wrapper for the object parameter passed to
  * the create method.
@@ -423,13 +502,13 @@ struct ObjectToCreate
      */
     explicit ObjectToCreate(const boost::json::value &val)
 	: creation_time{ 0, 0, 0, 0, 0, 0 } {
-	auto obj = val.as_array();
+	const auto &obj = val.as_array();
 	path = obj[0].as_string().c_str();
 	type = obj[1].as_string().c_str();
 	if (obj.size() >= 3)
 	{
-	    auto m = obj[2].as_object();
-	    for (auto elt: m)
+	    const auto &m = obj[2].as_object();
+	    for (auto &elt: m)
 	    {
 		auto &val =  elt.value();
 		switch (val.kind())
@@ -501,13 +580,13 @@ struct ObjectToModify
      * } update_metadata_params
      */
     explicit ObjectToModify(const boost::json::value &val) {
-	auto obj = val.as_array();
+	const auto &obj = val.as_array();
 	path = obj[0].as_string().c_str();
 	if (obj.size() >= 2 && obj[1].kind() == boost::json::kind::object)
 	{
 	    user_metadata.emplace(std::map<std::string, std::string>());
-	    auto m = obj[1].as_object();
-	    for (auto elt: m)
+	    const auto &m = obj[1].as_object();
+	    for (auto &elt: m)
 	    {
 		auto &val =  elt.value();
 		switch (val.kind())
@@ -567,9 +646,7 @@ struct ObjectToModify
  */
 class RemovalRequest
 {
-
-private:
-
+public:
     /**
      * Shock object be removed. We keep the
      * workspace ID with the data in order to last-user-out removal
@@ -580,6 +657,8 @@ private:
 	std::string ws_id;
     };
 
+private:
+
     /**
      * List of shock objects to be removed.
      */
@@ -608,6 +687,11 @@ public:
 	directories_.emplace_back(p);
     }
 
+    const std::vector<ShockObj> &shock_objects() const { return shock_urls_; }
+    const std::vector<boost::filesystem::path> &files() const { return files_; }
+    const std::vector<boost::filesystem::path> &directories() const { return directories_; }
+    bool empty() const { return shock_urls_.empty() && files_.empty() && directories_.empty(); }
+
     friend inline std::ostream &operator<<(std::ostream &os, const RemovalRequest &r) {
 	os << "RemovalRequest\n"
 	   << "Shock:\n";
@@ -626,6 +710,40 @@ public:
     }
 };
 
+/**
+ * What a copy did: the number of objects created and bytes of file
+ * data written, how many of the files were reflinks rather than new
+ * data, and the destination paths that could not be copied, with the
+ * reason.
+ */
+struct CopyReport
+{
+    size_t objects;
+    size_t folders;
+    size_t bytes;
+    size_t reflinked;
+    std::vector<std::pair<std::string, std::string>> failed;
+
+    CopyReport() : objects(0), folders(0), bytes(0), reflinked(0) {}
+
+    void add_failure(const std::string &path, const std::string &reason) {
+	failed.emplace_back(path, reason);
+    }
+
+    boost::json::value serialize(boost::json::storage_ptr sp = {}) const {
+	boost::json::array f(sp);
+	for (auto &x: failed)
+	    f.emplace_back(boost::json::array({x.first, x.second}, sp));
+	boost::json::object ret(sp);
+	ret.emplace("objects", objects);
+	ret.emplace("folders", folders);
+	ret.emplace("bytes", bytes);
+	ret.emplace("reflinked", reflinked);
+	ret.emplace("failed", std::move(f));
+	return ret;
+    }
+};
+
 inline std::ostream &operator<<(std::ostream &os, const std::map<std::string, std::string> &m)
 {
     os << "{";
@@ -12,6 +12,7 @@
 #include "SigningCerts.h"
 #include "Shock.h"
 #include "RootCertificates.h"
+#include "Tracing.h"
 
 using namespace ws_http_server;
 
@@ -33,7 +34,7 @@ int main(int argc, char *argv[])
     auto const port = static_cast<unsigned short>(std::atoi(argv[1]));
     auto const threads = std::max<int>(1, std::atoi(argv[2]));
 
-    BOOST_LOG_SEV(lg, wslog::debug) << "Listening on " << port << " with " << threads << " threads\n";
+    WSLOG(lg, wslog::debug) << "Listening on " << port << " with " << threads << " threads\n";
 
     /*
      * Overall system configuration.
@@ -74,17 +75,19 @@ int main(int argc, char *argv[])
     // Parse config
     if (!config.parse())
     {
-	std::cerr << "Error parsing workspace configuration\n";
+	WSLOG(lg, wslog::critical) << "Error parsing workspace configuration\n";
 	return 1;
     }
 
+    tracing::init(config.trace_file(), config.trace_sample_every(), config.trace_buffer_size());
+
     // SSL support
     
     ssl::context ssl_ctx{ssl::context::tlsv12_client};
     std::ifstream certs("/etc/pki/tls/cert.pem");
     if (!certs)
     {
-	std::cerr << "cannot load certs file\n";
+	WSLOG(lg, wslog::critical) << "cannot load certs file\n";
 	return 1;
     }
     boost::system::error_code ec;
@@ -123,11 +126,20 @@ int main(int argc, char *argv[])
     // Create our listener and start it running.
 
     Server server(ioc, global_state.config().api_root(), dispatcher, workspace_service, shock);
+    server.max_requests_per_connection(global_state.config().max_requests_per_connection());
+    server.idle_timeout(std::chrono::seconds(global_state.config().keepalive_timeout()));
+    server.reuse_port(global_state.config().reuse_port());
+    server.retry_after(global_state.config().overload_retry_after());
+    server.compression_min_size(global_state.config().compression_min_size());
+    server.batch_concurrency(global_state.config().batch_concurrency());
 
     server.run(address, port, threads);
 
     dispatcher.unregister_service("Workspace");
 
+    tracing::shutdown();
+    wslog::shutdown();
+
     SSL_finish();
     
     return EXIT_SUCCESS;
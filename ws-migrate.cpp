@@ -0,0 +1,82 @@
+/*
+ * Bring an existing workspace database up to the layout described in
+ * WorkspaceSchema.h: rewrite object paths into stored form, then build
+ * the indexes.
+ *
+ * Paths are rewritten before the indexes are built so that the index
+ * build sees the final values. The tool may be rerun; documents already
+ * in stored form are not touched.
+ */
+
+#include "WorkspaceSchema.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <mongocxx/client.hpp>
+#include <mongocxx/collection.hpp>
+#include <mongocxx/database.hpp>
+#include <mongocxx/instance.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/uri.hpp>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+int main(int argc, char *argv[])
+{
+    bool dry_run = argc == 4 && strcmp(argv[3], "--dry-run") == 0;
+    if (argc != 3 && !dry_run)
+    {
+	std::cerr << "Usage: " << argv[0] << " mongodb-url database [--dry-run]\n";
+	return EXIT_FAILURE;
+    }
+
+    mongocxx::instance instance;
+    mongocxx::client client{mongocxx::uri{argv[1]}};
+    auto db = client[argv[2]];
+    auto objects = db["objects"];
+
+    try {
+	mongocxx::options::find opts;
+	opts.projection(make_document(kvp("_id", 1), kvp("path", 1)));
+
+	long examined = 0, rewritten = 0;
+	auto cursor = objects.find({}, opts);
+	for (const auto &doc: cursor)
+	{
+	    examined++;
+	    auto elt = doc["path"];
+	    if (elt.type() != bsoncxx::type::k_utf8)
+		continue;
+	    std::string path = elt.get_utf8().value.to_string();
+	    std::string canon = schema::canonical_path(path);
+	    if (canon == path)
+		continue;
+
+	    rewritten++;
+	    std::cout << "'" << path << "' => '" << canon << "'\n";
+	    if (!dry_run)
+		objects.update_one(make_document(kvp("_id", doc["_id"].get_value())),
+				   make_document(kvp("$set", make_document(kvp("path", canon)))));
+	}
+	std::cout << examined << " objects examined, " << rewritten
+		  << (dry_run ? " to be rewritten\n" : " rewritten\n");
+
+	if (!dry_run)
+	{
+	    schema::create_indexes(db);
+	    std::cout << "indexes created\n";
+	}
+    } catch (std::exception &e) {
+	std::cerr << "Migration failed: " << e.what() << "\n";
+	return EXIT_FAILURE;
+    }
+
+    return 0;
+}